@@ -0,0 +1,224 @@
+#include "htext_app.c"
+#include "htext_app.h"
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+
+#define BENCH_DATA_PATH "build/bench_data"
+#define BENCH_DUMP_PATH "build/bench_dump"
+// NOTE: mutations in the middle of the buffer cost O(lines), the number of
+// repetitions shrinks with the buffer so the big sizes finish in seconds
+#define BENCH_WORK (100 * 1000 * 1000)
+#define BENCH_MAX_ITERATIONS 10000
+#define BENCH_MIN_ITERATIONS 10
+
+typedef enum { BenchFormat_csv, BenchFormat_json } BenchFormat;
+
+typedef struct {
+  BenchFormat format;
+  int32_t result_count;
+} Bench;
+
+static uint64_t bench_now_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void bench_report(Bench *bench, char *op, int32_t lines,
+                         int32_t iterations, uint64_t total_ns) {
+  real64 ns_per_op = (real64)total_ns / iterations;
+  if (bench->format == BenchFormat_csv) {
+    printf("%s,%d,%d,%llu,%.1f\n", op, lines, iterations,
+           (unsigned long long)total_ns, ns_per_op);
+  } else {
+    printf("%s  {\"op\": \"%s\", \"lines\": %d, \"iterations\": %d, "
+           "\"total_ns\": %llu, \"ns_per_op\": %.1f}",
+           bench->result_count > 0 ? ",\n" : "", op, lines, iterations,
+           (unsigned long long)total_ns, ns_per_op);
+  }
+  bench->result_count++;
+}
+
+static void bench_write_data(int32_t lines) {
+  FILE *f = fopen(BENCH_DATA_PATH, "w");
+  assert(f != NULL);
+  for (int32_t i = 0; i < lines; ++i) {
+    fprintf(f, "%d. This is a line of a benchmark buffer\n", i + 1);
+  }
+  fclose(f);
+}
+
+static void bench_cursor_to_middle(EditorFrame *frame) {
+  editor_frame_move_cursor_v(
+      frame, frame->line_count / 2 - frame->cursor.line_num, NULL);
+}
+
+static void bench_size(Bench *bench, MemoryArena *transient_arena,
+                       EditorFrame *frame, int32_t lines) {
+  bench_write_data(lines);
+  int32_t iterations = BENCH_WORK / lines;
+  if (iterations > BENCH_MAX_ITERATIONS) {
+    iterations = BENCH_MAX_ITERATIONS;
+  }
+  if (iterations < BENCH_MIN_ITERATIONS) {
+    iterations = BENCH_MIN_ITERATIONS;
+  }
+  uint64_t start;
+
+  start = bench_now_ns();
+  int r = editor_frame_load_file(transient_arena, frame, BENCH_DATA_PATH);
+  bench_report(bench, "load_file", lines, 1, bench_now_ns() - start);
+  assert(r == 0);
+  // NOTE: the file ends with a new line
+  assert(frame->line_count == lines + 1);
+
+  start = bench_now_ns();
+  for (int32_t i = 0; i < BENCH_MIN_ITERATIONS; ++i) {
+    frame->index_valid_size = 0;
+    editor_frame_reindex(frame);
+  }
+  bench_report(bench, "reindex", lines, BENCH_MIN_ITERATIONS,
+               bench_now_ns() - start);
+
+  // NOTE: a whole pass at once, the app spreads it over frames
+  start = bench_now_ns();
+  editor_frame_cold_step(transient_arena, frame, frame->line_count);
+  bench_report(bench, "cold_step", lines, 1, bench_now_ns() - start);
+
+  bench_cursor_to_middle(frame);
+  start = bench_now_ns();
+  for (int32_t i = 0; i < iterations; ++i) {
+    editor_frame_insert_text(frame, "x", 1);
+  }
+  bench_report(bench, "insert_text", lines, iterations,
+               bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (int32_t i = 0; i < iterations; ++i) {
+    editor_frame_remove_char(frame);
+  }
+  bench_report(bench, "remove_char", lines, iterations,
+               bench_now_ns() - start);
+
+  start = bench_now_ns();
+  for (int32_t i = 0; i < iterations; ++i) {
+    editor_frame_insert_new_line(frame);
+  }
+  bench_report(bench, "insert_new_line", lines, iterations,
+               bench_now_ns() - start);
+
+  bench_cursor_to_middle(frame);
+  start = bench_now_ns();
+  for (int32_t i = 0; i < iterations; ++i) {
+    editor_frame_remove_lines(frame, 1);
+  }
+  bench_report(bench, "remove_lines", lines, iterations,
+               bench_now_ns() - start);
+
+  start = bench_now_ns();
+  r = editor_frame_dump_file(transient_arena, frame, BENCH_DUMP_PATH, false);
+  bench_report(bench, "dump_file", lines, 1, bench_now_ns() - start);
+  assert(r == 0);
+
+  // NOTE: saving back copies the unchanged ranges around one edited line
+  r = editor_frame_load_file(transient_arena, frame, BENCH_DATA_PATH);
+  assert(r == 0);
+  bench_cursor_to_middle(frame);
+  editor_frame_insert_text(frame, "x", 1);
+  start = bench_now_ns();
+  r = editor_frame_dump_file(transient_arena, frame, BENCH_DATA_PATH, true);
+  bench_report(bench, "save_one_change", lines, 1, bench_now_ns() - start);
+  assert(r == 0);
+
+  start = bench_now_ns();
+  r = editor_frame_dump_file(transient_arena, frame, BENCH_DATA_PATH, true);
+  bench_report(bench, "save_unchanged", lines, 1, bench_now_ns() - start);
+  assert(r == 1);
+}
+
+// NOTE: the picker ranks a query typed one key at a time, the first key
+// scans every file and the next ones narrow down what matched
+static void bench_file_rank(Bench *bench, MemoryArena *arena, int32_t files) {
+  FileIndex *index = file_index_create(arena, Gigabytes(1), ".", "");
+  FileList *list = index->lists + index->current;
+  list->files = pushArray(&list->arena, files, char *, DEFAULT_ALIGNMENT);
+  list->masks = pushArray(&list->arena, files, uint64_t, DEFAULT_ALIGNMENT);
+  char path[128];
+  for (int32_t i = 0; i < files; ++i) {
+    sprintf(path, "src/module_%d/component%d/file_%d.c", i % 97, i % 1013, i);
+    list->files[i] = push_string(&list->arena, path);
+    list->masks[i] = fuzzy_mask(path, strlen(path));
+  }
+  list->file_count = list->file_size = files;
+
+  char *query = "mod12comp";
+  int32_t iterations = BENCH_MIN_ITERATIONS;
+  uint64_t total = 0;
+  uint64_t first = 0;
+  for (int32_t i = 0; i < iterations; ++i) {
+    index->ranked_list = NULL;
+    for (int32_t len = 1; len <= (int32_t)strlen(query); ++len) {
+      uint64_t start = bench_now_ns();
+      file_index_rank(index, query, len);
+      uint64_t elapsed = bench_now_ns() - start;
+      total += elapsed;
+      first += len == 1 ? elapsed : 0;
+    }
+  }
+  assert(index->result_count > 0);
+  bench_report(bench, "file_rank_first_key", files, iterations, first);
+  bench_report(bench, "file_rank_query", files, iterations, total);
+}
+
+// NOTE: usage: bench [--json] [--max-lines N]
+int main(int argc, char **argv) {
+  Bench bench = {.format = BenchFormat_csv};
+  int32_t max_lines = 10 * 1000 * 1000;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--json") == 0) {
+      bench.format = BenchFormat_json;
+    } else if (strcmp(argv[i], "--max-lines") == 0 && i + 1 < argc) {
+      max_lines = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--json] [--max-lines N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  uint64_t persistentSize = Gigabytes(64);
+  uint64_t transientSize = Gigabytes(1);
+  void *memoryBlock =
+      mmap(NULL, persistentSize + transientSize, PROT_NONE,
+           MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+  assert(memoryBlock != MAP_FAILED);
+
+  MemoryArena arena;
+  MemoryArena transient_arena;
+  initializeArena(&arena, persistentSize, memoryBlock);
+  initializeArena(&transient_arena, transientSize,
+                  ((uint8_t *)memoryBlock) + persistentSize);
+
+  EditorFrame frame = editor_frame_create(&arena);
+  // NOTE: the cursor stays in view, like it does in the editor
+  frame.viewport_v.size = 50;
+  frame.viewport_h.size = 100;
+
+  if (bench.format == BenchFormat_csv) {
+    printf("op,lines,iterations,total_ns,ns_per_op\n");
+  } else {
+    printf("[\n");
+  }
+  for (int32_t lines = 1000; lines <= max_lines; lines *= 10) {
+    bench_size(&bench, &transient_arena, &frame, lines);
+  }
+  bench_file_rank(&bench, &arena, 300 * 1000);
+  if (bench.format == BenchFormat_json) {
+    printf("\n]\n");
+  }
+
+  remove(BENCH_DATA_PATH);
+  remove(BENCH_DUMP_PATH);
+  return 0;
+}
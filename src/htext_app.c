@@ -5,6 +5,7 @@
 #include <SDL2/SDL_rect.h>
 #include <SDL2/SDL_render.h>
 #include <SDL2/SDL_ttf.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -14,6 +15,7 @@
 #define BG_COLOR 0x00000000
 #define EDITOR_FONT_COLOR 0x08a00300
 #define CURSOR_COLOR 0xFFFFFF9F
+#define SELECTION_COLOR 0x264F78FF
 
 #define MODELINE_BG_COLOR 0x595959FF
 #define MODELINE_FONT_COLOR 0xFFFFFF00
@@ -22,8 +24,21 @@
 
 #define EX_FONT_COLOR 0xFFFFFF00
 
+// NOTE: lines wrapped per frame ahead of scrolling after a resize
+#define WRAP_STEP_LINES 20000
+#define COLD_STEP_LINES 16384
+
+#include "htext_journal.c"
+#include "htext_latency.c"
+#include "htext_text_register.c"
+#include "htext_lz.c"
 #include "htext_editor_frame.c"
+#include "htext_ex_command.c"
+#include "htext_batch.c"
 #include "htext_ex_frame.c"
+#include "htext_grep.c"
+#include "htext_file_index.c"
+#include "htext_glyph_atlas.c"
 
 SDL_Texture *texture_from_text(SDL_Renderer *renderer, TTF_Font *font,
                                char *text, SDL_Color color, int32_t *w) {
@@ -37,11 +52,256 @@ SDL_Texture *texture_from_text(SDL_Renderer *renderer, TTF_Font *font,
   return texture;
 }
 
-CachedTexture cached_texture_create(SDL_Renderer *renderer, TTF_Font *font,
-                                    char *text, SDL_Color color) {
-  CachedTexture cached;
-  cached.texture = texture_from_text(renderer, font, text, color, &cached.w);
-  return cached;
+static inline int32_t glyph_width(State *state, char c) {
+  if (c < ASCII_LOW || c > ASCII_HIGH) {
+    c = '?';
+  }
+  return state->glyph_width[c - ASCII_LOW];
+}
+
+static void text_advances_compute(State *state, char *text, int32_t len,
+                                  int32_t *advances) {
+  advances[0] = 0;
+  for (int32_t i = 0; i < len; ++i) {
+    advances[i + 1] = advances[i] + glyph_width(state, text[i]);
+  }
+}
+
+// NOTE: the texture and the advances are built for the horizontal viewport
+static LineRender *line_check_texture_column(EditorFrame *frame, Line *line) {
+  LineRender *render = line_render(frame, line);
+  if (render == NULL) {
+    return NULL;
+  }
+  if (render->texture_dirty ||
+      render->texture_column != frame->viewport_h.start) {
+    line_invalidate_texture(line);
+    render->texture_column = frame->viewport_h.start;
+  }
+  return render;
+}
+
+// NOTE: x offset of column from the first visible column of the line, columns
+// outside of the visible part are clamped to it. O(1) for monospace fonts,
+// proportional fonts use the line prefix sum which is rebuilt only after the
+// texture is invalidated. Without room for it the widths are added up here
+int32_t line_column_x(State *state, Line *line, int32_t column) {
+  Viewport viewport_h = state->editor_frame.viewport_h;
+  int32_t visible_len = line->len - viewport_h.start;
+  if (visible_len > viewport_h.size) {
+    visible_len = viewport_h.size;
+  }
+  if (visible_len < 0) {
+    visible_len = 0;
+  }
+
+  int32_t i = column - viewport_h.start;
+  if (i < 0) {
+    i = 0;
+  } else if (i > visible_len) {
+    i = visible_len;
+  }
+
+  if (state->monospace) {
+    return i * state->glyph_advance;
+  }
+
+  char *text = line_text(&state->editor_frame, line) + viewport_h.start;
+  LineRender *render = line_check_texture_column(&state->editor_frame, line);
+  if (render != NULL && !render->advances_valid &&
+      render->advances_size < visible_len + 1) {
+    int32_t *advances = pushArray(&state->editor_frame.arena,
+                                  viewport_h.size + 1, int32_t,
+                                  DEFAULT_ALIGNMENT);
+    if (advances == NULL) {
+      render = NULL;
+    } else {
+      state->editor_frame.abandoned_size +=
+          render->advances_size * sizeof(int32_t);
+      render->advances = advances;
+      render->advances_size = viewport_h.size + 1;
+    }
+  }
+  if (render == NULL) {
+    int32_t x = 0;
+    for (int32_t j = 0; j < i; ++j) {
+      x += glyph_width(state, text[j]);
+    }
+    return x;
+  }
+  if (!render->advances_valid) {
+    text_advances_compute(state, text, visible_len, render->advances);
+    render->advances_valid = true;
+  }
+  return render->advances[i];
+}
+
+int32_t ex_frame_column_x(State *state, ExFrame *frame, int32_t column) {
+  assert(column <= frame->size);
+  if (state->monospace) {
+    return column * state->glyph_advance;
+  }
+
+  if (!frame->advances_valid) {
+    text_advances_compute(state, frame->text, frame->size, frame->advances);
+    frame->advances_valid = true;
+  }
+  return frame->advances[column];
+}
+
+static char *font_path(void) {
+  char *path = getenv("HTEXT_FONT");
+  if (path == NULL || path[0] == '\0') {
+    path = FONT_PATH;
+  }
+  return path;
+}
+
+// NOTE: also drops fonts and surfaces of a snapshot without freeing them
+static void raster_pool_reset(RasterPool *raster) {
+  memset(raster, 0, sizeof(*raster));
+  for (int32_t i = 0; i < RASTER_JOB_COUNT; ++i) {
+    raster->jobs[i].pool = raster;
+  }
+}
+
+static RasterPool *raster_pool_create(MemoryArena *arena) {
+  RasterPool *raster = pushStruct(arena, RasterPool, DEFAULT_ALIGNMENT);
+  raster_pool_reset(raster);
+  return raster;
+}
+
+// NOTE: waits for the workers before the fonts are closed
+static void raster_pool_destroy(RasterPool *raster, Memory *memory) {
+  if (memory->work_queue != NULL) {
+    memory->complete_all_work(memory->work_queue);
+  }
+  for (int32_t i = 0; i < RASTER_FONT_COUNT; ++i) {
+    if (raster->fonts[i] != NULL) {
+      TTF_CloseFont(raster->fonts[i]);
+      raster->fonts[i] = NULL;
+    }
+  }
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(raster_job_run) {
+  (void)queue;
+  RasterJob *job = data;
+  RasterPool *raster = job->pool;
+  int32_t slot = 0;
+  while (__atomic_exchange_n(raster->font_locks + slot, 1, __ATOMIC_ACQUIRE)) {
+    slot = (slot + 1) % RASTER_FONT_COUNT;
+  }
+  job->surface = TTF_RenderText_Solid(raster->fonts[slot], job->text,
+                                      job->color);
+  __atomic_store_n(raster->font_locks + slot, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&job->state, RasterJob_done, __ATOMIC_RELEASE);
+}
+
+// NOTE: returns false when every job is taken, the line is tried again the
+// next frame
+static bool raster_job_issue(RendererContext context, Line *line, char *text,
+                             int32_t size, SDL_Color color) {
+  RasterPool *raster = context.state->raster;
+  RasterJob *job = NULL;
+  for (int32_t i = 0; i < RASTER_JOB_COUNT; ++i) {
+    if (__atomic_load_n(&raster->jobs[i].state, __ATOMIC_ACQUIRE) ==
+        RasterJob_free) {
+      job = raster->jobs + i;
+      break;
+    }
+  }
+  if (job == NULL) {
+    return false;
+  }
+  if (raster->fonts[0] == NULL) {
+    for (int32_t i = 0; i < RASTER_FONT_COUNT; ++i) {
+      raster->fonts[i] =
+          TTF_cpointer(TTF_OpenFont(font_path(), context.state->font_size));
+    }
+  }
+
+  job->line = line;
+  job->color = color;
+  charcpy(job->text, text, size);
+  job->text[size] = '\0';
+  job->surface = NULL;
+  job->state = RasterJob_queued;
+  line->render->raster_job = job;
+  raster->async_count++;
+  context.memory->add_work_entry(context.memory->work_queue, raster_job_run,
+                                 job);
+  return true;
+}
+
+// NOTE: turns the surfaces the workers are done with into textures, the ones
+// of lines that changed in the meantime are dropped
+static void raster_jobs_collect(RendererContext context) {
+  RasterPool *raster = context.state->raster;
+  raster->sync_budget = RASTER_SYNC_LINES;
+  for (int32_t i = 0; i < RASTER_JOB_COUNT; ++i) {
+    RasterJob *job = raster->jobs + i;
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != RasterJob_done) {
+      continue;
+    }
+    if (job->line != NULL) {
+      LineRender *render = job->line->render;
+      assert(render->raster_job == job);
+      render->raster_job = NULL;
+      if (job->surface != NULL) {
+        render->texture = SDL_cpointer(
+            SDL_CreateTextureFromSurface(context.renderer, job->surface));
+        render->texture_width = job->surface->w;
+        render->texture_serial = ++context.state->texture_serial;
+      }
+    }
+    if (job->surface != NULL) {
+      SDL_FreeSurface(job->surface);
+    }
+    job->surface = NULL;
+    job->line = NULL;
+    job->state = RasterJob_free;
+  }
+}
+
+// NOTE: rasterizes the visible part of the line unless it already has a
+// texture for it, or one is on the way. With worker threads only the first
+// RASTER_SYNC_LINES lines of a frame are rasterized here, the others show
+// nothing until their job is done. Returns true when a texture was created
+// or a job was issued
+static bool line_texture_update(RendererContext context, Line *line,
+                                SDL_Color color) {
+  Viewport viewport_h = context.state->editor_frame.viewport_h;
+  LineRender *render =
+      line_check_texture_column(&context.state->editor_frame, line);
+  if (render == NULL || render->texture != NULL || render->raster_job != NULL ||
+      line->len <= viewport_h.start) {
+    return false;
+  }
+
+  int32_t str_to_render_size = line->len - viewport_h.start;
+  if (str_to_render_size > viewport_h.size) {
+    str_to_render_size = viewport_h.size;
+  }
+  char *text = line_text(&context.state->editor_frame, line);
+  RasterPool *raster = context.state->raster;
+  if (context.memory->work_queue != NULL && raster->sync_budget <= 0 &&
+      str_to_render_size < RASTER_JOB_TEXT_SIZE) {
+    return raster_job_issue(context, line, text + viewport_h.start,
+                            str_to_render_size, color);
+  }
+  raster->sync_budget--;
+
+  char *str_to_render = pushSize(context.transient_arena,
+                                 str_to_render_size + 1, DEFAULT_ALIGNMENT);
+  charcpy(str_to_render, text + viewport_h.start, str_to_render_size);
+  str_to_render[str_to_render_size] = '\0';
+
+  render->texture =
+      texture_from_text(context.renderer, context.state->font, str_to_render,
+                        color, &render->texture_width);
+  render->texture_serial = ++context.state->texture_serial;
+  return true;
 }
 
 void editor_frame_render_line(RendererContext context, Line *line,
@@ -49,19 +309,18 @@ void editor_frame_render_line(RendererContext context, Line *line,
   State *state = context.state;
   EditorFrame *frame = &state->editor_frame;
   Viewport viewport_h = frame->viewport_h;
-  int16_t cursor_column = frame->cursor.column;
+  int32_t cursor_column = frame->cursor.column;
   const int16_t cursor_w = state->font_h / 2;
 
+  LineRender *render = line_check_texture_column(frame, line);
+
   SDL_Rect dest;
   dest.x = start.x;
   dest.y = start.y;
   dest.h = state->font_h;
 
   if (line == frame->cursor.line) {
-    int16_t cursor_x = dest.x;
-    for (int16_t i = 0; i < cursor_column - viewport_h.start; ++i) {
-      cursor_x += state->glyph_width[line->text[i] - ASCII_LOW];
-    }
+    int32_t cursor_x = dest.x + line_column_x(state, line, cursor_column);
 
     SDL_Rect cursorDest;
     cursorDest.x = cursor_x;
@@ -72,7 +331,7 @@ void editor_frame_render_line(RendererContext context, Line *line,
         SDL_SetRenderDrawBlendMode(context.renderer, SDL_BLENDMODE_BLEND));
     SDL_ccode(SDL_SetRenderDrawColor(context.renderer, UNHEX(CURSOR_COLOR)));
 
-    if (state->mode != AppMode_ex) {
+    if (state->mode != AppMode_ex && state->mode != AppMode_picker) {
       SDL_ccode(SDL_RenderFillRect(context.renderer, &cursorDest));
     } else {
       SDL_ccode(SDL_RenderDrawRect(context.renderer, &cursorDest));
@@ -81,23 +340,10 @@ void editor_frame_render_line(RendererContext context, Line *line,
 
   if (line->len > 0) {
     bool should_render_line = line->len > viewport_h.start;
-    if (line->texture == NULL && should_render_line) {
-      int str_to_render_size = line->len - viewport_h.start;
-      if (str_to_render_size > viewport_h.size) {
-        str_to_render_size = viewport_h.size;
-      }
-      char *str_to_render = pushSize(context.transient_arena,
-                                     str_to_render_size + 1, DEFAULT_ALIGNMENT);
-      charcpy(str_to_render, line->text + viewport_h.start, str_to_render_size);
-      str_to_render[str_to_render_size] = '\0';
-
-      line->texture =
-          texture_from_text(context.renderer, state->font, str_to_render, color,
-                            &line->texture_width);
-    }
-    if (line->texture != NULL && should_render_line) {
-      dest.w = line->texture_width;
-      SDL_ccode(SDL_RenderCopy(context.renderer, line->texture, NULL, &dest));
+    line_texture_update(context, line, color);
+    if (render != NULL && render->texture != NULL && should_render_line) {
+      dest.w = render->texture_width;
+      SDL_ccode(SDL_RenderCopy(context.renderer, render->texture, NULL, &dest));
     }
   }
 
@@ -105,6 +351,284 @@ void editor_frame_render_line(RendererContext context, Line *line,
   dest.x = start.x;
 }
 
+// NOTE: spends what is left of the frame before input->frame_deadline on
+// textures for the page past the viewport in the direction it last moved, so
+// scrolling finds them ready. Nearest lines go first
+static void editor_frame_prefetch(RendererContext context, Input *input,
+                                  SDL_Color color) {
+  State *state = context.state;
+  EditorFrame *frame = &state->editor_frame;
+  Viewport viewport_v = frame->viewport_v;
+  if (viewport_v.start > state->prefetch_viewport_start) {
+    state->prefetch_direction = 1;
+  } else if (viewport_v.start < state->prefetch_viewport_start) {
+    state->prefetch_direction = -1;
+  }
+  state->prefetch_viewport_start = viewport_v.start;
+  if (input->frame_deadline == 0 || editor_frame_wrapping(frame)) {
+    return;
+  }
+
+  bool down = state->prefetch_direction >= 0;
+  int32_t start = down ? viewport_v.start + viewport_v.size
+                       : viewport_v.start - viewport_v.size;
+  int32_t end = start + viewport_v.size;
+  if (start < 0) {
+    start = 0;
+  }
+  if (end > frame->line_count) {
+    end = frame->line_count;
+  }
+  if (start >= end) {
+    return;
+  }
+
+  Line *line = editor_frame_line_at(frame, down ? start : end - 1);
+  for (int32_t i = start; i < end; ++i) {
+    if (SDL_GetPerformanceCounter() >= input->frame_deadline) {
+      break;
+    }
+    if (line_texture_update(context, line, color)) {
+      state->prefetch_count++;
+    }
+    line = down ? line->next : line->prev;
+  }
+}
+
+// NOTE: lines [*start, *end) are selected, and in visual block columns
+// [*column_start, *column_end) of them
+static void visual_selection(State *state, int32_t *start, int32_t *end,
+                             int32_t *column_start, int32_t *column_end) {
+  EditorFrame *frame = &state->editor_frame;
+  int32_t anchor = state->visual_line_num;
+  if (anchor >= frame->line_count) {
+    anchor = frame->line_count - 1;
+  }
+  int32_t cursor = frame->cursor.line_num;
+  *start = anchor < cursor ? anchor : cursor;
+  *end = (anchor > cursor ? anchor : cursor) + 1;
+
+  if (state->mode == AppMode_visual_block) {
+    int32_t column = frame->cursor.column;
+    *column_start =
+        state->visual_column < column ? state->visual_column : column;
+    *column_end =
+        (state->visual_column > column ? state->visual_column : column) + 1;
+  } else {
+    *column_start = 0;
+    *column_end = INT32_MAX;
+  }
+}
+
+// NOTE: x offset of column from the start of a row of a soft wrapped line,
+// clamped to the row
+static int32_t row_column_x(State *state, Line *line, int32_t row,
+                            int32_t column) {
+  int32_t row_end = line_row_end(line, row);
+  if (column > row_end) {
+    column = row_end;
+  }
+  char *text = line_text(&state->editor_frame, line);
+  int32_t x = 0;
+  for (int32_t i = line_row_start(line, row); i < column; ++i) {
+    x += glyph_width(state, text[i]);
+  }
+  return x;
+}
+
+// NOTE: sets the part of the row covered by the visual selection, left empty
+// when the row is not selected. Empty lines of a visual line selection get a
+// cursor wide mark
+static void row_selection_x(State *state, Line *line, int32_t line_num,
+                            int32_t row, ScreenRow *shown) {
+  if (state->mode != AppMode_visual_line &&
+      state->mode != AppMode_visual_block) {
+    return;
+  }
+  int32_t start, end, column_start, column_end;
+  visual_selection(state, &start, &end, &column_start, &column_end);
+  if (line_num < start || line_num >= end) {
+    return;
+  }
+  if (column_end > line->len) {
+    column_end = line->len;
+  }
+  if (column_start > column_end) {
+    return;
+  }
+
+  if (editor_frame_wrapping(&state->editor_frame)) {
+    int32_t row_start = line_row_start(line, row);
+    if (column_start < row_start) {
+      column_start = row_start;
+    }
+    shown->selection_x0 = row_column_x(state, line, row, column_start);
+    shown->selection_x1 = row_column_x(state, line, row, column_end);
+  } else {
+    shown->selection_x0 = line_column_x(state, line, column_start);
+    shown->selection_x1 = line_column_x(state, line, column_end);
+  }
+  if (state->mode == AppMode_visual_line && line->len == 0) {
+    shown->selection_x1 = shown->selection_x0 + state->font_h / 2;
+  }
+}
+
+// NOTE: x offset of the cursor in a row of a soft wrapped line, -1 when the
+// cursor is not on the row
+static int32_t row_cursor_x(State *state, Line *line, int32_t row) {
+  EditorFrame *frame = &state->editor_frame;
+  if (line != frame->cursor.line ||
+      editor_frame_column_row(frame, line, frame->cursor.column) != row) {
+    return -1;
+  }
+  return row_column_x(state, line, row, frame->cursor.column);
+}
+
+// NOTE: a row of a soft wrapped line, drawn glyph by glyph from the atlas so
+// wrapped lines need no textures
+void editor_frame_render_row(RendererContext context, Line *line, int32_t row,
+                             SDL_Point start, SDL_Color color) {
+  State *state = context.state;
+  int32_t row_start = line_row_start(line, row);
+  int32_t row_end = line_row_end(line, row);
+
+  int32_t cursor_x = row_cursor_x(state, line, row);
+  if (cursor_x >= 0) {
+    SDL_Rect cursorDest;
+    cursorDest.x = start.x + cursor_x;
+    cursorDest.y = start.y;
+    cursorDest.h = state->font_h;
+    cursorDest.w = state->font_h / 2;
+    SDL_ccode(
+        SDL_SetRenderDrawBlendMode(context.renderer, SDL_BLENDMODE_BLEND));
+    SDL_ccode(SDL_SetRenderDrawColor(context.renderer, UNHEX(CURSOR_COLOR)));
+    if (state->mode != AppMode_ex && state->mode != AppMode_picker) {
+      SDL_ccode(SDL_RenderFillRect(context.renderer, &cursorDest));
+    } else {
+      SDL_ccode(SDL_RenderDrawRect(context.renderer, &cursorDest));
+    }
+  }
+
+  GlyphAtlas *atlas = &state->atlas;
+  SDL_SetTextureColorMod(atlas->texture, color.r, color.g, color.b);
+  SDL_Rect dest = {.x = start.x, .y = start.y};
+  char *text = line_text(&state->editor_frame, line);
+  for (int32_t i = row_start; i < row_end; ++i) {
+    char c = text[i];
+    if (c < ASCII_LOW || c > ASCII_HIGH) {
+      c = '?';
+    }
+    SDL_Rect src = atlas->glyphs[c - ASCII_LOW];
+    dest.w = src.w;
+    dest.h = src.h;
+    SDL_RenderCopy(context.renderer, atlas->texture, &src, &dest);
+    dest.x += glyph_width(state, c);
+  }
+}
+
+// NOTE: recreates the screen target when the window size changed. Returns
+// true when everything has to be redrawn
+static bool screen_target_update(RendererContext context, int32_t w,
+                                 int32_t h) {
+  State *state = context.state;
+  if (state->screen_target != NULL && state->screen_w == w &&
+      state->screen_h == h) {
+    return false;
+  }
+  if (state->screen_target != NULL) {
+    SDL_DestroyTexture(state->screen_target);
+  }
+  state->screen_target = SDL_cpointer(
+      SDL_CreateTexture(context.renderer, SDL_PIXELFORMAT_ARGB8888,
+                        SDL_TEXTUREACCESS_TARGET, w, h));
+  SDL_ccode(SDL_SetTextureBlendMode(state->screen_target, SDL_BLENDMODE_NONE));
+  state->screen_w = w;
+  state->screen_h = h;
+  return true;
+}
+
+static void screen_clear_rect(SDL_Renderer *renderer, SDL_Rect *rect) {
+  SDL_ccode(SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE));
+  SDL_ccode(SDL_SetRenderDrawColor(renderer, UNHEX(BG_COLOR)));
+  SDL_ccode(SDL_RenderFillRect(renderer, rect));
+}
+
+// NOTE: records what screen row i shows now, returns true when it has to be
+// redrawn
+static bool screen_row_changed(State *state, int32_t i, ScreenRow *row,
+                               bool redraw_all) {
+  if (i >= SCREEN_ROWS_MAX) {
+    return true;
+  }
+  ScreenRow *last = state->screen_rows + i;
+  if (!redraw_all && memcmp(last, row, sizeof(*row)) == 0) {
+    return false;
+  }
+  *last = *row;
+  return true;
+}
+
+// NOTE: everything the modeline and the ex line show
+static uint64_t bottom_signature(State *state) {
+  uint64_t hash = hash_bytes(HASH_SEED, &state->mode, sizeof(state->mode));
+  hash = hash_bytes(hash, state->filename, strlen(state->filename));
+  hash = hash_bytes(hash, state->normal_ksm.keys, state->normal_ksm.keys_size);
+  hash = hash_bytes(hash, &state->recording_register,
+                    sizeof(state->recording_register));
+  hash = hash_bytes(hash, state->ex_frame.text, state->ex_frame.size);
+  hash = hash_bytes(hash, &state->ex_frame.cursor_column,
+                    sizeof(state->ex_frame.cursor_column));
+  return hash_bytes(hash, state->status_message,
+                    strlen(state->status_message) + 1);
+}
+
+// NOTE: everything the picker shows
+static uint64_t picker_signature(State *state) {
+  FileIndex *index = state->file_index;
+  FileList *list = file_index_list(index);
+  uint64_t hash = hash_bytes(HASH_SEED, index->results,
+                             index->result_count * sizeof(int32_t));
+  hash = hash_bytes(hash, &index->selected, sizeof(index->selected));
+  hash = hash_bytes(hash, &index->survivor_count,
+                    sizeof(index->survivor_count));
+  hash = hash_bytes(hash, &index->crawling, sizeof(index->crawling));
+  hash = hash_bytes(hash, &list, sizeof(list));
+  return hash_bytes(hash, &list->file_count, sizeof(list->file_count));
+}
+
+// NOTE: a line with the counts and the best results under it, the best one
+// right above the modeline
+static void picker_render(RendererContext context, int32_t width,
+                          int32_t bottom_y) {
+  State *state = context.state;
+  FileIndex *index = state->file_index;
+  FileList *list = file_index_list(index);
+  SDL_Renderer *renderer = context.renderer;
+  int32_t x = 0.005 * width;
+  int32_t y = bottom_y - (PICKER_RESULT_COUNT + 1) * state->font_h;
+  SDL_Rect rect = {.x = 0,
+                   .y = y,
+                   .w = width,
+                   .h = (PICKER_RESULT_COUNT + 1) * state->font_h};
+  screen_clear_rect(renderer, &rect);
+
+  SDL_Color color = {UNHEX(EDITOR_FONT_COLOR)};
+  char text[64];
+  sprintf(text, "%d of %d files%s", index->survivor_count, list->file_count,
+          index->crawling ? " (indexing)" : "");
+  glyph_atlas_render_text(renderer, &state->atlas, text, x, y, color);
+  for (int32_t i = 0; i < index->result_count; ++i) {
+    rect.y = bottom_y - (i + 1) * state->font_h;
+    rect.h = state->font_h;
+    if (i == index->selected) {
+      SDL_ccode(SDL_SetRenderDrawColor(renderer, UNHEX(SELECTION_COLOR)));
+      SDL_ccode(SDL_RenderFillRect(renderer, &rect));
+    }
+    glyph_atlas_render_text(renderer, &state->atlas,
+                            list->files[index->results[i]], x, rect.y, color);
+  }
+}
+
 void ex_frame_render_line(RendererContext context, SDL_Point start,
                           SDL_Color color) {
   State *state = context.state;
@@ -116,10 +640,8 @@ void ex_frame_render_line(RendererContext context, SDL_Point start,
   dest.y = start.y;
   dest.h = state->font_h;
 
-  int16_t cursor_x = dest.x;
-  for (int16_t i = 0; i < frame->cursor_column; ++i) {
-    cursor_x += state->glyph_width[frame->text[i] - ASCII_LOW];
-  }
+  int32_t cursor_x =
+      dest.x + ex_frame_column_x(state, frame, frame->cursor_column);
 
   SDL_Rect cursorDest;
   cursorDest.x = cursor_x;
@@ -173,6 +695,35 @@ int16_t poll_event(Input *input, SDL_Event *event) {
 }
 #endif
 
+static bool key_register_append(KeyRegister *reg, char key) {
+  if (reg->size == reg->max_size) {
+    reg->overflow = true;
+    return false;
+  }
+  reg->keys[reg->size] = key;
+  reg->size++;
+  return true;
+}
+
+static void key_register_clear(KeyRegister *reg) {
+  reg->size = 0;
+  reg->overflow = false;
+}
+
+static void key_register_create(MemoryArena *arena, KeyRegister *reg) {
+  reg->max_size = KEY_REGISTER_MAX_SIZE;
+  reg->keys = pushSize(arena, reg->max_size, DEFAULT_ALIGNMENT);
+  key_register_clear(reg);
+}
+
+static void stop_recording(State *state) {
+  state->recording_register = -1;
+  if (state->recording_texture != NULL) {
+    SDL_DestroyTexture(state->recording_texture);
+    state->recording_texture = NULL;
+  }
+}
+
 void key_state_machine_reset(KeyStateMachine *ksm) {
   ksm->state = KeyStateMachine_Repetitions;
   ksm->keys_size = 0;
@@ -184,6 +735,33 @@ void key_state_machine_reset(KeyStateMachine *ksm) {
   }
 }
 
+// NOTE: the register picked with " for the next yank or put, then the unnamed
+// one again
+static TextRegister *state_text_register(State *state) {
+  TextRegister *reg =
+      state->text_registers->registers + state->text_register;
+  state->text_register = 0;
+  return reg;
+}
+
+// NOTE: returns false and says so when the register can't hold the lines
+static bool state_yank(State *state, int32_t start, int32_t end) {
+  int8_t name = state->text_register;
+  TextRegister *reg = state_text_register(state);
+  if (!editor_frame_yank(&state->editor_frame, reg, start, end)) {
+    sprintf(state->status_message, "Register %c can't hold %d lines",
+            name == 0 ? '"' : 'a' + name - 1, end - start);
+    return false;
+  }
+  return true;
+}
+
+static void visual_begin(State *state, enum AppMode mode) {
+  state->mode = mode;
+  state->visual_line_num = state->editor_frame.cursor.line_num;
+  state->visual_column = state->editor_frame.cursor.column;
+}
+
 enum KeyStateMachineState key_state_machine_dispatch(State *state,
                                                      KeyStateMachine *ksm) {
   ExFrame *ex_frame = &state->ex_frame;
@@ -200,11 +778,35 @@ enum KeyStateMachineState key_state_machine_dispatch(State *state,
     } break;
     case 'i': {
       state->mode = AppMode_insert;
+      state->change_pending = true;
     } break;
     case 'I': {
       editor_frame_move_cursor_h(editor_frame,
                                  -1 * editor_frame->cursor.column);
       state->mode = AppMode_insert;
+      state->change_pending = true;
+    } break;
+    case 'V': {
+      visual_begin(state, AppMode_visual_line);
+    } break;
+    case KEY_CTRL_V: {
+      visual_begin(state, AppMode_visual_block);
+    } break;
+    case 'q': {
+      if (state->recording_register >= 0) {
+        // NOTE: the q that stops the recording was recorded too
+        KeyRegister *reg = state->key_registers + state->recording_register;
+        if (reg->size > 0) {
+          reg->size--;
+        }
+        stop_recording(state);
+      } else {
+        return KeyStateMachine_Operator;
+      }
+    } break;
+    case '.': {
+      state->pending_replay = &state->dot;
+      state->pending_replay_count = ksm->repetitions;
     } break;
     case 'h': {
       editor_frame_move_cursor_h(editor_frame, -1 * (ksm->repetitions));
@@ -213,10 +815,10 @@ enum KeyStateMachineState key_state_machine_dispatch(State *state,
       editor_frame_move_cursor_h(editor_frame, 1 * (ksm->repetitions));
     } break;
     case 'k': {
-      editor_frame_move_cursor_v(editor_frame, -1 * (ksm->repetitions), NULL);
+      editor_frame_move_cursor_rows(editor_frame, -1 * (ksm->repetitions));
     } break;
     case 'j': {
-      editor_frame_move_cursor_v(editor_frame, ksm->repetitions, NULL);
+      editor_frame_move_cursor_rows(editor_frame, ksm->repetitions);
     } break;
     case 'H': {
       editor_frame_move_cursor_h(editor_frame,
@@ -230,6 +832,7 @@ enum KeyStateMachineState key_state_machine_dispatch(State *state,
       editor_frame_move_cursor_h(editor_frame, editor_frame->cursor.line->len -
                                                    editor_frame->cursor.column);
       state->mode = AppMode_insert;
+      state->change_pending = true;
     } break;
     case 'G': {
       editor_frame_move_cursor_v(
@@ -237,14 +840,62 @@ enum KeyStateMachineState key_state_machine_dispatch(State *state,
           (editor_frame->line_count - editor_frame->cursor.line_num - 1),
           &editor_frame->cursor.column);
     } break;
+    case 'p':
+    case 'P': {
+      TextRegister *reg = state_text_register(state);
+      bool put = true;
+      editor_frame_begin_batch(editor_frame);
+      for (int32_t i = 0; i < ksm->repetitions && put; ++i) {
+        put = editor_frame_put(editor_frame, reg, operator[0] == 'P');
+      }
+      editor_frame_end_batch(editor_frame);
+      state->change_pending = true;
+      if (!put) {
+        sprintf(state->status_message, "Out of memory, nothing was put");
+        return KeyStateMachine_Done;
+      }
+    } break;
+    case '"':
+    case '@':
     case 'd':
-    case 'g': {
+    case 'g':
+    case 'y': {
       return KeyStateMachine_Operator;
     } break;
     }
+  } else if (operator[0] == 'q') {
+    if (operator[1] >= 'a' && operator[1] <= 'z') {
+      state->recording_register = operator[1] - 'a';
+      key_register_clear(state->key_registers + state->recording_register);
+    }
+  } else if (operator[0] == '@') {
+    int8_t reg = operator[1] == '@' ? state->last_replayed_register
+                                    : operator[1] - 'a';
+    if (reg >= 0 && reg < KEY_REGISTER_COUNT) {
+      state->last_replayed_register = reg;
+      state->pending_replay = state->key_registers + reg;
+      state->pending_replay_count = ksm->repetitions;
+    }
+  } else if (operator[0] == '"') {
+    if (operator[1] >= 'a' && operator[1] <= 'z') {
+      state->text_register = operator[1] - 'a' + 1;
+    }
   } else if (operator[0] == 'd' && operator[1] == 'd') {
     key_state_machine_reset(ksm);
+    int32_t start = editor_frame->cursor.line_num;
+    int64_t end = (int64_t)start + ksm->repetitions;
+    state_yank(state, start,
+               end > editor_frame->line_count ? editor_frame->line_count : end);
     editor_frame_remove_lines(editor_frame, ksm->repetitions);
+    state->change_pending = true;
+  } else if (operator[0] == 'y' && operator[1] == 'y') {
+    int32_t start = editor_frame->cursor.line_num;
+    int64_t end = (int64_t)start + ksm->repetitions;
+    if (!state_yank(state, start,
+                    end > editor_frame->line_count ? editor_frame->line_count
+                                                   : end)) {
+      return KeyStateMachine_Done;
+    }
   } else if (operator[0] == 'g' && operator[1] == 'g') {
     editor_frame_move_cursor_v(editor_frame,
                                -1 * (editor_frame->cursor.line_num),
@@ -269,7 +920,10 @@ void key_state_machine_add_key(KeyStateMachine *ksm, char c, State *state) {
       } else {
         ksm->state = KeyStateMachine_Operator;
         ksm->keys[ksm->keys_size] = '\0';
-        ksm->repetitions = atoi(ksm->keys);
+        long long repetitions = strtoll(ksm->keys, NULL, 10);
+        ksm->repetitions = repetitions > KEY_MAX_REPETITIONS
+                               ? KEY_MAX_REPETITIONS
+                               : repetitions;
       }
       ksm->operator[ksm->operator_size] = c;
       ksm->operator_size++;
@@ -295,251 +949,1245 @@ void key_state_machine_add_key(KeyStateMachine *ksm, char c, State *state) {
   }
 }
 
-int16_t load_file(RendererContext context, char *filename) {
+void filename_texture_update(RendererContext context) {
   State *state = context.state;
-
-  int r = editor_frame_load_file(context.transient_arena, &state->editor_frame,
-                                 filename);
-  if (r < 0) {
-    return r;
-  }
-
-  strcpy(state->filename, filename);
-
   SDL_Color color = {UNHEX(MODELINE_FONT_COLOR)};
 
   if (state->filename_texture != NULL) {
     SDL_DestroyTexture(state->filename_texture);
+    state->filename_texture = NULL;
+  }
+  if (state->filename[0] != '\0') {
+    state->filename_texture =
+        texture_from_text(context.renderer, state->font, state->filename,
+                          color, &state->filename_texture_width);
   }
-  state->filename_texture =
-      texture_from_text(context.renderer, state->font, state->filename, color,
-                        &state->filename_texture_width);
-  return 0;
 }
 
-int16_t dump_file(State *state, char *filename) {
-  FILE *f = fopen(filename, "w");
-  if (!f) {
-    return -1;
+// NOTE: what the layout needs from the font and glyph_width
+static void state_font_metrics(State *state) {
+  state->font_h = TTF_FontHeight(state->font);
+  state->glyph_advance = state->glyph_width[0];
+  state->monospace = true;
+  state->min_glyph_width = state->glyph_advance;
+  for (int16_t i = ASCII_LOW; i <= ASCII_HIGH; ++i) {
+    int32_t w = state->glyph_width[i - ASCII_LOW];
+    if (w != state->glyph_advance) {
+      state->monospace = false;
+    }
+    if (w > 0 && w < state->min_glyph_width) {
+      state->min_glyph_width = w;
+    }
   }
-
-  EditorFrame *editor_frame = &state->editor_frame;
-
-  char new_line = '\n';
-
-  for (Line *line = editor_frame->line; line != NULL; line = line->next) {
-    fwrite(line->text, line->len, 1, f);
-    fwrite(&new_line, 1, 1, f);
+  if (state->min_glyph_width < 1) {
+    state->min_glyph_width = 1;
   }
+}
 
-  fclose(f);
+// NOTE: everything that lives outside of permanent storage, rebuilt when a
+// snapshot is restored
+static void state_create_resources(State *state, SDL_Renderer *renderer) {
+  uint64_t start = SDL_GetPerformanceCounter();
 
-  return 0;
+  state->font = TTF_cpointer(TTF_OpenFont(font_path(), state->font_size));
+  state->atlas_cached =
+      glyph_atlas_create(&state->atlas, renderer, state->font, font_path(),
+                         state->font_size, state->glyph_width);
+  state_font_metrics(state);
+
+  state->font_init_time = (real32)(SDL_GetPerformanceCounter() - start) *
+                          1000.0f / (real32)SDL_GetPerformanceFrequency();
 }
 
 void state_create(State *state, SDL_Renderer *renderer, Memory *memory) {
   state->mode = AppMode_normal;
+  state->layout = snapshot_layout();
+  state->font_size = FONT_SIZE;
+  state->font_size_target = FONT_SIZE;
 
-  state->font = TTF_cpointer(TTF_OpenFont("IosevkaNerdFont-Regular.ttf", 20));
-  state->font_h = TTF_FontHeight(state->font);
-
-  SDL_Color sdlFontColor = {UNHEX(EDITOR_FONT_COLOR)};
-  for (int16_t i = ASCII_LOW; i < ASCII_HIGH; ++i) {
-    SDL_Surface *surface =
-        TTF_cpointer(TTF_RenderGlyph_Solid(state->font, i, sdlFontColor));
-    state->glyph_width[i - ASCII_LOW] = surface->w;
-    SDL_FreeSurface(surface);
-  }
-
-  {
-    SDL_Color color = {UNHEX(EX_FONT_COLOR)};
-    SDL_Surface *surface =
-        TTF_cpointer(TTF_RenderGlyph_Solid(state->font, ':', color));
-    state->ex_prefix_texture_width = surface->w;
-    state->ex_prefix_texture =
-        SDL_cpointer(SDL_CreateTextureFromSurface(renderer, surface));
-    SDL_FreeSurface(surface);
-  }
+  state_create_resources(state, renderer);
 
   initializeArena(&state->arena, memory->permanent_storage_size - sizeof(State),
                   (uint8_t *)memory->permanent_storage + sizeof(State));
 
   state->editor_frame = editor_frame_create(&state->arena);
   state->ex_frame = ex_frame_create(&state->arena);
-
-  SDL_Color modeColor = {UNHEX(MODELINE_FONT_COLOR)};
-  state->appModeTextures[AppMode_ex] =
-      cached_texture_create(renderer, state->font, "EX | ", modeColor);
-  state->appModeTextures[AppMode_normal] =
-      cached_texture_create(renderer, state->font, "NORMAL | ", modeColor);
-  state->appModeTextures[AppMode_insert] =
-      cached_texture_create(renderer, state->font, "INSERT | ", modeColor);
+  state->raster = raster_pool_create(&state->arena);
+  state->text_registers =
+      text_registers_create(&state->arena, TEXT_REGISTER_ARENA_SIZE);
+  state->editor_frame.registers = state->text_registers;
+  state->grep = grep_search_create(&state->arena, GREP_ARENA_SIZE);
+  state->file_index = file_index_create(&state->arena, FILE_INDEX_ARENA_SIZE,
+                                        ".", FILE_INDEX_PATH);
+  file_index_ignore(state->file_index, JOURNAL_PATH, "");
+  file_index_ignore(state->file_index, SNAPSHOT_DEFAULT_PATH, "");
 
   state->filename[0] = 0;
   state->status_message[0] = '\0';
 
   key_state_machine_reset(&state->normal_ksm);
-}
-
-void state_destroy(State *state) {
-  TTF_CloseFont(state->font);
 
-  SDL_DestroyTexture(state->ex_prefix_texture);
-  SDL_DestroyTexture(state->appModeTextures[AppMode_ex].texture);
-  SDL_DestroyTexture(state->appModeTextures[AppMode_normal].texture);
-  SDL_DestroyTexture(state->appModeTextures[AppMode_insert].texture);
+  for (int8_t i = 0; i < KEY_REGISTER_COUNT; ++i) {
+    key_register_create(&state->arena, state->key_registers + i);
+  }
+  key_register_create(&state->arena, &state->dot_pending);
+  key_register_create(&state->arena, &state->dot);
+  state->recording_register = -1;
+  state->last_replayed_register = -1;
 }
 
-extern UPDATE_AND_RENDER(UpdateAndRender) {
-  assert(sizeof(State) <= memory->permanent_storage_size);
-
-#if DEBUG_WINDOW
-  uint32_t debugFontColor = 0x00000000;
-  SDL_SetRenderDrawColor(buffer->debug_renderer, UNHEX(0xFFFFFFFF));
-  SDL_RenderClear(buffer->debug_renderer);
-#endif
-
-  SDL_ccode(SDL_SetRenderDrawColor(buffer->renderer, UNHEX(BG_COLOR)));
-  SDL_ccode(SDL_RenderClear(buffer->renderer));
-
-  State *state = (State *)memory->permanent_storage;
+static void lines_forget_textures(Line *line) {
+  for (; line != NULL; line = line->next) {
+    if (line->render != NULL) {
+      line->render->texture = NULL;
+      line->render->texture_dirty = false;
+      line->render->raster_job = NULL;
+    }
+  }
+}
 
-  if (!state->isInitialized) {
-    state_create(state, buffer->renderer, memory);
-    state->isInitialized = true;
+// NOTE: the snapshot still points to textures and a font of the process that
+// wrote it, those pointers are dropped without destroying anything and the
+// textures are rebuilt lazily as they are rendered
+void state_restore(State *state, RendererContext context) {
+  lines_forget_textures(state->editor_frame.line);
+  lines_forget_textures(state->editor_frame.deleted_line);
+  for (int32_t i = 0; i < LINE_NUMBER_TEXTURE_CACHE_SIZE; ++i) {
+    state->line_number_texture_cache[i] = NULL;
   }
+  state->ex_frame.texture = NULL;
+  state->normal_ksm.texture = NULL;
+  state->recording_texture = NULL;
+  state->filename_texture = NULL;
+  state->atlas.texture = NULL;
+  state->screen_target = NULL;
+  raster_pool_reset(state->raster);
+  state->font_job = (FontJob){};
+  state->font_size_target = state->font_size;
+  grep_search_restore(state->grep);
+  file_index_restore(state->file_index);
+  // NOTE: the journal fd belongs to the process that wrote the snapshot
+  state->editor_frame.journal = NULL;
+
+  state_create_resources(state, context.renderer);
+  filename_texture_update(context);
 
-  // NOTE(casey): Transient initialization
-  assert(sizeof(TransientState) <= memory->transient_storage_size);
-  TransientState *transient_arena = (TransientState *)memory->transient_storage;
-  if (!transient_arena->is_initialized) {
-    initializeArena(&transient_arena->arena,
-                    memory->transient_storage_size - sizeof(TransientState),
-                    (uint8_t *)memory->transient_storage +
-                        sizeof(TransientState));
+  state->mode = AppMode_normal;
+  key_state_machine_reset(&state->normal_ksm);
+  state->recording_register = -1;
+  state->replay_depth = 0;
+  state->pending_replay = NULL;
+  state->change_pending = false;
+  state->dot_replaying = false;
+  state->dot_pending.size = 0;
+  sprintf(state->status_message, "Restored snapshot");
+}
 
-    transient_arena->is_initialized = true;
+static int write_all(int fd, void *data, size_t size, off_t offset) {
+  uint8_t *bytes = data;
+  while (size > 0) {
+    ssize_t written = pwrite(fd, bytes, size, offset);
+    if (written < 0) {
+      return -1;
+    }
+    bytes += written;
+    size -= written;
+    offset += written;
   }
+  return 0;
+}
 
-  if (input->executableReloaded) {
-    printf("RELOAD\n");
+// NOTE: only State and the arenas carved from the state arena hold data, the
+// rest of the image is left as a hole
+int16_t snapshot_write(RendererContext context, char *filename) {
+  State *state = context.state;
+  Memory *memory = context.memory;
+  if ((uint64_t)memory->permanent_storage != STORAGE_BASE_ADDRESS) {
+    return -1;
   }
 
-  RendererContext context =
-      (RendererContext){.state = state,
-                        .transient_arena = &transient_arena->arena,
-                        .renderer = buffer->renderer};
+  int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
 
-  EditorFrame *editor_frame = &state->editor_frame;
+  SnapshotHeader header = {.magic = SNAPSHOT_MAGIC,
+                           .base = (uint64_t)memory->permanent_storage,
+                           .size = memory->permanent_storage_size};
+  MemoryArena *frame_arena = &state->editor_frame.arena;
+  int r = ftruncate(fd, SNAPSHOT_HEADER_SIZE + header.size);
+  if (r == 0) {
+    r = write_all(fd, &header, sizeof(header), 0);
+  }
+  if (r == 0) {
+    r = write_all(fd, memory->permanent_storage,
+                  sizeof(State) + state->arena.used, SNAPSHOT_HEADER_SIZE);
+  }
+  if (r == 0) {
+    off_t offset = frame_arena->base - (uint8_t *)memory->permanent_storage;
+    r = write_all(fd, frame_arena->base, frame_arena->used,
+                  SNAPSHOT_HEADER_SIZE + offset);
+  }
+  for (int32_t i = 0; i < TEXT_REGISTER_COUNT && r == 0; ++i) {
+    MemoryArena *register_arena = &state->text_registers->registers[i].arena;
+    off_t offset =
+        register_arena->base - (uint8_t *)memory->permanent_storage;
+    r = write_all(fd, register_arena->base, register_arena->used,
+                  SNAPSHOT_HEADER_SIZE + offset);
+  }
+  if (r == 0) {
+    MemoryArena *grep_arena = &state->grep->arena;
+    off_t offset = grep_arena->base - (uint8_t *)memory->permanent_storage;
+    r = write_all(fd, grep_arena->base, grep_arena->used,
+                  SNAPSHOT_HEADER_SIZE + offset);
+  }
+  for (int32_t i = 0; i < 2 && r == 0; ++i) {
+    MemoryArena *list_arena = &state->file_index->lists[i].arena;
+    off_t offset = list_arena->base - (uint8_t *)memory->permanent_storage;
+    r = write_all(fd, list_arena->base, list_arena->used,
+                  SNAPSHOT_HEADER_SIZE + offset);
+  }
+  if (close(fd) != 0) {
+    r = -1;
+  }
+  return r;
+}
+
+// NOTE: the journal left behind by a session that didn't quit is replayed
+// before journaling starts over, unless the buffer came from a snapshot.
+// Playback runs don't journal so they stay deterministic
+static void state_journal_open(RendererContext context, bool replay) {
+#if DEBUG_PLAYBACK != PLAYBACK_PLAYING
+  State *state = context.state;
+  EditorFrame *editor_frame = &state->editor_frame;
+  int fd = open(JOURNAL_PATH, O_RDWR | O_CREAT | O_APPEND, 0644);
+  if (fd < 0) {
+    char *error = strerror(errno);
+    printf("journal open failed %s\n", error);
+    sprintf(state->status_message, "Journal disabled: %.200s", error);
+    return;
+  }
+  editor_frame->journal = journal_create(&state->arena, fd);
+
+  struct stat journal_stat;
+  if (!replay || fstat(fd, &journal_stat) != 0 ||
+      journal_stat.st_size == 0) {
+    editor_frame_journal_restart(editor_frame, state->filename);
+  } else {
+    char filename[FILENAME_SIZE];
+    int32_t count = editor_frame_journal_replay(context.transient_arena,
+                                                editor_frame, filename);
+    if (count < 0) {
+      editor_frame_close(editor_frame);
+      sprintf(state->status_message, "Unusable journal %s discarded",
+              JOURNAL_PATH);
+    } else {
+      strcpy(state->filename, filename);
+      filename_texture_update(context);
+      sprintf(state->status_message, "Recovered %d edits from %s", count,
+              JOURNAL_PATH);
+    }
+  }
+  __atomic_store_n(&context.memory->journal_fd, fd, __ATOMIC_RELEASE);
+#else
+  (void)context;
+  (void)replay;
+#endif
+}
+
+// NOTE: a clean quit leaves nothing to recover
+static void state_journal_close(RendererContext context) {
+  Journal *journal = context.state->editor_frame.journal;
+  if (journal == NULL) {
+    return;
+  }
+  __atomic_store_n(&context.memory->journal_fd, -1, __ATOMIC_RELEASE);
+  close(journal->fd);
+  unlink(JOURNAL_PATH);
+  context.state->editor_frame.journal = NULL;
+}
+
+static void latency_pending_add(State *state, enum LatencyKind kind,
+                                uint32_t timestamp) {
+  if (state->latency_pending_count == LATENCY_PENDING_MAX) {
+    return;
+  }
+  state->latency_pending[state->latency_pending_count++] =
+      (LatencySample){.kind = kind, .timestamp = timestamp};
+}
+
+// NOTE: the events handled last frame were presented at input->last_present
+static void latency_collect(State *state, Input *input) {
+  for (int32_t i = 0; i < state->latency_pending_count; ++i) {
+    LatencySample *sample = state->latency_pending + i;
+    if (input->last_present >= sample->timestamp) {
+      latency_record(state->latency + sample->kind,
+                     input->last_present - sample->timestamp);
+    }
+  }
+  state->latency_pending_count = 0;
+}
+
+static char *latency_kind_names[LatencyKind_count] = {
+    [LatencyKind_text_input] = "text",
+    [LatencyKind_keydown] = "keydown",
+    [LatencyKind_ex_command] = "ex",
+};
+
+// NOTE: writes at dest without going past end and returns where the next
+// write goes. What doesn't fit is cut, end - 1 always keeps the terminator
+static char *format_append(char *dest, char *end, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vsnprintf(dest, end - dest, format, args);
+  va_end(args);
+  if (written < 0) {
+    return dest;
+  }
+  return written < end - dest ? dest + written : end - 1;
+}
+
+static void latency_show(State *state) {
+  char *dest = state->status_message;
+  char *end = state->status_message + sizeof(state->status_message);
+  for (int32_t i = 0; i < LatencyKind_count; ++i) {
+    char line[STATUS_MESSAGE_SIZE];
+    latency_format(line, sizeof(line), latency_kind_names[i],
+                   state->latency + i);
+    dest = format_append(dest, end, "%s%s", i > 0 ? " | " : "latency ", line);
+  }
+}
+
+void state_destroy(State *state, Memory *memory) {
+  char line[STATUS_MESSAGE_SIZE];
+  for (int32_t i = 0; i < LatencyKind_count; ++i) {
+    latency_format(line, sizeof(line), latency_kind_names[i],
+                   state->latency + i);
+    printf("latency %s\n", line);
+  }
+
+  raster_pool_destroy(state->raster, memory);
+  if (state->font_job.state == RasterJob_done) {
+    TTF_CloseFont(state->font_job.font);
+    SDL_FreeSurface(state->font_job.surface);
+  }
+  grep_search_cancel(state->grep);
+  if (memory->background_queue != NULL) {
+    memory->complete_all_work(memory->background_queue);
+  }
+  TTF_CloseFont(state->font);
+  if (state->screen_target != NULL) {
+    SDL_DestroyTexture(state->screen_target);
+  }
+
+  glyph_atlas_destroy(&state->atlas);
+}
+
+static void line_number_textures_clear(State *state) {
+  for (int32_t i = 0; i < LINE_NUMBER_TEXTURE_CACHE_SIZE; ++i) {
+    if (state->line_number_texture_cache[i] != NULL) {
+      SDL_DestroyTexture(state->line_number_texture_cache[i]);
+      state->line_number_texture_cache[i] = NULL;
+    }
+  }
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(font_job_run) {
+  (void)queue;
+  FontJob *job = data;
+  job->font = TTF_cpointer(TTF_OpenFont(font_path(), job->font_size));
+  job->surface = glyph_atlas_surface(job->font, font_path(), job->font_size,
+                                     &job->header, &job->cached);
+  __atomic_store_n(&job->state, RasterJob_done, __ATOMIC_RELEASE);
+}
+
+static void font_job_issue(RendererContext context) {
+  FontJob *job = &context.state->font_job;
+  job->font_size = context.state->font_size_target;
+  job->state = RasterJob_queued;
+  if (context.memory->work_queue != NULL) {
+    context.memory->add_work_entry(context.memory->work_queue, font_job_run,
+                                   job);
+  } else {
+    font_job_run(NULL, job);
+  }
+}
+
+// NOTE: Ctrl+= and Ctrl+-. Only one size is loaded at a time, the last one
+// asked for is loaded next
+static void state_zoom(RendererContext context, int32_t step) {
+  State *state = context.state;
+  int32_t size = state->font_size_target + step;
+  if (size < FONT_SIZE_MIN) {
+    size = FONT_SIZE_MIN;
+  } else if (size > FONT_SIZE_MAX) {
+    size = FONT_SIZE_MAX;
+  }
+  state->font_size_target = size;
+  if (state->font_job.state == RasterJob_free && size != state->font_size) {
+    font_job_issue(context);
+  }
+}
+
+// NOTE: the font of font_job replaces the current one. Everything drawn with
+// the old font is dropped at once, the lines in a single pass over the
+// buffer and the deleted-line list, and rebuilt lazily as it is shown again
+static void state_font_swap(RendererContext context) {
+  State *state = context.state;
+  FontJob *job = &state->font_job;
+  raster_pool_destroy(state->raster, context.memory);
+  raster_jobs_collect(context);
+
+  TTF_CloseFont(state->font);
+  state->font = job->font;
+  state->font_size = job->font_size;
+  state->atlas_cached = job->cached;
+  glyph_atlas_destroy(&state->atlas);
+  glyph_atlas_from_surface(&state->atlas, context.renderer, job->surface,
+                           &job->header, state->glyph_width);
+  state_font_metrics(state);
+  job->font = NULL;
+  job->surface = NULL;
+
+  EditorFrame *frame = &state->editor_frame;
+  for (Line *line = frame->line; line != NULL; line = line->next) {
+    line_invalidate_texture(line);
+  }
+  for (Line *line = frame->deleted_line; line != NULL; line = line->next) {
+    line_invalidate_texture(line);
+  }
+  frame->wrap_glyph_width = NULL;
+  line_number_textures_clear(state);
+  ex_frame_invalidate_texture(&state->ex_frame);
+  if (state->normal_ksm.texture != NULL) {
+    SDL_DestroyTexture(state->normal_ksm.texture);
+    state->normal_ksm.texture = NULL;
+  }
+  if (state->recording_texture != NULL) {
+    SDL_DestroyTexture(state->recording_texture);
+    state->recording_texture = NULL;
+  }
+  filename_texture_update(context);
+  if (state->screen_target != NULL) {
+    SDL_DestroyTexture(state->screen_target);
+    state->screen_target = NULL;
+  }
+}
+
+// NOTE: before the layout of the frame, which depends on the font metrics.
+// A size that was changed again while it loaded is dropped
+static void font_job_collect(RendererContext context) {
+  State *state = context.state;
+  FontJob *job = &state->font_job;
+  if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != RasterJob_done) {
+    return;
+  }
+  if (job->font_size == state->font_size_target) {
+    state_font_swap(context);
+  } else {
+    TTF_CloseFont(job->font);
+    SDL_FreeSurface(job->surface);
+  }
+  job->state = RasterJob_free;
+  if (state->font_size_target != state->font_size) {
+    font_job_issue(context);
+  }
+}
+
+static char *format_size(char *dest, memory_index size) {
+  if (size >= Gigabytes(1)) {
+    sprintf(dest, "%.1fG", (real64)size / Gigabytes(1));
+  } else if (size >= Megabytes(1)) {
+    sprintf(dest, "%.1fM", (real64)size / Megabytes(1));
+  } else if (size >= Kilobytes(1)) {
+    sprintf(dest, "%.1fK", (real64)size / Kilobytes(1));
+  } else {
+    sprintf(dest, "%zuB", size);
+  }
+  return dest;
+}
+
+static char *format_arena_stats(char *dest, char *end, char *name,
+                                MemoryArena *arena) {
+  char used[16], committed[16], high_water[16];
+  return format_append(dest, end, "%s %s/%s hw %s allocs %u", name,
+                       format_size(used, arena->used),
+                       format_size(committed, arena->committed),
+                       format_size(high_water, arena->high_water),
+                       arena->allocation_count);
+}
+
+#if ARENA_TAGS
+static void print_arena_tags(char *name, MemoryArena *arena) {
+  char size[16];
+  printf("%s\n", name);
+  for (int32_t i = 0; i < ARENA_TAG_COUNT; ++i) {
+    ArenaTag *tag = arena->tags + i;
+    if (tag->count > 0) {
+      printf("  %-40s %8s %8u\n",
+             i == ARENA_TAG_COUNT - 1 ? "other" : tag->callsite,
+             format_size(size, tag->size), tag->count);
+    }
+  }
+}
+#endif
+
+static void stats_show(RendererContext context) {
+  State *state = context.state;
+  EditorFrame *editor_frame = &state->editor_frame;
+
+  int32_t texture_count = 0;
+  for (Line *line = editor_frame->line; line != NULL; line = line->next) {
+    if (line->render != NULL && line->render->texture != NULL) {
+      texture_count++;
+    }
+  }
+  int32_t deleted_count = 0;
+  for (Line *line = editor_frame->deleted_line; line != NULL;
+       line = line->next) {
+    deleted_count++;
+  }
+  for (int32_t i = 0; i < LINE_NUMBER_TEXTURE_CACHE_SIZE; ++i) {
+    if (state->line_number_texture_cache[i] != NULL) {
+      texture_count++;
+    }
+  }
+
+  char abandoned[16];
+  char *dest = state->status_message;
+  char *end = state->status_message + sizeof(state->status_message);
+  dest = format_append(dest, end,
+                       "lines %d textures %d prefetched %d async %d "
+                       "redrawn %d frame %.2f/%.2fms font %.2fms%s | ",
+                       editor_frame->line_count, texture_count,
+                       state->prefetch_count, state->raster->async_count,
+                       state->rows_redrawn, state->frame_time_last,
+                       state->frame_time_max, state->font_init_time,
+                       state->atlas_cached ? " cached" : "");
+  dest = format_arena_stats(dest, end, "editor", &editor_frame->arena);
+  char cold[16], cold_compressed[16];
+  dest = format_append(dest, end, " abandoned %s deleted %d cold %s in %s | ",
+                       format_size(abandoned, editor_frame->abandoned_size),
+                       deleted_count,
+                       format_size(cold, editor_frame->cold_size),
+                       format_size(cold_compressed,
+                                   editor_frame->cold_compressed_size));
+  dest = format_arena_stats(dest, end, "state", &state->arena);
+  dest = format_append(dest, end, " | ");
+  dest = format_arena_stats(dest, end, "transient", context.transient_arena);
   ExFrame *ex_frame = &state->ex_frame;
+  char ex_size[16];
+  format_append(dest, end, " | ex %d/%d %s", ex_frame->size,
+                ex_frame->max_size,
+                format_size(ex_size, ex_frame->max_size +
+                                         (ex_frame->max_size + 1) *
+                                             sizeof(int32_t)));
+
+#if ARENA_TAGS
+  print_arena_tags("editor", &editor_frame->arena);
+  print_arena_tags("state", &state->arena);
+  print_arena_tags("transient", context.transient_arena);
+#endif
+}
+
+// NOTE: path replaces the buffer, the status says why when it can't be read
+static bool state_open_file(RendererContext context, char *path) {
+  State *state = context.state;
+  int loaded = strlen(path) >= FILENAME_SIZE
+                   ? -1
+                   : editor_frame_load_file(context.transient_arena,
+                                            &state->editor_frame, path);
+  if (loaded == LOAD_FILE_UNPRINTABLE) {
+    sprintf(state->status_message, "Cannot load %.200s: not printable", path);
+    return false;
+  }
+  if (loaded != 0) {
+    sprintf(state->status_message, "Cannot open %.200s", path);
+    return false;
+  }
+  strcpy(state->filename, path);
+  filename_texture_update(context);
+  state->grep->list_open = false;
+  return true;
+}
+
+static void grep_status_show(State *state) {
+  GrepSearch *search = state->grep;
+  sprintf(state->status_message,
+          "grep %.100s: %d matches in %d files, %d searched%s",
+          search->pattern, search->match_count, search->file_count,
+          search->files_searched,
+          search->running      ? " (searching)"
+          : search->incomplete ? " (stopped)"
+                               : "");
+}
+
+// NOTE: the match's file replaces the buffer unless it is already open, the
+// results list written by :copen can be replaced without saving
+static void grep_jump(RendererContext context, int32_t index) {
+  State *state = context.state;
+  GrepSearch *search = state->grep;
+  EditorFrame *frame = &state->editor_frame;
+  if (search->match_count == 0) {
+    sprintf(state->status_message, "No grep results");
+    return;
+  }
+  GrepMatch *match = search->matches + index;
+  char *path = search->files[match->file];
+  if (search->list_open || strcmp(path, state->filename) != 0) {
+    if (frame->modified && !search->list_open) {
+      sprintf(state->status_message, "No write since last change");
+      return;
+    }
+    if (!state_open_file(context, path)) {
+      return;
+    }
+  }
+  editor_frame_move_cursor_v(frame, match->line_num - frame->cursor.line_num,
+                             NULL);
+  editor_frame_move_cursor_h(frame, match->column - frame->cursor.column);
+  search->current = index;
+  sprintf(state->status_message, "(%d of %d) %.150s:%d: %.*s", index + 1,
+          search->match_count, path, match->line_num,
+          match->preview_len < 150 ? match->preview_len : 150,
+          match->preview);
+}
+
+// NOTE: a line per match, `path:line:column: text`, written after the last
+// line of the list. The cursor stays where it was
+static void grep_list_append(RendererContext context) {
+  State *state = context.state;
+  GrepSearch *search = state->grep;
+  EditorFrame *frame = &state->editor_frame;
+  int32_t line_num = frame->cursor.line_num;
+  int32_t column = frame->cursor.column;
+  TemporaryMemory tmp_memory = beginTemporaryMemory(context.transient_arena);
+  char *text = pushSize(context.transient_arena,
+                        GREP_PATH_SIZE + GREP_PREVIEW_SIZE + 32,
+                        DEFAULT_ALIGNMENT);
+  editor_frame_begin_batch(frame);
+  editor_frame_move_cursor_v(frame, frame->line_count, NULL);
+  editor_frame_move_cursor_h(frame, frame->cursor.line->len);
+  for (; search->list_count < search->match_count; ++search->list_count) {
+    GrepMatch *match = search->matches + search->list_count;
+    int32_t size = grep_match_format(search, match, text);
+    if (search->list_count > 0) {
+      editor_frame_insert_new_line(frame);
+    }
+    editor_frame_insert_text(frame, text, size);
+  }
+  editor_frame_move_cursor_v(frame, line_num - frame->cursor.line_num, NULL);
+  editor_frame_move_cursor_h(frame, column - frame->cursor.column);
+  editor_frame_end_batch(frame);
+  endTemporaryMemory(tmp_memory);
+}
+
+// NOTE: the list replaces the buffer and grows as the search finds more
+static void grep_list_open(RendererContext context) {
+  State *state = context.state;
+  GrepSearch *search = state->grep;
+  EditorFrame *frame = &state->editor_frame;
+  if (frame->modified && !search->list_open) {
+    sprintf(state->status_message, "No write since last change");
+    return;
+  }
+  editor_frame_close(frame);
+  search->list_count = 0;
+  grep_list_append(context);
+  editor_frame_move_cursor_v(frame, search->current, NULL);
+
+  state->filename[0] = '\0';
+  filename_texture_update(context);
+  search->list_open = true;
+  grep_status_show(state);
+}
+
+// NOTE: grep pattern [dir], a pattern with spaces goes between double quotes
+static void ex_grep(RendererContext context, char *args) {
+  State *state = context.state;
+  char *pattern = args;
+  char *end;
+  if (pattern[0] == '"') {
+    pattern++;
+    end = strchr(pattern, '"');
+  } else {
+    end = strchr(pattern, ' ');
+  }
+  if (end == NULL) {
+    end = pattern + strlen(pattern);
+  }
+  int32_t pattern_len = end - pattern;
+  char *dir = end[0] == '"' ? end + 1 : end;
+  while (dir[0] == ' ') {
+    dir++;
+  }
+  if (dir[0] == '\0') {
+    dir = ".";
+  }
+  if (pattern_len == 0 || pattern_len >= GREP_PATTERN_SIZE) {
+    sprintf(state->status_message, "Invalid pattern: %.200s", args);
+    return;
+  }
+  if (strlen(dir) >= GREP_PATH_SIZE) {
+    sprintf(state->status_message, "Cannot open %.200s", dir);
+    return;
+  }
+  grep_search_start(state->grep, pattern, pattern_len, dir);
+  if (state->grep->list_open) {
+    grep_list_open(context);
+  }
+  grep_status_show(state);
+}
+
+// NOTE: find [query], the query stays in the ex line and is ranked again as
+// it is edited. The crawl is refreshed every time the picker opens
+static void picker_open(RendererContext context, char *query) {
+  State *state = context.state;
+  ExFrame *ex_frame = &state->ex_frame;
+  int16_t size = strlen(query);
+  memmove(ex_frame->text, query, size);
+  ex_frame->size = size;
+  ex_frame->cursor_column = size;
+  ex_frame_invalidate_texture(ex_frame);
+  file_index_refresh(state->file_index, context.memory);
+  file_index_rank(state->file_index, ex_frame->text, ex_frame->size);
+  state->mode = AppMode_picker;
+}
+
+static void picker_accept(RendererContext context) {
+  State *state = context.state;
+  FileIndex *index = state->file_index;
+  state->mode = AppMode_normal;
+  if (index->result_count == 0) {
+    sprintf(state->status_message, "No matching files");
+    return;
+  }
+  if (state->editor_frame.modified) {
+    sprintf(state->status_message, "No write since last change");
+    return;
+  }
+  FileList *list = file_index_list(index);
+  state_open_file(context, list->files[index->results[index->selected]]);
+}
+
+// NOTE: returns 1 when the app should quit
+int16_t ex_frame_execute(RendererContext context) {
+  State *state = context.state;
+  EditorFrame *editor_frame = &state->editor_frame;
+  ExFrame *ex_frame = &state->ex_frame;
+
+  ExCommandContext ex_context = {.frame = editor_frame,
+                                 .transient_arena = context.transient_arena,
+                                 .filename = state->filename,
+                                 .status_message = state->status_message};
+  ExResult result =
+      ex_command_execute(&ex_context, ex_frame->text, ex_frame->size);
+  if (ex_context.filename_changed) {
+    filename_texture_update(context);
+    state->grep->list_open = false;
+  }
+
+  if (result == ExResult_quit) {
+    state_journal_close(context);
+    state_destroy(state, context.memory);
+    return 1;
+  } else if (result != ExResult_unhandled) {
+    return 0;
+  }
+
+  ex_frame->text[ex_frame->size] = '\0';
+  if (strcmp(ex_frame->text, "invalidate") == 0) {
+    editor_frame_invalidate_viewport_textures(editor_frame);
+  } else if (strcmp(ex_frame->text, "stats") == 0) {
+    stats_show(context);
+  } else if (strcmp(ex_frame->text, "latency") == 0) {
+    latency_show(state);
+  } else if (strncmp(ex_frame->text, "grep ", 5) == 0) {
+    ex_grep(context, ex_frame->text + 5);
+  } else if (strcmp(ex_frame->text, "cn") == 0 ||
+             strcmp(ex_frame->text, "cnext") == 0) {
+    GrepSearch *search = state->grep;
+    grep_jump(context, search->current + 1 < search->match_count
+                           ? search->current + 1
+                           : search->current);
+  } else if (strcmp(ex_frame->text, "cp") == 0 ||
+             strcmp(ex_frame->text, "cprevious") == 0) {
+    GrepSearch *search = state->grep;
+    grep_jump(context, search->current > 0 ? search->current - 1 : 0);
+  } else if (strcmp(ex_frame->text, "cc") == 0 ||
+             strncmp(ex_frame->text, "cc ", 3) == 0) {
+    GrepSearch *search = state->grep;
+    int32_t n = ex_frame->size > 3 ? atoi(ex_frame->text + 3) : 0;
+    if (n < 1) {
+      n = search->current >= 0 ? search->current + 1 : 1;
+    }
+    grep_jump(context, n <= search->match_count ? n - 1
+                                                : search->match_count - 1);
+  } else if (strcmp(ex_frame->text, "copen") == 0) {
+    grep_list_open(context);
+  } else if (strcmp(ex_frame->text, "find") == 0 ||
+             strncmp(ex_frame->text, "find ", 5) == 0) {
+    picker_open(context, ex_frame->size > 5 ? ex_frame->text + 5 : "");
+  } else if (strcmp(ex_frame->text, "snapshot") == 0 ||
+             strncmp(ex_frame->text, "snapshot ", 9) == 0) {
+    char *filename =
+        ex_frame->size > 9 ? ex_frame->text + 9 : SNAPSHOT_DEFAULT_PATH;
+    if (snapshot_write(context, filename) == 0) {
+      sprintf(state->status_message, "Wrote snapshot to %s", filename);
+    } else {
+      sprintf(state->status_message, "Cannot write snapshot to %s", filename);
+    }
+  } else if (ex_frame->size > 0) {
+    sprintf(state->status_message, "Unrecognized command: %s", ex_frame->text);
+  }
+  return 0;
+}
+
+int16_t app_handle_key(RendererContext context, char key);
+
+static void visual_move_cursor(EditorFrame *frame, int32_t line_num,
+                               int32_t column) {
+  editor_frame_move_cursor_v(frame, line_num - frame->cursor.line_num, NULL);
+  editor_frame_move_cursor_h(frame, column - frame->cursor.column);
+}
+
+static void block_insert_begin(State *state, int32_t start, int32_t end,
+                               int32_t column) {
+  EditorFrame *frame = &state->editor_frame;
+  visual_move_cursor(frame, start, column);
+  state->block_insert_pending = true;
+  state->block_insert_start = start;
+  state->block_insert_end = end;
+  state->block_insert_column = column;
+  state->block_insert_first_column = frame->cursor.column;
+  state->block_insert_len = frame->cursor.line->len;
+  state->mode = AppMode_insert;
+  state->change_pending = true;
+}
+
+// NOTE: the text typed since block_insert_begin goes into the other lines of
+// the block, unless insert mode did more than add text to the first line
+static void block_insert_end(State *state) {
+  if (!state->block_insert_pending) {
+    return;
+  }
+  state->block_insert_pending = false;
+  EditorFrame *frame = &state->editor_frame;
+  Line *line = frame->cursor.line;
+  int32_t first_column = state->block_insert_first_column;
+  int32_t size = frame->cursor.column - first_column;
+  if (frame->cursor.line_num != state->block_insert_start || size <= 0 ||
+      line->len - state->block_insert_len != size ||
+      state->block_insert_end > frame->line_count) {
+    return;
+  }
+  editor_frame_block_insert(frame, state->block_insert_start + 1,
+                            state->block_insert_end,
+                            state->block_insert_column,
+                            line->text + first_column, size);
+}
+
+// NOTE: d, x, c and I change all the selected lines with a single editor
+// frame operation, V and Ctrl-V switch between the visual modes
+static void visual_apply(State *state, char key) {
+  EditorFrame *frame = &state->editor_frame;
+  bool block = state->mode == AppMode_visual_block;
+  if (key == 'V' || key == KEY_CTRL_V) {
+    enum AppMode mode = key == 'V' ? AppMode_visual_line
+                                   : AppMode_visual_block;
+    state->mode = state->mode == mode ? AppMode_normal : mode;
+    return;
+  }
+
+  int32_t start, end, column_start, column_end;
+  visual_selection(state, &start, &end, &column_start, &column_end);
+  state->mode = AppMode_normal;
+  switch (key) {
+  case 'd':
+  case 'x': {
+    if (block) {
+      editor_frame_block_delete(frame, start, end, column_start, column_end);
+      visual_move_cursor(frame, start, column_start);
+    } else {
+      state_yank(state, start, end);
+      editor_frame_delete_range(frame, start, end);
+    }
+    state->change_pending = true;
+  } break;
+  case 'y': {
+    // NOTE: registers hold whole lines, a block yanks its lines too
+    state_yank(state, start, end);
+    visual_move_cursor(frame, start, block ? column_start : 0);
+  } break;
+  case 'c': {
+    if (block) {
+      editor_frame_block_delete(frame, start, end, column_start, column_end);
+      block_insert_begin(state, start, end, column_start);
+    } else {
+      // NOTE: the lines are replaced by a single empty one
+      editor_frame_delete_range(frame, start + 1, end);
+      editor_frame_block_delete(frame, start, start + 1, 0, INT32_MAX);
+      visual_move_cursor(frame, start, 0);
+      state->mode = AppMode_insert;
+      state->change_pending = true;
+    }
+  } break;
+  case 'I': {
+    block_insert_begin(state, start, end, block ? column_start : 0);
+  } break;
+  }
+}
+
+#define VISUAL_MOTION_KEYS "0123456789hjklHLGg"
+#define VISUAL_OPERATOR_KEYS "dxcyIV" "\x16"
+
+// NOTE: replays are executed as a single editor frame batch, nothing is
+// rendered and the frame is reindexed once at the end
+int16_t app_replay_keys(RendererContext context, KeyRegister *reg,
+                        int32_t count) {
+  State *state = context.state;
+  if (state->replay_depth == KEY_REPLAY_MAX_DEPTH) {
+    sprintf(state->status_message, "Replay too deep");
+    return 0;
+  }
+
+  // NOTE: the register may be recorded again while we replay it
+  int32_t size = reg->size;
+  char *keys = pushSize(context.transient_arena, size, DEFAULT_ALIGNMENT);
+  charcpy(keys, reg->keys, size);
+
+  bool is_dot = reg == &state->dot;
+  bool was_dot_replaying = state->dot_replaying;
+  state->dot_replaying = state->dot_replaying || is_dot;
+  state->replay_depth++;
+  editor_frame_begin_batch(&state->editor_frame);
+
+  int16_t result = 0;
+  for (int32_t n = 0; n < count && result == 0; ++n) {
+    for (int32_t i = 0; i < size && result == 0; ++i) {
+      result = app_handle_key(context, keys[i]);
+    }
+  }
+
+  editor_frame_end_batch(&state->editor_frame);
+  state->replay_depth--;
+  state->dot_replaying = was_dot_replaying;
+  if (is_dot) {
+    state->change_pending = false;
+  }
+  return result;
+}
+
+// NOTE: returns 1 when the app should quit
+int16_t app_handle_key(RendererContext context, char key) {
+  State *state = context.state;
+  EditorFrame *editor_frame = &state->editor_frame;
+  ExFrame *ex_frame = &state->ex_frame;
+  KeyStateMachine *ksm = &state->normal_ksm;
+  bool is_printable = key >= ASCII_LOW && key <= ASCII_HIGH;
+
+  if (state->recording_register >= 0 && state->replay_depth == 0) {
+    KeyRegister *reg = state->key_registers + state->recording_register;
+    if (!key_register_append(reg, key)) {
+      sprintf(state->status_message, "Register %c is full",
+              'a' + state->recording_register);
+      stop_recording(state);
+    }
+  }
+
+  if (!state->dot_replaying) {
+    if (state->mode == AppMode_normal && ksm->keys_size == 0 &&
+        !state->change_pending) {
+      key_register_clear(&state->dot_pending);
+    }
+    key_register_append(&state->dot_pending, key);
+  }
+
+  int16_t result = 0;
+  switch (state->mode) {
+  case AppMode_normal: {
+    if (is_printable || key == KEY_CTRL_V) {
+      key_state_machine_add_key(ksm, key, state);
+    } else if (key == KEY_RETURN && state->grep->list_open &&
+               ksm->keys_size == 0 &&
+               editor_frame->cursor.line_num < state->grep->match_count) {
+      grep_jump(context, editor_frame->cursor.line_num);
+    }
+  } break;
+  case AppMode_visual_line:
+  case AppMode_visual_block: {
+    bool is_key = is_printable || key == KEY_CTRL_V;
+    if (key == KEY_ESCAPE) {
+      key_state_machine_reset(ksm);
+      state->mode = AppMode_normal;
+    } else if (is_key && ksm->state != KeyStateMachine_Operator &&
+               strchr(VISUAL_OPERATOR_KEYS, key) != NULL) {
+      key_state_machine_reset(ksm);
+      visual_apply(state, key);
+    } else if (is_key && strchr(VISUAL_MOTION_KEYS, key) != NULL) {
+      key_state_machine_add_key(ksm, key, state);
+    }
+  } break;
+  case AppMode_ex: {
+    if (key == KEY_RETURN) {
+      state->mode = AppMode_normal;
+      result = ex_frame_execute(context);
+    } else if (key == KEY_BACKSPACE) {
+      ex_frame_remove_char(ex_frame);
+    } else if (key == KEY_ESCAPE) {
+      state->mode = AppMode_normal;
+      ex_frame->size = 0;
+      ex_frame->cursor_column = 0;
+    } else if (is_printable) {
+      ex_frame_insert_text(ex_frame, &key, 1);
+    }
+  } break;
+  case AppMode_picker: {
+    FileIndex *index = state->file_index;
+    if (key == KEY_RETURN) {
+      picker_accept(context);
+    } else if (key == KEY_ESCAPE) {
+      state->mode = AppMode_normal;
+    } else if (key == KEY_CTRL_N || key == KEY_CTRL_P) {
+      int32_t step = key == KEY_CTRL_N ? -1 : 1;
+      if (index->result_count > 0) {
+        index->selected = (index->selected + step + index->result_count) %
+                          index->result_count;
+      }
+    } else if (key == KEY_BACKSPACE || is_printable) {
+      if (key == KEY_BACKSPACE) {
+        ex_frame_remove_char(ex_frame);
+      } else if (ex_frame->size + 1 < ex_frame->max_size) {
+        ex_frame_insert_text(ex_frame, &key, 1);
+      }
+      file_index_rank(index, ex_frame->text, ex_frame->size);
+    }
+  } break;
+  case AppMode_insert: {
+    if (key == KEY_RETURN) {
+      if (!editor_frame_insert_new_line(editor_frame)) {
+        sprintf(state->status_message, "Out of memory, no new line");
+      }
+    } else if (key == KEY_BACKSPACE) {
+      editor_frame_remove_char(editor_frame);
+    } else if (key == KEY_ESCAPE) {
+      state->mode = AppMode_normal;
+      block_insert_end(state);
+    } else if (is_printable) {
+      editor_frame_insert_text(editor_frame, &key, 1);
+    }
+  } break;
+  default:
+    assert(false);
+    break;
+  }
+
+  if (result == 0 && state->pending_replay != NULL) {
+    KeyRegister *reg = state->pending_replay;
+    state->pending_replay = NULL;
+    result = app_replay_keys(context, reg, state->pending_replay_count);
+  }
+
+  if (state->change_pending && !state->dot_replaying &&
+      state->mode == AppMode_normal && ksm->keys_size == 0) {
+    state->change_pending = false;
+    if (!state->dot_pending.overflow) {
+      state->dot.size = state->dot_pending.size;
+      charcpy(state->dot.keys, state->dot_pending.keys, state->dot.size);
+    }
+  }
+
+  return result;
+}
+
+extern UPDATE_AND_RENDER(UpdateAndRender) {
+  uint64_t frame_start = SDL_GetPerformanceCounter();
+  assert(sizeof(State) <= memory->permanent_storage_size);
+  assert(sizeof(State) <= STORAGE_INITIAL_COMMIT_SIZE);
+
+#if DEBUG_WINDOW
+  uint32_t debugFontColor = 0x00000000;
+  SDL_SetRenderDrawColor(buffer->debug_renderer, UNHEX(0xFFFFFFFF));
+  SDL_RenderClear(buffer->debug_renderer);
+#endif
+
+  SDL_ccode(SDL_SetRenderDrawColor(buffer->renderer, UNHEX(BG_COLOR)));
+  SDL_ccode(SDL_RenderClear(buffer->renderer));
+
+  State *state = (State *)memory->permanent_storage;
+
+  if (memory->restored &&
+      (!state->isInitialized || state->layout != snapshot_layout())) {
+    printf("snapshot layout mismatch, starting from scratch\n");
+    memory->restored = false;
+    memset(state, 0, sizeof(State));
+  }
+
+  bool state_created = false;
+  if (!state->isInitialized) {
+    state_create(state, buffer->renderer, memory);
+    state->isInitialized = true;
+    state_created = true;
+  }
+
+  // NOTE(casey): Transient initialization
+  assert(sizeof(TransientState) <= memory->transient_storage_size);
+  assert(sizeof(TransientState) <= STORAGE_INITIAL_COMMIT_SIZE);
+  TransientState *transient_arena = (TransientState *)memory->transient_storage;
+  if (!transient_arena->is_initialized) {
+    initializeArena(&transient_arena->arena,
+                    memory->transient_storage_size - sizeof(TransientState),
+                    (uint8_t *)memory->transient_storage +
+                        sizeof(TransientState));
+
+    transient_arena->is_initialized = true;
+  }
+
+  if (input->executableReloaded) {
+    printf("RELOAD\n");
+  }
+
+  RendererContext context =
+      (RendererContext){.state = state,
+                        .transient_arena = &transient_arena->arena,
+                        .renderer = buffer->renderer,
+                        .memory = memory};
+
+  if (memory->restored) {
+    memory->restored = false;
+    state_restore(state, context);
+    state_journal_open(context, false);
+  }
+  if (state_created) {
+    state_journal_open(context, true);
+  }
+  font_job_collect(context);
+
+  EditorFrame *editor_frame = &state->editor_frame;
 
   const int16_t editor_frame_start_y = buffer->height * 0.01;
   const int16_t modeline_frame_start_y = buffer->height - state->font_h * 3;
   const int16_t ex_frame_start_y = modeline_frame_start_y + 1.5 * state->font_h;
+  const int16_t editor_frame_start_x = buffer->width * 0.01;
   editor_frame->viewport_v.size =
       (modeline_frame_start_y - editor_frame_start_y) / state->font_h;
-  // TODO make this dynamic
-  editor_frame->viewport_h.size = 100;
+  {
+    int32_t text_start_x = editor_frame_start_x +
+                           state->line_number_texture_width + state->font_h;
+    int32_t viewport_h_size =
+        (buffer->width - text_start_x) / state->min_glyph_width;
+    if (viewport_h_size < 1) {
+      viewport_h_size = 1;
+    }
+    if (viewport_h_size != editor_frame->viewport_h.size) {
+      editor_frame->viewport_h.size = viewport_h_size;
+      editor_frame_invalidate_viewport_textures(editor_frame);
+    }
+    editor_frame_set_wrap_width(editor_frame, buffer->width - text_start_x,
+                                state->glyph_width);
+  }
+
+  latency_collect(state, input);
 
   TemporaryMemory tmp_memory = beginTemporaryMemory(&transient_arena->arena);
 
   SDL_Event event;
   while (poll_event(input, &event)) {
     switch (event.type) {
-    case SDL_KEYDOWN:
-      switch (state->mode) {
-      case AppMode_normal:
-        break;
-      case AppMode_ex:
-        if (event.key.keysym.scancode == SDL_SCANCODE_RETURN) {
-          state->mode = AppMode_normal;
-          if ((ex_frame->size == 4 &&
-               strncmp(ex_frame->text, "quit", 4) == 0) ||
-              (ex_frame->size == 1 && strncmp(ex_frame->text, "q", 1) == 0)) {
-            state_destroy(state);
-            return 1;
-          } else if ((ex_frame->size == 4 &&
-                      strncmp(ex_frame->text, "load", 4) == 0)) {
-            char *filename = "data";
-            if (load_file(context, filename) != 0) {
-              sprintf(state->status_message, "Cannot open %s", filename);
-            }
-          } else if (strncmp(ex_frame->text, "load ", 5) == 0) {
-            ex_frame->text[ex_frame->size] = '\0';
-            char *filename = ex_frame->text + 5;
-            if (load_file(context, filename) != 0) {
-              sprintf(state->status_message, "Cannot open %s", filename);
-            }
-          } else if (strncmp(ex_frame->text, "dump ", 5) == 0) {
-            ex_frame->text[ex_frame->size] = '\0';
-            char *filename = ex_frame->text + 5;
-            if (dump_file(state, filename) == 0) {
-              sprintf(state->status_message, "Wrote to %s", filename);
-            } else {
-              sprintf(state->status_message, "Cannot write to %s", filename);
-            }
-          } else if (ex_frame->size == 5 &&
-                     strncmp(ex_frame->text, "close", 5) == 0) {
-            state->filename[0] = 0;
-            editor_frame_close(editor_frame);
-          } else if (ex_frame->size == 10 &&
-                     strncmp(ex_frame->text, "invalidate", 10) == 0) {
-            editor_frame_invalidate_viewport_textures(editor_frame);
-          } else if (strlen(ex_frame->text) > 0) {
-            sprintf(state->status_message, "Unrecognized command: %s",
-                    ex_frame->text);
-          }
-        } else if (event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
-          ex_frame_remove_char(ex_frame);
-        } else if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
-          state->mode = AppMode_normal;
-          ex_frame->size = 0;
-          ex_frame->cursor_column = 0;
-        }
-        break;
-      case AppMode_insert:
-        if (event.key.keysym.scancode == SDL_SCANCODE_RETURN) {
-          editor_frame_insert_new_line(editor_frame);
-        } else if (event.key.keysym.scancode == SDL_SCANCODE_BACKSPACE) {
-          editor_frame_remove_char(editor_frame);
-        } else if (event.key.keysym.scancode == SDL_SCANCODE_ESCAPE) {
-          state->mode = AppMode_normal;
+    case SDL_KEYDOWN: {
+      char key = 0;
+      switch (event.key.keysym.scancode) {
+      case SDL_SCANCODE_RETURN: {
+        key = KEY_RETURN;
+      } break;
+      case SDL_SCANCODE_BACKSPACE: {
+        key = KEY_BACKSPACE;
+      } break;
+      case SDL_SCANCODE_ESCAPE: {
+        key = KEY_ESCAPE;
+      } break;
+      case SDL_SCANCODE_V: {
+        if (event.key.keysym.mod & KMOD_CTRL) {
+          key = KEY_CTRL_V;
         }
-        break;
-      default:
-        assert(false);
-        break;
-      }
-      break;
-    case SDL_TEXTINPUT:
-      switch (state->mode) {
-      case AppMode_normal: {
-        for (size_t x = 0; x < strlen(event.text.text); ++x) {
-          key_state_machine_add_key(&state->normal_ksm, event.text.text[x],
-                                    state);
+      } break;
+      case SDL_SCANCODE_N: {
+        if (event.key.keysym.mod & KMOD_CTRL) {
+          key = KEY_CTRL_N;
         }
       } break;
-      case AppMode_ex: {
-        int16_t text_size = strlen(event.text.text);
-        ex_frame_insert_text(ex_frame, event.text.text, text_size);
+      case SDL_SCANCODE_P: {
+        if (event.key.keysym.mod & KMOD_CTRL) {
+          key = KEY_CTRL_P;
+        }
       } break;
-      case AppMode_insert: {
-        int16_t text_size = strlen(event.text.text);
-        editor_frame_insert_text(&transient_arena->arena, editor_frame,
-                                 event.text.text, text_size);
+      case SDL_SCANCODE_EQUALS:
+      case SDL_SCANCODE_MINUS: {
+        if (event.key.keysym.mod & KMOD_CTRL) {
+          bool in = event.key.keysym.scancode == SDL_SCANCODE_EQUALS;
+          state_zoom(context, in ? FONT_SIZE_STEP : -FONT_SIZE_STEP);
+        }
       } break;
       default:
-        assert(false);
         break;
       }
-      break;
+      if (key != 0) {
+        latency_pending_add(state,
+                            key == KEY_RETURN && state->mode == AppMode_ex
+                                ? LatencyKind_ex_command
+                                : LatencyKind_keydown,
+                            event.common.timestamp);
+        if (app_handle_key(context, key) == 1) {
+          return 1;
+        }
+      }
+    } break;
+    case SDL_TEXTINPUT: {
+      latency_pending_add(state, LatencyKind_text_input,
+                          event.common.timestamp);
+      for (size_t x = 0; x < strlen(event.text.text); ++x) {
+        if (app_handle_key(context, event.text.text[x]) == 1) {
+          return 1;
+        }
+      }
+    } break;
     case SDL_QUIT: /* if mouse click to close window */
-      state_destroy(state);
+      state_destroy(state, memory);
       return 1;
     }
   }
 
+  if (grep_search_step(state->grep, memory)) {
+    if (state->grep->list_open) {
+      grep_list_append(context);
+    }
+    grep_status_show(state);
+  }
+  if (file_index_step(state->file_index, memory) &&
+      state->mode == AppMode_picker) {
+    file_index_rank(state->file_index, state->ex_frame.text,
+                    state->ex_frame.size);
+  }
+
   // -------- rendering
+  raster_jobs_collect(context);
+
+  // NOTE: the rows under a picker that closed are drawn again
+  bool picker_closed = state->picker_shown && state->mode != AppMode_picker;
+  state->picker_shown = state->mode == AppMode_picker;
+  if (picker_closed) {
+    state->picker_signature = 0;
+  }
+  bool redraw_all =
+      screen_target_update(context, buffer->width, buffer->height) ||
+      input->executableReloaded || picker_closed;
+  SDL_ccode(SDL_SetRenderTarget(buffer->renderer, state->screen_target));
+  if (redraw_all) {
+    SDL_ccode(SDL_SetRenderDrawColor(buffer->renderer, UNHEX(BG_COLOR)));
+    SDL_ccode(SDL_RenderClear(buffer->renderer));
+  }
+  state->rows_redrawn = 0;
+
   // render editor frame
   {
     assert(editor_frame->viewport_v.start >= 0);
@@ -547,54 +2195,168 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
     assert(editor_frame->viewport_v.start < editor_frame->line_count);
     Line *start_line = editor_frame->index[editor_frame->viewport_v.start];
     assert(start_line != NULL);
-    Line *end_line = NULL;
+    bool wrapping = editor_frame_wrapping(editor_frame);
+    int32_t row = wrapping ? editor_frame->viewport_row : 0;
+    int32_t rows_left = editor_frame->viewport_v.size;
+    int32_t screen_row = 0;
 
-    if ((editor_frame->viewport_v.start + editor_frame->viewport_v.size) <
-        editor_frame->line_count) {
-      end_line = editor_frame->index[editor_frame->viewport_v.start +
-                                     editor_frame->viewport_v.size];
-    }
-
-    int16_t x_start = buffer->width * 0.01;
+    int16_t x_start = editor_frame_start_x;
     SDL_Rect dest;
     dest.x = x_start;
     dest.y = editor_frame_start_y;
     dest.h = state->font_h;
 
-    int16_t line_number = editor_frame->viewport_v.start;
+    int32_t line_number = editor_frame->viewport_v.start;
     SDL_Color color = {UNHEX(EDITOR_FONT_COLOR)};
-    char line_number_str[6];
+    char line_number_str[12];
+
+    // NOTE: the gutter is as wide as the biggest line number, cached
+    // textures are dropped when that changes
+    int32_t line_number_digits = 4;
+    for (int32_t n = editor_frame->line_count; n >= 10000; n /= 10) {
+      line_number_digits++;
+    }
+    if (line_number_digits != state->line_number_digits) {
+      state->line_number_digits = line_number_digits;
+      redraw_all = true;
+      line_number_textures_clear(state);
+    }
 
-    for (Line *line = start_line; line != end_line; line = line->next) {
-      assert(line_number < LINE_NUMBER_TEXTURE_CACHE_SIZE);
+    for (Line *line = start_line; line != NULL && rows_left > 0;
+         line = line->next) {
+      int32_t slot = line_number % LINE_NUMBER_TEXTURE_CACHE_SIZE;
       SDL_Texture *line_number_texture =
-          state->line_number_texture_cache[line_number];
+          state->line_number_texture_cache[slot];
+      if (line_number_texture != NULL &&
+          state->line_number_texture_cache_key[slot] != line_number) {
+        SDL_DestroyTexture(line_number_texture);
+        line_number_texture = NULL;
+      }
       if (line_number_texture == NULL) {
-        sprintf(line_number_str, "%4d", line_number);
-        line_number_texture =
-            texture_from_text(buffer->renderer, state->font, line_number_str,
-                              color, &state->line_number_texture_width);
-        state->line_number_texture_cache[line_number] = line_number_texture;
+        sprintf(line_number_str, "%10d", line_number);
+        line_number_texture = texture_from_text(
+            buffer->renderer, state->font,
+            line_number_str + 10 - line_number_digits, color,
+            &state->line_number_texture_width);
+        state->line_number_texture_cache[slot] = line_number_texture;
+        state->line_number_texture_cache_key[slot] = line_number;
       }
 
       dest.w = state->line_number_texture_width;
-      SDL_ccode(
-          SDL_RenderCopy(buffer->renderer, line_number_texture, NULL, &dest));
+      SDL_Point start = (SDL_Point){.x = dest.x + dest.w + state->font_h};
+      int32_t rows = 1;
+      if (wrapping) {
+        rows = editor_frame_line_rows(editor_frame, line);
+      } else {
+        line_texture_update(context, line, color);
+      }
 
-      dest.x += dest.w + state->font_h;
+      for (; row < rows && rows_left > 0; ++row, --rows_left, ++screen_row) {
+        ScreenRow shown = {.line = line,
+                           .line_number = line_number,
+                           .row = row,
+                           .cursor_x = -1};
+        if (wrapping) {
+          int32_t row_start = line_row_start(line, row);
+          char *text = line_text(editor_frame, line);
+          shown.content = hash_bytes(HASH_SEED, text + row_start,
+                                     line_row_end(line, row) - row_start);
+          shown.cursor_x = row_cursor_x(state, line, row);
+        } else {
+          LineRender *render = line->render;
+          shown.content = render != NULL && render->texture != NULL
+                              ? render->texture_serial
+                              : 0;
+          if (line == editor_frame->cursor.line) {
+            shown.cursor_x =
+                line_column_x(state, line, editor_frame->cursor.column);
+          }
+        }
+        if (shown.cursor_x >= 0) {
+          shown.cursor_style = state->mode;
+        }
+        row_selection_x(state, line, line_number, row, &shown);
+
+        if (screen_row_changed(state, screen_row, &shown, redraw_all)) {
+          SDL_Rect row_rect = {
+              .x = 0, .y = dest.y, .w = buffer->width, .h = state->font_h};
+          screen_clear_rect(buffer->renderer, &row_rect);
+          if (shown.selection_x1 > shown.selection_x0) {
+            SDL_Rect selection_rect = {.x = start.x + shown.selection_x0,
+                                       .y = dest.y,
+                                       .w = shown.selection_x1 -
+                                            shown.selection_x0,
+                                       .h = state->font_h};
+            SDL_ccode(SDL_SetRenderDrawColor(buffer->renderer,
+                                             UNHEX(SELECTION_COLOR)));
+            SDL_ccode(SDL_RenderFillRect(buffer->renderer, &selection_rect));
+          }
+          if (row == 0) {
+            SDL_ccode(SDL_RenderCopy(buffer->renderer, line_number_texture,
+                                     NULL, &dest));
+          }
+          start.y = dest.y;
+          if (wrapping) {
+            editor_frame_render_row(context, line, row, start, color);
+          } else {
+            editor_frame_render_line(context, line, start, color);
+          }
+          state->rows_redrawn++;
+        }
+        dest.y += state->font_h;
+      }
+      row = 0;
+      line_number++;
+    }
 
-      SDL_Point start = (SDL_Point){.x = dest.x, .y = dest.y};
-      editor_frame_render_line(context, line, start, color);
+    // NOTE: rows past the end of the buffer
+    for (; rows_left > 0; --rows_left, ++screen_row) {
+      ScreenRow shown = {.cursor_x = -1};
+      if (screen_row_changed(state, screen_row, &shown, redraw_all)) {
+        SDL_Rect row_rect = {
+            .x = 0, .y = dest.y, .w = buffer->width, .h = state->font_h};
+        screen_clear_rect(buffer->renderer, &row_rect);
+        state->rows_redrawn++;
+      }
       dest.y += state->font_h;
-      dest.x = x_start;
-      line_number++;
+    }
+    editor_frame_wrap_step(editor_frame, WRAP_STEP_LINES);
+  }
+
+  // NOTE: the picker covers the last editor rows, it is drawn again after
+  // any row under it was
+  if (state->mode == AppMode_picker) {
+    uint64_t signature = picker_signature(state);
+    if (redraw_all || state->rows_redrawn > 0 ||
+        signature != state->picker_signature) {
+      state->picker_signature = signature;
+      picker_render(context, buffer->width, modeline_frame_start_y);
     }
   }
 
+  // NOTE: the modeline and the ex line are redrawn together
+  uint64_t bottom = bottom_signature(state);
+  bool redraw_bottom = redraw_all || bottom != state->bottom_signature;
+  if (redraw_bottom) {
+    state->bottom_signature = bottom;
+    SDL_Rect bottom_rect = {.x = 0,
+                            .y = modeline_frame_start_y,
+                            .w = buffer->width,
+                            .h = buffer->height - modeline_frame_start_y};
+    screen_clear_rect(buffer->renderer, &bottom_rect);
+  }
+
   // render modeline
-  {
+  if (redraw_bottom) {
     assert(state->mode < AppMode_count);
-    CachedTexture *texture = state->appModeTextures + state->mode;
+    static char *app_mode_labels[AppMode_count] = {
+        [AppMode_normal] = "NORMAL | ",
+        [AppMode_ex] = "EX | ",
+        [AppMode_insert] = "INSERT | ",
+        [AppMode_visual_line] = "VISUAL LINE | ",
+        [AppMode_visual_block] = "VISUAL BLOCK | ",
+        [AppMode_picker] = "FIND | ",
+    };
     SDL_Rect dest;
     dest.y = modeline_frame_start_y;
     dest.h = state->font_h;
@@ -605,9 +2367,11 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
         SDL_SetRenderDrawColor(buffer->renderer, UNHEX(MODELINE_BG_COLOR)));
     SDL_ccode(SDL_RenderFillRect(buffer->renderer, &dest));
 
+    SDL_Color mode_color = {UNHEX(MODELINE_FONT_COLOR)};
     dest.x = buffer->width * 0.01;
-    dest.w = texture->w;
-    SDL_ccode(SDL_RenderCopy(buffer->renderer, texture->texture, NULL, &dest));
+    dest.w = glyph_atlas_render_text(buffer->renderer, &state->atlas,
+                                     app_mode_labels[state->mode], dest.x,
+                                     dest.y, mode_color);
 
     dest.x += dest.w;
 
@@ -628,26 +2392,41 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
 
       dest.w = state->normal_ksm.texture_width;
       SDL_RenderCopy(buffer->renderer, state->normal_ksm.texture, NULL, &dest);
+      dest.x += dest.w + state->font_h;
+    }
+
+    if (state->recording_register >= 0) {
+      if (state->recording_texture == NULL) {
+        SDL_Color color = {UNHEX(MODELINE_FONT_COLOR)};
+        char text[20];
+        sprintf(text, "recording @%c", 'a' + state->recording_register);
+        state->recording_texture =
+            texture_from_text(buffer->renderer, state->font, text, color,
+                              &state->recording_texture_width);
+      }
+
+      dest.w = state->recording_texture_width;
+      SDL_RenderCopy(buffer->renderer, state->recording_texture, NULL, &dest);
       dest.x += dest.w;
     }
   }
 
-  if (state->mode == AppMode_ex) {
+  if (redraw_bottom &&
+      (state->mode == AppMode_ex || state->mode == AppMode_picker)) {
     int16_t x = 0.005 * buffer->width;
 
     SDL_Rect dest;
     dest.x = x;
     dest.y = ex_frame_start_y;
     dest.h = state->font_h;
-    dest.w = state->ex_prefix_texture_width;
-    SDL_ccode(SDL_RenderCopy(buffer->renderer, state->ex_prefix_texture, NULL,
-                             &dest));
-    dest.x += dest.w;
-
     SDL_Color color = {UNHEX(EX_FONT_COLOR)};
+    char *prompt = state->mode == AppMode_ex ? ":" : "find: ";
+    dest.x += glyph_atlas_render_text(buffer->renderer, &state->atlas, prompt,
+                                      dest.x, dest.y, color);
+
     SDL_Point start = (SDL_Point){.x = dest.x, .y = dest.y};
     ex_frame_render_line(context, start, color);
-  } else if (strlen(state->status_message) > 0) {
+  } else if (redraw_bottom && strlen(state->status_message) > 0) {
     int16_t x = 0.005 * buffer->width;
     SDL_Rect dest;
     dest.x = x;
@@ -658,7 +2437,18 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
     SDL_Texture *texture = texture_from_text(
         buffer->renderer, state->font, state->status_message, color, &dest.w);
     SDL_ccode(SDL_RenderCopy(buffer->renderer, texture, NULL, &dest));
+    SDL_DestroyTexture(texture);
+  }
+
+  // NOTE: until the font of a zoom is ready the old one is shown scaled
+  SDL_Rect screen_rect = {.w = buffer->width, .h = buffer->height};
+  if (state->font_size_target != state->font_size) {
+    screen_rect.w = screen_rect.w * state->font_size_target / state->font_size;
+    screen_rect.h = screen_rect.h * state->font_size_target / state->font_size;
   }
+  SDL_ccode(SDL_SetRenderTarget(buffer->renderer, NULL));
+  SDL_ccode(SDL_RenderCopy(buffer->renderer, state->screen_target, NULL,
+                           &screen_rect));
 
 #if DEBUG_WINDOW
   {
@@ -706,7 +2496,8 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
     dest.y += state->font_h;
 
     {
-      sprintf(text, "Ex frame cursor column: %d", ex_frame->cursor_column);
+      sprintf(text, "Ex frame cursor column: %d",
+              state->ex_frame.cursor_column);
       SDL_Texture *texture = texture_from_text(
           buffer->debug_renderer, state->font, text, color, &dest.w);
       SDL_RenderCopy(buffer->debug_renderer, texture, NULL, &dest);
@@ -719,5 +2510,28 @@ extern UPDATE_AND_RENDER(UpdateAndRender) {
 
   endTemporaryMemory(tmp_memory);
 
+  if (editor_frame->journal != NULL && journal_flush(editor_frame->journal)) {
+    __atomic_store_n(&memory->journal_dirty, 1, __ATOMIC_RELEASE);
+  }
+
+  state->frame_time_last = (real32)(SDL_GetPerformanceCounter() - frame_start) *
+                           1000.0f / (real32)SDL_GetPerformanceFrequency();
+  if (state->frame_time_last > state->frame_time_max) {
+    state->frame_time_max = state->frame_time_last;
+  }
+
+  tmp_memory = beginTemporaryMemory(&transient_arena->arena);
+  editor_frame_prefetch(context, input,
+                        (SDL_Color){UNHEX(EDITOR_FONT_COLOR)});
+  endTemporaryMemory(tmp_memory);
+
+  // NOTE: one step a frame when there is time left, a pass over a huge
+  // buffer is spread over seconds
+  if (input->frame_deadline != 0 &&
+      SDL_GetPerformanceCounter() < input->frame_deadline) {
+    editor_frame_cold_step(&transient_arena->arena, &state->editor_frame,
+                           COLD_STEP_LINES);
+  }
+
   return 0;
 }
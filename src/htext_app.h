@@ -5,17 +5,57 @@
 #include "htext_platform.h"
 #include <SDL2/SDL_render.h>
 #include <SDL2/SDL_ttf.h>
+#include <stddef.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
-#define INDEX_SIZE 5000
+// NOTE: compiles in the frame integrity checks, `make bench` turns them off.
+// How much they check is picked at runtime, see EditorFrameIntegrity
+#ifndef EDITOR_FRAME_INTEGRITY
+#define EDITOR_FRAME_INTEGRITY 1
+#endif
+
+#define INDEX_INITIAL_SIZE 5000
 #define KEY_PREFIX_MAX_SIZE 20
-#define LINE_NUMBER_TEXTURE_CACHE_SIZE 5000
+#define LINE_NUMBER_TEXTURE_CACHE_SIZE 512
+
+#define ARENA_COMMIT_SIZE Kilobytes(64)
+#define ARENA_HUGE_PAGE_SIZE Megabytes(2)
+#ifndef FRAME_ARENA_HUGE_PAGES
+#define FRAME_ARENA_HUGE_PAGES 1
+#endif
+
+#ifndef ARENA_TAGS
+#define ARENA_TAGS 0
+#endif
+#define ARENA_TAG_COUNT 32
+
+#define ARENA_STRINGIFY_(x) #x
+#define ARENA_STRINGIFY(x) ARENA_STRINGIFY_(x)
+#define ARENA_CALLSITE __FILE__ ":" ARENA_STRINGIFY(__LINE__)
 
+typedef struct {
+  const char *callsite;
+  memory_index size;
+  uint32_t count;
+} ArenaTag;
+
+// NOTE: size is only reserved address space, pages are committed on demand
+// as used grows and can be given back to the OS with releaseArena
 typedef struct {
   memory_index size;
   uint8_t *base;
   memory_index used;
+  memory_index committed;
+  memory_index commit_size;
   int32_t tempCount;
+
+  memory_index high_water;
+  uint32_t allocation_count;
+#if ARENA_TAGS
+  // NOTE: the last tag also collects every callsite that did not fit
+  ArenaTag tags[ARENA_TAG_COUNT];
+#endif
 } MemoryArena;
 
 typedef struct {
@@ -32,7 +72,74 @@ static void initializeArena(MemoryArena *arena, memory_index size, void *base) {
   arena->size = size;
   arena->base = (uint8_t *)base;
   arena->used = 0;
+  arena->committed = 0;
+  arena->commit_size = ARENA_COMMIT_SIZE;
   arena->tempCount = 0;
+  arena->high_water = 0;
+  arena->allocation_count = 0;
+#if ARENA_TAGS
+  memset(arena->tags, 0, sizeof(arena->tags));
+#endif
+}
+
+inline static size_t align_down(size_t value, size_t alignment) {
+  return value & ~(alignment - 1);
+}
+
+inline static size_t align_up(size_t value, size_t alignment) {
+  return align_down(value + alignment - 1, alignment);
+}
+
+// NOTE: big arenas ask for transparent huge pages, commits then happen in
+// huge page steps so the kernel can back them with a single TLB entry
+static void arenaUseHugePages(MemoryArena *arena) {
+#ifdef MADV_HUGEPAGE
+  size_t start = align_up((size_t)arena->base, ARENA_HUGE_PAGE_SIZE);
+  size_t end = align_down((size_t)arena->base + arena->size,
+                          ARENA_HUGE_PAGE_SIZE);
+  if (start < end) {
+    madvise((void *)start, end - start, MADV_HUGEPAGE);
+    arena->commit_size = ARENA_HUGE_PAGE_SIZE;
+  }
+#else
+  (void)arena;
+#endif
+}
+
+// NOTE: false when the pages can't be made writable, nothing is committed
+// then and the caller gets to decide what a failed allocation means
+static bool commitArena(MemoryArena *arena, memory_index used) {
+  if (used > arena->size) {
+    return false;
+  }
+  if (used <= arena->committed) {
+    return true;
+  }
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t start = align_down((size_t)arena->base + arena->committed, page_size);
+  size_t end = align_up((size_t)arena->base + used, arena->commit_size);
+  if (end > (size_t)arena->base + arena->size) {
+    end = (size_t)arena->base + arena->size;
+  }
+  if (mprotect((void *)start, end - start, PROT_READ | PROT_WRITE) != 0) {
+    return false;
+  }
+  arena->committed = end - (size_t)arena->base;
+  return true;
+}
+
+// NOTE: gives the pages past used back to the OS, they read as zero when
+// committed again
+static void releaseArena(MemoryArena *arena) {
+  size_t page_size = sysconf(_SC_PAGESIZE);
+  size_t start = align_up((size_t)arena->base + arena->used, page_size);
+  size_t end = (size_t)arena->base + arena->committed;
+  if (start >= end) {
+    return;
+  }
+  madvise((void *)start, end - start, MADV_DONTNEED);
+  mprotect((void *)start, end - start, PROT_NONE);
+  arena->committed = start - (size_t)arena->base;
 }
 
 inline static size_t getAlignmentOffset(MemoryArena *arena, size_t alignment) {
@@ -57,18 +164,54 @@ inline static memory_index getArenaRemainingSize(MemoryArena *arena) {
   (type *)pushSize(arena, sizeof(type), aligment)
 #define pushArray(arena, count, type, aligment)                                \
   (type *)pushSize(arena, (count) * sizeof(type), aligment)
+#define pushSize(arena, size, alignment)                                       \
+  pushSizeTagged(arena, size, alignment, ARENA_CALLSITE)
+
+#if ARENA_TAGS
+static void arenaTag(MemoryArena *arena, const char *callsite,
+                     memory_index size) {
+  ArenaTag *tag = arena->tags + ARENA_TAG_COUNT - 1;
+  for (int32_t i = 0; i < ARENA_TAG_COUNT - 1; ++i) {
+    if (arena->tags[i].callsite == NULL) {
+      arena->tags[i].callsite = callsite;
+    }
+    if (arena->tags[i].callsite == callsite) {
+      tag = arena->tags + i;
+      break;
+    }
+  }
+  tag->size += size;
+  tag->count++;
+}
+#endif
 
 #define DEFAULT_ALIGNMENT 4
-void *pushSize(MemoryArena *arena, size_t size, size_t alignment) {
+// NOTE: NULL when the arena is full or its pages can't be committed
+void *pushSizeTagged(MemoryArena *arena, size_t size, size_t alignment,
+                     const char *callsite) {
   size_t originalSize = size;
   size_t alignmentOffset = getAlignmentOffset(arena, alignment);
   size += alignmentOffset;
 
-  assert((arena->used + size) <= arena->size);
+  if (size > arena->size - arena->used ||
+      !commitArena(arena, arena->used + size)) {
+    return NULL;
+  }
   void *result = arena->base + arena->used + alignmentOffset;
   arena->used += size;
 
   assert(size >= originalSize);
+  (void)originalSize;
+
+  if (arena->used > arena->high_water) {
+    arena->high_water = arena->used;
+  }
+  arena->allocation_count++;
+#if ARENA_TAGS
+  arenaTag(arena, callsite, size);
+#else
+  (void)callsite;
+#endif
 
   return result;
 }
@@ -76,6 +219,9 @@ void *pushSize(MemoryArena *arena, size_t size, size_t alignment) {
 char *push_string(MemoryArena *arena, char *source) {
   uint32_t size = strlen(source) + 1;
   char *dest = (char *)pushSize(arena, size, DEFAULT_ALIGNMENT);
+  if (dest == NULL) {
+    return NULL;
+  }
   for (uint32_t charIndex = 0; charIndex < size; ++charIndex) {
     dest[charIndex] = source[charIndex];
   }
@@ -83,12 +229,18 @@ char *push_string(MemoryArena *arena, char *source) {
 }
 
 #define ARENA_DEFAULT_ALIGNMENT 16
+// NOTE: sub arenas are carved from the end of the reserved range, so the
+// parent never commits them and they commit their own pages on demand
 static void sub_arena(MemoryArena *result, MemoryArena *arena, size_t size,
                       size_t alignment) {
-  result->size = size;
-  result->base = (uint8_t *)pushSize(arena, size, alignment);
-  result->used = 0;
-  result->tempCount = 0;
+  size_t end = (size_t)arena->base + arena->size;
+  size_t base = align_down(end - size, alignment);
+  assert(base >= (size_t)arena->base + arena->used);
+  arena->size = base - (size_t)arena->base;
+  if (arena->committed > arena->size) {
+    arena->committed = arena->size;
+  }
+  initializeArena(result, end - base, (void *)base);
 }
 
 TemporaryMemory beginTemporaryMemory(MemoryArena *arena) {
@@ -109,54 +261,290 @@ void endTemporaryMemory(TemporaryMemory temporaryMemory) {
 
 inline void checkArena(MemoryArena *arena) { assert(arena->tempCount == 0); }
 
-enum AppMode { AppMode_normal, AppMode_ex, AppMode_insert, AppMode_count };
+enum AppMode {
+  AppMode_normal,
+  AppMode_ex,
+  AppMode_insert,
+  AppMode_visual_line,
+  AppMode_visual_block,
+  AppMode_picker,
+  AppMode_count
+};
 
-typedef struct {
+struct Line;
+struct RasterJob;
+
+// NOTE: everything derived from the text of a line to show it. Lines only
+// get one once they are rendered or wrapped, so scrolling through part of a
+// huge file doesn't cost it for every line. Given back when the line is
+// deleted
+typedef struct LineRender {
+  // NOTE: the texture and the advances only cover the visible part of the
+  // line, starting at texture_column, so very long lines cost as much as the
+  // screen is wide
   SDL_Texture *texture;
-  int32_t w;
-} CachedTexture;
+  int32_t texture_width;
+  int32_t texture_column;
+  // NOTE: the text changed inside a batch, the texture is dropped when the
+  // batch ends or when the line is rendered again
+  bool texture_dirty;
+  // NOTE: a worker is rasterizing the line, the texture is created from its
+  // surface when it is done
+  struct RasterJob *raster_job;
+  // NOTE: tells textures apart, addresses of destroyed textures are reused
+  uint32_t texture_serial;
 
-struct Line;
+  // NOTE: prefix sum of glyph advances, advances[i] is the x offset of column
+  // texture_column + i. Only used for proportional fonts, invalidated with the
+  // texture
+  int32_t *advances;
+  int32_t advances_size;
+  bool advances_valid;
+
+  // NOTE: with soft wrapping row i + 1 of the line starts at column wraps[i].
+  // Valid while wrap_generation matches the frame, 0 never does
+  int32_t *wraps;
+  int32_t wrap_count;
+  int32_t wraps_size;
+  int32_t wrap_generation;
+
+  struct LineRender *next_free;
+} LineRender;
 
+// NOTE: lines up to LINE_INLINE_SIZE - 1 characters keep their text in the
+// line itself, text points to inline_text until the line outgrows it. The
+// text of a cold line is NULL, inline_text holds a ColdLine instead
+#define LINE_INLINE_SIZE 19
+
+// NOTE: 64 bytes, lines are allocated LINE_BLOCK_COUNT at a time so walking
+// the list of a loaded file goes through memory in order
 typedef struct Line {
   char *text;
-  int16_t len;
-  int16_t max_len;
+  int32_t len;
+  int32_t max_len;
   struct Line *prev;
   struct Line *next;
-
-  SDL_Texture *texture;
-  int32_t texture_width;
+  // NOTE: NULL until the line is rendered or wrapped
+  LineRender *render;
+  // NOTE: number of the line in the file the frame was loaded from or last
+  // saved to while its text is the same as there, -1 once it changes
+  int32_t origin;
+  // NOTE: a text register points to text too, it is copied before the line
+  // changes it
+  bool text_shared;
+  char inline_text[LINE_INLINE_SIZE];
 } Line;
 
+#define LINE_BLOCK_COUNT 1024
+
+// NOTE: the texts of consecutive lines far from the viewport and the cursor,
+// joined by new lines and compressed with lz_compress. The data follows the
+// struct. cache_slot is the EditorFrame.cold_cache slot holding it
+// decompressed, or -1
+typedef struct {
+  int32_t size;
+  int32_t compressed_size;
+  int32_t cache_slot;
+} ColdBlock;
+
+typedef struct {
+  ColdBlock *block;
+  int32_t offset;
+} ColdLine;
+static_assert(sizeof(ColdLine) <= LINE_INLINE_SIZE, "ColdLine fits inline");
+
+typedef struct {
+  ColdBlock *block;
+  char *text;
+  uint32_t last_use;
+} ColdCacheSlot;
+
+#define COLD_BLOCK_SIZE Kilobytes(64)
+// NOTE: smaller runs can't give a page back once alignment is accounted for
+#define COLD_BLOCK_MIN_SIZE Kilobytes(16)
+// NOTE: lines this close to the viewport or the cursor stay warm
+#define COLD_HOT_LINES 4096
+// NOTE: a text pointer from line_text stays valid until COLD_CACHE_COUNT
+// other blocks are decompressed
+#define COLD_CACHE_COUNT 8
+
+enum JournalOp {
+  JournalOp_load,
+  JournalOp_close,
+  JournalOp_insert_text,
+  JournalOp_remove_char,
+  JournalOp_insert_new_line,
+  JournalOp_remove_lines,
+  JournalOp_delete_range,
+  JournalOp_substitute,
+  JournalOp_block_insert,
+  JournalOp_block_delete,
+  JournalOp_put,
+};
+
+// NOTE: on disk every record is followed by size bytes of payload. The cursor
+// is the one the operation started from
+typedef struct {
+  int32_t op;
+  int32_t line_num;
+  int32_t column;
+  int32_t args[4];
+  int32_t size;
+} JournalRecord;
+
+#define JOURNAL_PATH "htext.journal"
+#define JOURNAL_BUFFER_SIZE Kilobytes(64)
+
+// NOTE: an append-only log of editor frame mutations since the last load or
+// write, replayed over the loaded file after a crash
+typedef struct {
+  int fd;
+  char *buffer;
+  int32_t size;
+  // NOTE: > 0 while an operation that was already recorded runs other
+  // mutators, and while the journal is being replayed
+  int32_t suspended;
+} Journal;
+
+typedef struct {
+  char *text;
+  int32_t len;
+} LineSpan;
+
+// NOTE: yanked lines. Spans point to the text of the lines in the editor
+// frame, which are marked text_shared, so yanking copies no text. Only short
+// lines, whose text lives in the line itself, are copied into the register
+// arena, and every text still in the frame arena is copied there before the
+// frame is closed
+typedef struct {
+  MemoryArena arena;
+  LineSpan *spans;
+  int32_t count;
+} TextRegister;
+
+// NOTE: the unnamed register and "a to "z
+#define TEXT_REGISTER_COUNT 27
+#define TEXT_REGISTER_ARENA_SIZE Megabytes(128)
+
+typedef struct {
+  TextRegister registers[TEXT_REGISTER_COUNT];
+} TextRegisters;
+
 typedef struct {
   Line *line;
-  int16_t line_num;
-  int16_t column;
+  int32_t line_num;
+  int32_t column;
 } Cursor;
 
 typedef struct {
-  int16_t start;
-  int16_t size;
+  int32_t start;
+  int32_t size;
 } Viewport;
 
+// NOTE: what is checked after every edit. touched only looks at the lines
+// the edit changed and their neighbors, periodic adds a full sweep every
+// INTEGRITY_SWEEP_INTERVAL edits and full walks every line every time. The
+// starting level comes from $HTEXT_INTEGRITY, :set integrity=<level> changes
+// it
+enum EditorFrameIntegrity {
+  Integrity_off,
+  Integrity_touched,
+  Integrity_periodic,
+  Integrity_full,
+  Integrity_count
+};
+#define INTEGRITY_SWEEP_INTERVAL 1000
+
+// NOTE: tells whether a file is still the one that was read or written
+typedef struct {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+} FileIdentity;
+
 typedef struct {
   Line *line;
-  int16_t line_count;
+  int32_t line_count;
   // NOTE: currently I use this only to optimize the rendering window, so it
   // could be much smaller, some cursor_line +/- amount_of_lines_to_render
-  Line *index[INDEX_SIZE];
+  // Grows by doubling, old copies are left in the arena
+  Line **index;
+  int32_t index_size;
 
   Cursor cursor;
 
   Viewport viewport_v;
   Viewport viewport_h;
+  // NOTE: with soft wrapping viewport_v.size counts rows and the screen starts
+  // at row viewport_row of the line viewport_v.start
+  int32_t viewport_row;
+
+  // NOTE: rows break where the glyph widths add up to more than wrap_width
+  // pixels. A new width bumps wrap_generation, visible lines are rewrapped as
+  // they are shown and the rest by editor_frame_wrap_step, from wrap_next
+  bool wrap;
+  int32_t wrap_width;
+  int32_t *wrap_glyph_width;
+  int32_t wrap_generation;
+  int32_t wrap_next;
 
   MemoryArena arena;
   // IMPORTANT: this is not a double link list, only next pointers are valid
   Line *deleted_line;
+  // NOTE: lines are handed out from line_block, renders of deleted lines are
+  // kept for reuse in free_render
+  Line *line_block;
+  int32_t line_block_left;
+  LineRender *free_render;
+
+  // NOTE: index entries [0, index_valid_size) are up to date, the rest is
+  // rebuilt lazily by editor_frame_reindex_from
+  int32_t index_valid_size;
+  // NOTE: while batch_depth > 0 reindexing, viewport texture invalidation and
+  // integrity checks are deferred to editor_frame_end_batch
+  int16_t batch_depth;
+  bool batch_viewport_invalidated;
+  // NOTE: lines touched by the current batch, [batch_dirty_start,
+  // batch_dirty_end) in line numbers at the end of the batch
+  int32_t batch_dirty_start;
+  int32_t batch_dirty_end;
+
+  // NOTE: bytes left behind in the arena by regrown line buffers, advances
+  // and index copies
+  memory_index abandoned_size;
+
+  // NOTE: NULL when edits are not journaled, batch mode and tests
+  Journal *journal;
+  // NOTE: NULL when nothing can be yanked, batch mode
+  TextRegisters *registers;
+
+  enum EditorFrameIntegrity integrity;
+  int32_t integrity_edits;
+
+  // NOTE: the file the lines came from, origin_offsets[n] is where its line n
+  // starts. Saving back to it copies runs of unchanged lines from it. Empty
+  // when the file is unknown or changed under us
+  FileIdentity origin_file;
+  int64_t *origin_offsets;
+  int32_t origin_count;
+  int32_t origin_size;
+  // NOTE: something changed since the frame was loaded or saved
+  bool modified;
+
+  // NOTE: editor_frame_cold_step goes on from cold_next. cold_size and
+  // cold_compressed_size add up every block made so far
+  int32_t cold_next;
+  uint32_t cold_use;
+  ColdCacheSlot cold_cache[COLD_CACHE_COUNT];
+  memory_index cold_size;
+  memory_index cold_compressed_size;
 } EditorFrame;
 
+// NOTE: editor_frame_load_file result for a file with tabs, control bytes or
+// bytes past ASCII, which lines can't hold
+#define LOAD_FILE_UNPRINTABLE -2
+
 typedef struct {
   char *text;
   int16_t size;
@@ -164,11 +552,112 @@ typedef struct {
   int16_t cursor_column;
   SDL_Texture *texture;
   int32_t texture_width;
+
+  int32_t *advances;
+  bool advances_valid;
 } ExFrame;
 
 #define ASCII_LOW 32
 #define ASCII_HIGH 126
 
+// NOTE: keys are handled as chars so they can be recorded into registers, the
+// few non printable keys we care about use their ascii control codes
+#define KEY_BACKSPACE '\b'
+#define KEY_RETURN '\r'
+#define KEY_ESCAPE '\x1b'
+#define KEY_CTRL_V '\x16'
+#define KEY_CTRL_N '\x0e'
+#define KEY_CTRL_P '\x10'
+
+#define GLYPH_COUNT (ASCII_HIGH - ASCII_LOW + 1)
+#define GLYPH_ATLAS_MAGIC 0x3130534c54415448ULL // "HTATLS01"
+
+// NOTE: the font can be overridden with $HTEXT_FONT
+#define FONT_PATH "IosevkaNerdFont-Regular.ttf"
+#define FONT_SIZE 20
+// NOTE: Ctrl+= and Ctrl+- change the size by FONT_SIZE_STEP
+#define FONT_SIZE_MIN 8
+#define FONT_SIZE_MAX 72
+#define FONT_SIZE_STEP 2
+
+// NOTE: on disk the header is followed by h rows of w ARGB8888 pixels
+typedef struct {
+  uint64_t magic;
+  uint64_t font_hash;
+  int32_t font_size;
+  int32_t font_style;
+  int32_t w;
+  int32_t h;
+  int32_t advances[GLYPH_COUNT];
+  SDL_Rect glyphs[GLYPH_COUNT];
+} GlyphAtlasFileHeader;
+
+typedef struct {
+  SDL_Texture *texture;
+  int32_t h;
+  SDL_Rect glyphs[GLYPH_COUNT];
+} GlyphAtlas;
+
+// NOTE: a font size opened and rasterized on a worker, the main thread only
+// turns the atlas surface into a texture when it swaps fonts
+typedef struct {
+  // NOTE: written by the worker when done, accessed with __atomic builtins
+  int32_t state;
+  int32_t font_size;
+  TTF_Font *font;
+  SDL_Surface *surface;
+  GlyphAtlasFileHeader header;
+  bool cached;
+} FontJob;
+
+// NOTE: TTF fonts can't be shared between threads, every job takes one of
+// the pool fonts for as long as it renders
+#define RASTER_FONT_COUNT (WORK_QUEUE_THREAD_COUNT + 1)
+#define RASTER_JOB_COUNT 64
+#define RASTER_JOB_TEXT_SIZE 1024
+// NOTE: lines rasterized on the main thread per frame before the rest go to
+// the workers, so typing and single line scrolling never wait a frame
+#define RASTER_SYNC_LINES 4
+
+enum RasterJobState { RasterJob_free, RasterJob_queued, RasterJob_done };
+
+typedef struct RasterJob {
+  struct RasterPool *pool;
+  // NOTE: written by the worker when done, accessed with __atomic builtins
+  int32_t state;
+  // NOTE: NULL once the line was invalidated, the surface is then dropped
+  Line *line;
+  SDL_Color color;
+  char text[RASTER_JOB_TEXT_SIZE];
+  SDL_Surface *surface;
+} RasterJob;
+
+typedef struct RasterPool {
+  TTF_Font *fonts[RASTER_FONT_COUNT];
+  int32_t font_locks[RASTER_FONT_COUNT];
+  RasterJob jobs[RASTER_JOB_COUNT];
+  int32_t sync_budget;
+  int32_t async_count;
+} RasterPool;
+
+// NOTE: what a row of the editor frame showed when it was last drawn into the
+// screen target. content is the texture serial of the line, or a hash of the
+// text of a wrapped row
+typedef struct {
+  Line *line;
+  uint64_t content;
+  int32_t line_number;
+  int32_t row;
+  int32_t cursor_x;
+  int32_t cursor_style;
+  // NOTE: the selection covers [selection_x0, selection_x1) of the row
+  int32_t selection_x0;
+  int32_t selection_x1;
+} ScreenRow;
+
+// NOTE: rows past this are redrawn every frame
+#define SCREEN_ROWS_MAX 256
+
 enum KeyStateMachineState {
   KeyStateMachine_Repetitions,
   KeyStateMachine_Operator,
@@ -186,51 +675,479 @@ typedef struct {
   char keys[100];
   int8_t keys_size;
 
-  int16_t repetitions;
+  int32_t repetitions;
 
   char operator[2];
   int8_t operator_size;
 } KeyStateMachine;
 
+// NOTE: keeps counts like 100000000000j from overflowing
+#define KEY_MAX_REPETITIONS 1000000000
+
+#define KEY_REGISTER_COUNT 26
+#define KEY_REGISTER_MAX_SIZE Kilobytes(16)
+#define KEY_REPLAY_MAX_DEPTH 100
+
+typedef struct {
+  char *keys;
+  int32_t size;
+  int32_t max_size;
+  // NOTE: keys were dropped because the register was full
+  bool overflow;
+} KeyRegister;
+
+#define STATUS_MESSAGE_SIZE 400
+#define FILENAME_SIZE 200
+
+typedef enum {
+  ExResult_ok,
+  ExResult_error,
+  ExResult_quit,
+  // NOTE: not an editing command, left to the caller (rendering commands)
+  ExResult_unhandled,
+} ExResult;
+
+// NOTE: everything ex commands need to edit a buffer, no SDL involved so it is
+// shared by the ex frame and by batch mode
+typedef struct {
+  EditorFrame *frame;
+  MemoryArena *transient_arena;
+  char *filename;       // FILENAME_SIZE bytes
+  char *status_message; // STATUS_MESSAGE_SIZE bytes
+  bool filename_changed;
+} ExCommandContext;
+
+typedef struct {
+  MemoryArena arena;
+  MemoryArena transient_arena;
+  EditorFrame frame;
+  char filename[FILENAME_SIZE];
+  char status_message[STATUS_MESSAGE_SIZE];
+} BatchState;
+
+// NOTE: :grep walks a directory tree on the background queue, a job reads
+// one directory or searches one file. A job whose output fills up is issued
+// again from where it stopped
+#define GREP_JOB_COUNT 8
+#define GREP_JOB_OUTPUT_SIZE Kilobytes(64)
+#define GREP_PATH_SIZE 4096
+#define GREP_PATTERN_SIZE 256
+#define GREP_PREVIEW_SIZE 200
+#define GREP_ARENA_SIZE Megabytes(256)
+// NOTE: files with a NUL byte in their first GREP_BINARY_CHECK_SIZE bytes
+// are skipped
+#define GREP_BINARY_CHECK_SIZE 1024
+// NOTE: a file job looks at the generation between chunks, a search that
+// was replaced stops without reading the rest of a huge file
+#define GREP_SCAN_CHUNK_SIZE Megabytes(4)
+
+enum GrepJobState { GrepJob_free, GrepJob_queued, GrepJob_done };
+enum PathKind { PathKind_directory, PathKind_file };
+
+typedef struct GrepJob {
+  struct GrepSearch *search;
+  // NOTE: written by the worker when done, accessed with __atomic builtins
+  int32_t state;
+  int32_t generation;
+  int8_t kind;
+  // NOTE: set by the worker when the output filled up, the job goes on from
+  // resume (a telldir position or the offset of a line) when issued again
+  bool more;
+  int64_t resume;
+  int32_t resume_line;
+  // NOTE: index of the file in GrepSearch.files once it has a match
+  int32_t file;
+  int32_t output_size;
+  // NOTE: a copy, the search may be replaced while the job runs
+  char pattern[GREP_PATTERN_SIZE];
+  int32_t pattern_len;
+  char path[GREP_PATH_SIZE];
+  uint8_t output[GREP_JOB_OUTPUT_SIZE];
+} GrepJob;
+
+typedef struct {
+  char *path;
+  int8_t kind;
+} GrepPath;
+
+typedef struct {
+  int32_t file;
+  int32_t line_num;
+  int32_t column;
+  int32_t preview_len;
+  char *preview;
+} GrepMatch;
+
+// NOTE: paths and matches live in the search arena until the next search
+typedef struct GrepSearch {
+  MemoryArena arena;
+  // NOTE: bumped by every search, read by the workers with __atomic builtins
+  int32_t generation;
+  char pattern[GREP_PATTERN_SIZE];
+  int32_t pattern_len;
+  bool running;
+  // NOTE: FIFO of the paths waiting for a job, from pending_head
+  GrepPath *pending;
+  int32_t pending_head;
+  int32_t pending_count;
+  int32_t pending_size;
+  char **files;
+  int32_t file_count;
+  int32_t file_size;
+  GrepMatch *matches;
+  int32_t match_count;
+  int32_t match_size;
+  int32_t files_searched;
+  // NOTE: the search stopped before the end of the tree, the arena ran out
+  // or a snapshot was restored
+  bool incomplete;
+  // NOTE: the match :cn and :cp move from, -1 before the first jump
+  int32_t current;
+  // NOTE: the editor frame shows the list written by :copen, list_count
+  // matches are in it
+  bool list_open;
+  int32_t list_count;
+  GrepJob jobs[GREP_JOB_COUNT];
+} GrepSearch;
+
+// NOTE: the files under the working directory for :find. The tree is crawled
+// on the background queue with the grep directory reader and saved to
+// FILE_INDEX_PATH, the next crawl only reads again the directories whose
+// mtime changed
+#define FILE_INDEX_PATH "htext.files"
+#define FILE_INDEX_MAGIC 0x3130584449544800ULL // "\0HTIDX01"
+#define FILE_INDEX_ARENA_SIZE Megabytes(256)
+#define FILE_INDEX_JOB_COUNT 8
+#define FILE_INDEX_IGNORED_COUNT 8
+#define PICKER_RESULT_COUNT 10
+
+enum FileIndexJobKind {
+  FileIndexJob_directory,
+  FileIndexJob_save,
+  FileIndexJob_load
+};
+
+typedef struct {
+  uint64_t magic;
+  int32_t dir_count;
+  int32_t padding;
+} FileIndexFileHeader;
+
+typedef struct {
+  char *path;
+  struct timespec mtime;
+  // NOTE: the records of the directory reader, names without the path
+  uint8_t *entries;
+  int32_t entries_size;
+  bool read;
+} FileIndexDir;
+
+// NOTE: one crawl. dirs are in breadth first order, the crawl goes through
+// them as it finds them
+typedef struct {
+  MemoryArena arena;
+  FileIndexDir *dirs;
+  int32_t dir_count;
+  int32_t dir_size;
+  // NOTE: open addressing on the path hash, indexes of dirs, -1 when empty.
+  // Built once the crawl is done
+  int32_t *dir_table;
+  int32_t dir_table_size;
+  char **files;
+  // NOTE: a bit per character class in the path, see fuzzy_mask
+  uint64_t *masks;
+  int32_t file_count;
+  int32_t file_size;
+  bool incomplete;
+} FileList;
+
+typedef struct FileIndexJob {
+  struct FileIndex *index;
+  // NOTE: written by the worker when done, accessed with __atomic builtins
+  int32_t state;
+  int8_t kind;
+  int32_t dir;
+  // NOTE: the last crawl saw the directory with this mtime, it is only read
+  // again when the mtime changed
+  bool cached;
+  bool unchanged;
+  struct timespec mtime;
+  bool more;
+  int64_t resume;
+  int32_t output_size;
+  char path[GREP_PATH_SIZE];
+  uint8_t output[GREP_JOB_OUTPUT_SIZE];
+} FileIndexJob;
+
+typedef struct FileIndex {
+  // NOTE: lists[current] is the last complete crawl, the other one is being
+  // crawled or is the one before
+  FileList lists[2];
+  int32_t current;
+  char root[GREP_PATH_SIZE];
+  char save_path[GREP_PATH_SIZE];
+  // NOTE: files the editor writes itself, as the crawl names them. They are
+  // left out of the lists
+  char ignored[FILE_INDEX_IGNORED_COUNT][GREP_PATH_SIZE];
+  int32_t ignored_count;
+  // NOTE: the saved list is read into lists[current] by a job, the crawl
+  // starts once it is done and nothing is shown until then
+  bool loaded;
+  bool loading;
+  bool crawling;
+  int32_t crawl_next;
+  int32_t dirs_read;
+  int32_t dirs_reused;
+  FileIndexJob jobs[FILE_INDEX_JOB_COUNT];
+
+  // NOTE: the files of ranked_list that match query, narrowed down while
+  // the query only grows. survivors lives in the ranked list arena and is
+  // reused until the list grows past survivor_size
+  FileList *ranked_list;
+  int32_t ranked_file_count;
+  char query[GREP_PATTERN_SIZE];
+  int32_t query_len;
+  int32_t *survivors;
+  int32_t survivor_count;
+  int32_t survivor_size;
+  int32_t results[PICKER_RESULT_COUNT];
+  int32_t result_count;
+  int32_t selected;
+} FileIndex;
+
+// NOTE: HDR style latency histogram in milliseconds. Values under
+// LATENCY_SUB_BUCKETS get a bucket each, every power of two above that is
+// split in LATENCY_SUB_BUCKETS / 2 buckets, so a bucket is never wider than
+// 1/16th of its values
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BUCKET_BITS)
+#define LATENCY_BUCKET_COUNT                                                   \
+  (LATENCY_SUB_BUCKETS +                                                       \
+   (32 - LATENCY_SUB_BUCKET_BITS) * (LATENCY_SUB_BUCKETS / 2))
+
+typedef struct {
+  uint32_t counts[LATENCY_BUCKET_COUNT];
+  uint32_t total;
+  uint32_t max;
+} LatencyHistogram;
+
+enum LatencyKind {
+  LatencyKind_text_input,
+  LatencyKind_keydown,
+  LatencyKind_ex_command,
+  LatencyKind_count
+};
+
+// NOTE: an event handled this frame, its latency is known once the frame is
+// presented
+typedef struct {
+  int32_t kind;
+  uint32_t timestamp;
+} LatencySample;
+
+#define LATENCY_PENDING_MAX 64
+
+// NOTE: bump when something kept in a snapshot changes meaning without
+// changing its layout, snapshot_layout catches the rest
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_DEFAULT_PATH "htext.snapshot"
+
 typedef struct {
   int isInitialized;
+  uint64_t layout;
   enum AppMode mode;
 
   MemoryArena arena;
 
-  char status_message[200];
-  char filename[200];
+  char status_message[STATUS_MESSAGE_SIZE];
+
+  // NOTE: time spent in UpdateAndRender, in milliseconds
+  real32 frame_time_last;
+  real32 frame_time_max;
+  char filename[FILENAME_SIZE];
 
   EditorFrame editor_frame;
   ExFrame ex_frame;
 
   TTF_Font *font;
-  int glyph_width[ASCII_HIGH - ASCII_LOW];
+  int32_t font_size;
+  // NOTE: zoom asked for font_size_target, the screen is drawn at font_size
+  // and scaled until font_job has it ready
+  int32_t font_size_target;
+  FontJob font_job;
+  int32_t glyph_width[GLYPH_COUNT];
+  GlyphAtlas atlas;
+  // NOTE: time spent opening the font and building the atlas, in milliseconds
+  real32 font_init_time;
+  bool atlas_cached;
   int16_t font_h;
+  // NOTE: when every printable glyph has the same advance the x position of a
+  // column is column * glyph_advance, no need to look at the text
+  bool monospace;
+  int32_t glyph_advance;
+  int32_t min_glyph_width;
 
-  CachedTexture appModeTextures[AppMode_count];
+  RasterPool *raster;
+  uint32_t texture_serial;
+
+  // NOTE: the frame is composed in screen_target and only the editor rows and
+  // the modeline and ex line that changed are redrawn into it
+  SDL_Texture *screen_target;
+  int32_t screen_w;
+  int32_t screen_h;
+  ScreenRow screen_rows[SCREEN_ROWS_MAX];
+  uint64_t bottom_signature;
+  int32_t rows_redrawn;
+
+  // NOTE: render-ahead of the lines past the viewport, direction is 1 when
+  // it last moved down and -1 when it moved up
+  int32_t prefetch_viewport_start;
+  int8_t prefetch_direction;
+  int32_t prefetch_count;
 
   int32_t line_number_texture_width;
+  int32_t line_number_digits;
+  // NOTE: direct mapped by line number % LINE_NUMBER_TEXTURE_CACHE_SIZE
   SDL_Texture *line_number_texture_cache[LINE_NUMBER_TEXTURE_CACHE_SIZE];
+  int32_t line_number_texture_cache_key[LINE_NUMBER_TEXTURE_CACHE_SIZE];
 
   SDL_Texture *filename_texture;
   int32_t filename_texture_width;
 
-  SDL_Texture *ex_prefix_texture;
-  int16_t ex_prefix_texture_width;
+  // NOTE: from the SDL timestamp of an event to the present of the frame that
+  // handled it
+  LatencyHistogram latency[LatencyKind_count];
+  LatencySample latency_pending[LATENCY_PENDING_MAX];
+  int32_t latency_pending_count;
 
   KeyStateMachine normal_ksm;
+
+  // NOTE: yy, dd and p. text_register is the one picked with ", 0 is the
+  // unnamed register and 1 to 26 are "a to "z
+  TextRegisters *text_registers;
+  int8_t text_register;
+
+  GrepSearch *grep;
+
+  // NOTE: :find, the query is typed in ex_frame and the results are drawn
+  // over the last editor rows. picker_signature is what was drawn
+  FileIndex *file_index;
+  uint64_t picker_signature;
+  bool picker_shown;
+
+  // NOTE: visual modes select from the anchor to the cursor
+  int32_t visual_line_num;
+  int32_t visual_column;
+  // NOTE: block I and c, the text typed in the first line of the block is
+  // inserted in the rest of its lines at block_insert_column when insert mode
+  // ends. It was typed from block_insert_first_column, which is less when the
+  // first line is shorter than the block column
+  bool block_insert_pending;
+  int32_t block_insert_start;
+  int32_t block_insert_end;
+  int32_t block_insert_column;
+  int32_t block_insert_first_column;
+  int32_t block_insert_len;
+
+  // macros, q{reg} and @{reg}
+  KeyRegister key_registers[KEY_REGISTER_COUNT];
+  int8_t recording_register; // -1 when not recording
+  int8_t last_replayed_register;
+  SDL_Texture *recording_texture;
+  int32_t recording_texture_width;
+
+  // dot repeat, keys are captured from the first key of a command until the
+  // editor is back to normal mode
+  KeyRegister dot_pending;
+  KeyRegister dot;
+  bool change_pending;
+  bool dot_replaying;
+
+  int16_t replay_depth;
+  // NOTE: set by the key state machine, replayed once the key that requested
+  // it is fully processed
+  KeyRegister *pending_replay;
+  int32_t pending_replay_count;
 } State;
 
 typedef struct {
   State *state;
   SDL_Renderer *renderer;
   MemoryArena *transient_arena;
+  Memory *memory;
 } RendererContext;
 
 static inline void charcpy(char *dest, char *source, u_long size) {
   memcpy(dest, source, size);
 }
 
+#define HASH_SEED 0xcbf29ce484222325ULL
+
+// NOTE: FNV-1a, chained by passing the previous result as hash
+static inline uint64_t hash_bytes(uint64_t hash, void *data, size_t size) {
+  uint8_t *bytes = data;
+  for (size_t i = 0; i < size; ++i) {
+    hash ^= bytes[i];
+    hash *= 0x100000001b3ULL;
+  }
+  return hash;
+}
+
+// NOTE: a snapshot taken by a build with a different layout is ignored. The
+// sizes alone miss fields that were reordered or swapped for ones of the same
+// size, so the offsets of the fields the restored memory is reached through
+// are hashed too
+static inline uint64_t snapshot_layout(void) {
+  uint64_t layout[] = {
+      SNAPSHOT_VERSION,
+      sizeof(State),
+      sizeof(EditorFrame),
+      sizeof(Line),
+      sizeof(MemoryArena),
+      offsetof(MemoryArena, base),
+      offsetof(MemoryArena, used),
+      offsetof(MemoryArena, committed),
+      offsetof(Line, text),
+      offsetof(Line, len),
+      offsetof(Line, max_len),
+      offsetof(Line, prev),
+      offsetof(Line, next),
+      offsetof(Line, render),
+      offsetof(Line, origin),
+      offsetof(Line, text_shared),
+      offsetof(Line, inline_text),
+      offsetof(EditorFrame, line),
+      offsetof(EditorFrame, line_count),
+      offsetof(EditorFrame, index),
+      offsetof(EditorFrame, cursor),
+      offsetof(EditorFrame, arena),
+      offsetof(EditorFrame, deleted_line),
+      offsetof(EditorFrame, line_block),
+      offsetof(EditorFrame, free_render),
+      offsetof(EditorFrame, journal),
+      offsetof(EditorFrame, registers),
+      offsetof(EditorFrame, origin_offsets),
+      offsetof(EditorFrame, cold_cache),
+      offsetof(State, layout),
+      offsetof(State, mode),
+      offsetof(State, arena),
+      offsetof(State, filename),
+      offsetof(State, editor_frame),
+      offsetof(State, ex_frame),
+      offsetof(State, font_size),
+      offsetof(State, raster),
+      offsetof(State, screen_rows),
+      offsetof(State, latency),
+      offsetof(State, normal_ksm),
+      offsetof(State, text_registers),
+      offsetof(State, grep),
+      offsetof(State, file_index),
+      offsetof(State, key_registers),
+      offsetof(State, dot),
+      offsetof(State, pending_replay),
+  };
+  return hash_bytes(HASH_SEED, layout, sizeof(layout));
+}
+
 #define __H_TEXT_APP
 #endif
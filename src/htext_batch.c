@@ -0,0 +1,89 @@
+#include "htext_app.h"
+
+// NOTE: headless mode, runs an ex script over every file without SDL or TTF.
+// Empty lines and lines starting with `"` are skipped, a leading `:` is
+// optional. Returns the number of files that failed
+extern RUN_BATCH(RunBatch) {
+  assert(sizeof(BatchState) <= STORAGE_INITIAL_COMMIT_SIZE);
+  BatchState *state = (BatchState *)memory->permanent_storage;
+  initializeArena(&state->arena,
+                  memory->permanent_storage_size - sizeof(BatchState),
+                  (uint8_t *)memory->permanent_storage + sizeof(BatchState));
+  initializeArena(&state->transient_arena, memory->transient_storage_size,
+                  memory->transient_storage);
+  state->frame = editor_frame_create(&state->arena);
+
+  FILE *f = fopen(script_path, "r");
+  if (!f) {
+    fprintf(stderr, "Cannot open %s\n", script_path);
+    return file_count > 0 ? file_count : 1;
+  }
+  long script_size = -1;
+  if (fseek(f, 0, SEEK_END) == 0) {
+    script_size = ftell(f);
+  }
+  char *script = NULL;
+  if (script_size >= 0 && fseek(f, 0, SEEK_SET) == 0) {
+    script = pushSize(&state->arena, script_size + 1, DEFAULT_ALIGNMENT);
+  }
+  if (script == NULL) {
+    fprintf(stderr, "Cannot read %s\n", script_path);
+    fclose(f);
+    return file_count > 0 ? file_count : 1;
+  }
+  script_size = fread(script, 1, script_size, f);
+  script[script_size] = '\0';
+  fclose(f);
+
+  int failures = 0;
+  for (int32_t i = 0; i < file_count; ++i) {
+    ExCommandContext context = {.frame = &state->frame,
+                                .transient_arena = &state->transient_arena,
+                                .filename = state->filename,
+                                .status_message = state->status_message};
+    int32_t line_number = 0;
+    TemporaryMemory tmp_memory = beginTemporaryMemory(&state->transient_arena);
+    char *load = pushSize(&state->transient_arena, strlen(files[i]) + 6,
+                          DEFAULT_ALIGNMENT);
+    sprintf(load, "load %s", files[i]);
+    ExResult result = ex_command_execute(&context, load, strlen(load));
+    endTemporaryMemory(tmp_memory);
+
+    for (char *line = script; result == ExResult_ok && *line != '\0';) {
+      char *end = strchr(line, '\n');
+      if (end == NULL) {
+        end = line + strlen(line);
+      }
+      line_number++;
+      char *command = line;
+      int32_t size = end - line;
+      line = *end == '\0' ? end : end + 1;
+
+      if (size > 0 && command[size - 1] == '\r') {
+        size--;
+      }
+      if (size > 0 && command[0] == ':') {
+        command++;
+        size--;
+      }
+      if (size == 0 || command[0] == '"') {
+        continue;
+      }
+
+      result = ex_command_execute(&context, command, size);
+      if (result == ExResult_unhandled) {
+        sprintf(state->status_message, "Unrecognized command: %.*s",
+                size > 200 ? 200 : size, command);
+        result = ExResult_error;
+      }
+    }
+
+    if (result == ExResult_error) {
+      fprintf(stderr, "%s:%d: %s: %s\n", script_path, line_number, files[i],
+              state->status_message);
+      failures++;
+    }
+  }
+
+  return failures;
+}
@@ -1,23 +1,149 @@
 #include "htext_app.h"
+#include <errno.h>
+#include <limits.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 
 #define TEXT_LINE_ALLOCATION_SIZE 100
 
-static Line *line_create(MemoryArena *arena) {
-  Line *line = pushStruct(arena, Line, DEFAULT_ALIGNMENT);
+// NOTE: NULL when the arena has no room for another block of lines
+static Line *line_create(EditorFrame *frame) {
+  if (frame->line_block_left == 0) {
+    Line *block = pushArray(&frame->arena, LINE_BLOCK_COUNT, Line,
+                            DEFAULT_ALIGNMENT);
+    if (block == NULL) {
+      return NULL;
+    }
+    frame->line_block = block;
+    frame->line_block_left = LINE_BLOCK_COUNT;
+  }
+  Line *line = frame->line_block++;
+  frame->line_block_left--;
   line->len = 0;
-  line->text = pushSize(arena, TEXT_LINE_ALLOCATION_SIZE, DEFAULT_ALIGNMENT);
-  line->max_len = TEXT_LINE_ALLOCATION_SIZE - 1;
+  line->text = line->inline_text;
+  line->max_len = LINE_INLINE_SIZE - 1;
   line->prev = NULL;
   line->next = NULL;
-  line->texture = NULL;
+  line->render = NULL;
+  line->origin = -1;
+  line->text_shared = false;
+  return line;
+}
+
+// NOTE: a deleted line when there is one. A cold one gets its inline buffer
+// back, the text it had is gone
+static Line *line_recycle(EditorFrame *frame) {
+  Line *line = frame->deleted_line;
+  if (line == NULL) {
+    return line_create(frame);
+  }
+  frame->deleted_line = line->next;
+  if (line->text == NULL) {
+    line->text = line->inline_text;
+    line->max_len = LINE_INLINE_SIZE - 1;
+  }
   return line;
 }
 
+// NOTE: a line from line_recycle that was never linked in goes back
+static void line_unrecycle(EditorFrame *frame, Line *line) {
+  line->next = frame->deleted_line;
+  frame->deleted_line = line;
+}
+
+// NOTE: NULL when the arena has no room for another render, the line is then
+// shown without a texture or wraps
+LineRender *line_render(EditorFrame *frame, Line *line) {
+  if (line->render == NULL) {
+    LineRender *render = frame->free_render;
+    if (render != NULL) {
+      frame->free_render = render->next_free;
+    } else {
+      render = pushStruct(&frame->arena, LineRender, DEFAULT_ALIGNMENT);
+      if (render == NULL) {
+        return NULL;
+      }
+      render->advances = NULL;
+      render->advances_size = 0;
+      render->wraps = NULL;
+      render->wraps_size = 0;
+    }
+    render->texture = NULL;
+    render->texture_dirty = false;
+    render->raster_job = NULL;
+    render->advances_valid = false;
+    render->wrap_count = 0;
+    render->wrap_generation = 0;
+    render->next_free = NULL;
+    line->render = render;
+  }
+  return line->render;
+}
+
 static void line_invalidate_texture(Line *line) {
-  if (line->texture != NULL) {
-    SDL_DestroyTexture(line->texture);
-    line->texture = NULL;
+  LineRender *render = line->render;
+  if (render == NULL) {
+    return;
+  }
+  if (render->texture != NULL) {
+    SDL_DestroyTexture(render->texture);
+    render->texture = NULL;
+  }
+  if (render->raster_job != NULL) {
+    render->raster_job->line = NULL;
+    render->raster_job = NULL;
+  }
+  render->texture_dirty = false;
+  render->advances_valid = false;
+}
+
+// NOTE: the block decompressed in a cache slot, the least recently used slot
+// is reused. The slot buffers exist since editor_frame_freeze made the block
+static char *cold_block_text(EditorFrame *frame, ColdBlock *block) {
+  frame->cold_use++;
+  if (block->cache_slot < 0) {
+    int32_t slot_index = 0;
+    for (int32_t i = 1; i < COLD_CACHE_COUNT; ++i) {
+      if (frame->cold_cache[i].last_use <
+          frame->cold_cache[slot_index].last_use) {
+        slot_index = i;
+      }
+    }
+    ColdCacheSlot *slot = frame->cold_cache + slot_index;
+    if (slot->block != NULL) {
+      slot->block->cache_slot = -1;
+    }
+    assert(slot->text != NULL);
+    bool decompressed = lz_decompress((uint8_t *)(block + 1),
+                                      block->compressed_size,
+                                      (uint8_t *)slot->text, block->size);
+    assert(decompressed);
+    slot->block = block;
+    block->cache_slot = slot_index;
+  }
+  ColdCacheSlot *slot = frame->cold_cache + block->cache_slot;
+  slot->last_use = frame->cold_use;
+  return slot->text;
+}
+
+// NOTE: reading the text of a line that may be cold. Writes go through
+// line_reserve, which warms the line up for good
+static char *line_text(EditorFrame *frame, Line *line) {
+  if (line->text != NULL) {
+    return line->text;
+  }
+  ColdLine cold;
+  memcpy(&cold, line->inline_text, sizeof(cold));
+  return cold_block_text(frame, cold.block) + cold.offset;
+}
+
+// NOTE: the advances and wraps buffers go with the render to its next line
+static void line_release_render(EditorFrame *frame, Line *line) {
+  if (line->render != NULL) {
+    line_invalidate_texture(line);
+    line->render->next_free = frame->free_render;
+    frame->free_render = line->render;
+    line->render = NULL;
   }
 }
 
@@ -34,35 +160,102 @@ static void line_insert_next(Line *line, Line *next_line) {
   line->next = next_line;
 }
 
-#if 1
+// NOTE: makes room for len characters. Capacity doubles so appending to very
+// long lines is amortized, the old text is left in the arena. Every change to
+// the text of a line goes through here first, text shared with a register or
+// in a cold block is copied. False when the arena can't hold the new text or
+// len is past what an int32_t length can hold, the line is left as it was
+static bool line_try_reserve(EditorFrame *frame, Line *line, int64_t len) {
+  if (len >= INT32_MAX) {
+    return false;
+  }
+  char *source = line_text(frame, line);
+  bool shared = line->text == NULL || line->text_shared;
+  if (shared && len < LINE_INLINE_SIZE) {
+    memmove(line->inline_text, source, line->len < len ? line->len : len);
+    line->text = line->inline_text;
+    line->max_len = LINE_INLINE_SIZE - 1;
+    line->text_shared = false;
+    shared = false;
+  }
+  if (line->max_len < len || shared) {
+    int64_t new_size = ((int64_t)line->max_len + 1) * 2;
+    if (new_size < len + 1) {
+      int64_t chunks = (len + TEXT_LINE_ALLOCATION_SIZE) /
+                       TEXT_LINE_ALLOCATION_SIZE;
+      new_size = chunks * TEXT_LINE_ALLOCATION_SIZE;
+    }
+    if (new_size > INT32_MAX) {
+      new_size = INT32_MAX;
+    }
+
+    char *text = pushSize(&frame->arena, new_size, DEFAULT_ALIGNMENT);
+    if (text == NULL) {
+      return false;
+    }
+    charcpy(text, source, line->len);
+    if (line->text != line->inline_text && !shared) {
+      frame->abandoned_size += line->max_len + 1;
+    }
+    line->text = text;
+    line->max_len = new_size - 1;
+    line->text_shared = false;
+  }
+  return true;
+}
+
+static void line_reserve(EditorFrame *frame, Line *line, int32_t len) {
+  bool reserved = line_try_reserve(frame, line, len);
+  assert(reserved);
+  assert(line->max_len >= len);
+  (void)reserved;
+}
+
+#if EDITOR_FRAME_INTEGRITY
+// NOTE: inside a batch the frame is checked once by editor_frame_end_batch
 #define assert_editor_frame_integrity(editor_frame)                            \
-  _assert_editor_frame_integrity(editor_frame, __FILE__, __LINE__)
+  do {                                                                         \
+    if ((editor_frame)->batch_depth == 0) {                                    \
+      _assert_editor_frame_integrity(editor_frame, __FILE__, __LINE__);        \
+    }                                                                          \
+  } while (0)
 
 #define my_assert(cond, file, linenum)                                         \
-  if (!(cond)) {                                                               \
-    printf("%s:%d\n", file, linenum);                                          \
-    assert(cond);                                                              \
+  do {                                                                         \
+    if (!(cond)) {                                                             \
+      printf("%s:%d\n", file, linenum);                                        \
+      assert(cond);                                                            \
+    }                                                                          \
+  } while (0)
+
+static void assert_line_integrity(EditorFrame *frame, Line *line,
+                                  char *file, int32_t linenum) {
+  my_assert(line->len <= line->max_len, file, linenum);
+  my_assert(line->origin < frame->origin_count, file, linenum);
+  my_assert(line->prev != line, file, linenum);
+  my_assert(line->next != line, file, linenum);
+  my_assert(line->prev == NULL || line->prev->next == line, file, linenum);
+  my_assert(line->next == NULL || line->next->prev == line, file, linenum);
+  my_assert((line->prev == NULL) == (line == frame->line), file, linenum);
+  char *text = line_text(frame, line);
+  for (int32_t i = 0; i < line->len; ++i) {
+    my_assert(text[i] >= 32, file, linenum);
   }
+}
 
-void _assert_editor_frame_integrity(EditorFrame *frame, char *file,
-                                    int16_t linenum) {
-  my_assert(frame->cursor.line != NULL, file, linenum);
+static void assert_editor_frame_full_integrity(EditorFrame *frame,
+                                               char *file, int32_t linenum) {
   Line *prev_line = NULL;
 
-  int16_t line_num = 0;
+  int32_t line_num = 0;
   for (Line *line = frame->line; line != NULL; line = line->next) {
-    my_assert(line->len <= line->max_len, file, linenum);
-    my_assert(line->prev != line, file, linenum);
-    my_assert(line->next != line, file, linenum);
+    assert_line_integrity(frame, line, file, linenum);
     my_assert(line->prev == prev_line, file, linenum);
 
     if (line == frame->cursor.line) {
-      my_assert(line_num == frame->cursor.line_num, file, linenum)
+      my_assert(line_num == frame->cursor.line_num, file, linenum);
     }
 
-    for (int16_t i = 0; i < line->len; ++i) {
-      my_assert(line->text[i] >= 32, file, linenum);
-    }
     prev_line = line;
     line_num++;
   }
@@ -70,33 +263,340 @@ void _assert_editor_frame_integrity(EditorFrame *frame, char *file,
   assert(line_num == frame->line_count);
 
   for (Line *line = frame->deleted_line; line != NULL; line = line->next) {
-    my_assert(line->texture == NULL, file, linenum);
+    my_assert(line->render == NULL, file, linenum);
+  }
+}
+
+// NOTE: the lines of the last edit, batch_dirty_start to batch_dirty_end, and
+// one line on each side, found through the index that was just rebuilt
+static void assert_editor_frame_touched_integrity(EditorFrame *frame,
+                                                  char *file,
+                                                  int32_t linenum) {
+  my_assert(frame->index_valid_size == frame->line_count, file, linenum);
+  my_assert(frame->index[0] == frame->line, file, linenum);
+  my_assert(frame->index[frame->line_count - 1]->next == NULL, file, linenum);
+  my_assert(frame->cursor.line_num < frame->line_count, file, linenum);
+  my_assert(frame->index[frame->cursor.line_num] == frame->cursor.line, file,
+            linenum);
+
+  int32_t start = frame->batch_dirty_start - 1;
+  int32_t end = frame->batch_dirty_end + 1;
+  if (start < 0) {
+    start = 0;
+  }
+  if (end > frame->line_count) {
+    end = frame->line_count;
+  }
+  for (int32_t i = start; i < end; ++i) {
+    Line *line = frame->index[i];
+    assert_line_integrity(frame, line, file, linenum);
+    if (i + 1 < frame->line_count) {
+      my_assert(line->next == frame->index[i + 1], file, linenum);
+    }
+  }
+}
+
+void _assert_editor_frame_integrity(EditorFrame *frame, char *file,
+                                    int32_t linenum) {
+  my_assert(frame->cursor.line != NULL, file, linenum);
+  switch (frame->integrity) {
+  case Integrity_off: {
+  } break;
+  case Integrity_touched: {
+    assert_editor_frame_touched_integrity(frame, file, linenum);
+  } break;
+  case Integrity_periodic: {
+    assert_editor_frame_touched_integrity(frame, file, linenum);
+    if (frame->integrity_edits >= INTEGRITY_SWEEP_INTERVAL) {
+      frame->integrity_edits = 0;
+      assert_editor_frame_full_integrity(frame, file, linenum);
+    }
+  } break;
+  default: {
+    assert_editor_frame_full_integrity(frame, file, linenum);
+  } break;
   }
 }
 #else
 #define assert_editor_frame_integrity(editor_frame) (void)editor_frame
 #endif
 
-// TODO: reindex using the previous index
-void editor_frame_reindex(EditorFrame *frame) {
-  int16_t i = 0;
-  for (Line *line = frame->line; line != NULL; line = line->next) {
+// NOTE: room in the index for count lines, false when the arena is full
+static bool editor_frame_index_reserve(EditorFrame *frame, int32_t count) {
+  if (frame->index_size >= count) {
+    return true;
+  }
+  int32_t new_size =
+      frame->index_size > 0 ? frame->index_size * 2 : INDEX_INITIAL_SIZE;
+  while (new_size < count) {
+    new_size *= 2;
+  }
+  Line **index = pushArray(&frame->arena, new_size, Line *, DEFAULT_ALIGNMENT);
+  if (index == NULL) {
+    return false;
+  }
+  memcpy(index, frame->index, frame->index_valid_size * sizeof(Line *));
+  frame->abandoned_size += frame->index_size * sizeof(Line *);
+  frame->index = index;
+  frame->index_size = new_size;
+  return true;
+}
+
+// NOTE: lines before line_num didn't change, so the index is rebuilt from
+// there. Inside a batch this only marks the rest of the index as stale
+void editor_frame_reindex_from(EditorFrame *frame, int32_t line_num) {
+  if (line_num < frame->index_valid_size) {
+    frame->index_valid_size = line_num;
+  }
+  if (frame->batch_depth > 0) {
+    return;
+  }
+
+  bool reserved = editor_frame_index_reserve(frame, frame->line_count);
+  assert(reserved);
+  (void)reserved;
+
+  int32_t i = frame->index_valid_size;
+  Line *line = i == 0 ? frame->line : frame->index[i - 1]->next;
+  for (; line != NULL; line = line->next) {
     frame->index[i] = line;
     ++i;
-    assert(i < INDEX_SIZE);
   }
   assert(i == frame->line_count);
+  frame->index_valid_size = i;
+}
+
+void editor_frame_reindex(EditorFrame *frame) {
+  editor_frame_reindex_from(frame, 0);
+}
+
+// NOTE: the index may be stale inside a batch, in that case we walk from the
+// closest line we know the number of
+Line *editor_frame_line_at(EditorFrame *frame, int32_t line_num) {
+  assert(line_num >= 0 && line_num < frame->line_count);
+  if (line_num < frame->index_valid_size) {
+    return frame->index[line_num];
+  }
+
+  Line *line = frame->cursor.line;
+  int32_t n = frame->cursor.line_num;
+  int32_t last_indexed = frame->index_valid_size - 1;
+  if (last_indexed >= 0 && line_num - last_indexed < abs(line_num - n)) {
+    line = frame->index[last_indexed];
+    n = last_indexed;
+  }
+
+  for (; n < line_num; ++n) {
+    line = line->next;
+  }
+  for (; n > line_num; --n) {
+    line = line->prev;
+  }
+  assert(line != NULL);
+  return line;
+}
+
+static void editor_frame_reset_dirty_range(EditorFrame *frame) {
+  frame->batch_dirty_start = INT32_MAX;
+  frame->batch_dirty_end = 0;
+}
+
+static void editor_frame_mark_dirty(EditorFrame *frame, int32_t line_num) {
+  if (line_num < frame->batch_dirty_start) {
+    frame->batch_dirty_start = line_num;
+  }
+  if (line_num + 1 > frame->batch_dirty_end) {
+    frame->batch_dirty_end = line_num + 1;
+  }
+}
+
+// NOTE: the text of the line changed
+static void editor_frame_touch_line(EditorFrame *frame, Line *line,
+                                    int32_t line_num) {
+  line->origin = -1;
+  frame->modified = true;
+  if (line->render != NULL) {
+    line->render->texture_dirty = true;
+    line->render->advances_valid = false;
+    line->render->wrap_generation = 0;
+  }
+  editor_frame_mark_dirty(frame, line_num);
+}
+
+// NOTE: count lines were inserted at line_num, or removed if count is
+// negative, the lines after it were renumbered
+static void editor_frame_lines_moved(EditorFrame *frame, int32_t line_num,
+                                     int32_t count) {
+  frame->modified = true;
+  editor_frame_reindex_from(frame, line_num);
+  if (line_num < frame->batch_dirty_end) {
+    frame->batch_dirty_end += count;
+  }
+  if (line_num > 0) {
+    editor_frame_mark_dirty(frame, line_num - 1);
+  }
+  if (line_num < frame->line_count) {
+    editor_frame_mark_dirty(frame, line_num);
+  }
 }
 
 void editor_frame_cursor_reset(EditorFrame *frame) {
   frame->viewport_v.start = 0;
+  frame->viewport_row = 0;
   frame->viewport_h.start = 0;
   frame->cursor.line_num = 0;
   frame->cursor.line = frame->line;
   frame->cursor.column = 0;
 }
 
+// NOTE: wrapping needs a width, batch mode and tests have none unless they set
+// one
+static inline bool editor_frame_wrapping(EditorFrame *frame) {
+  return frame->wrap && frame->wrap_width > 0;
+}
+
+static int32_t editor_frame_char_width(EditorFrame *frame, char c) {
+  if (frame->wrap_glyph_width == NULL) {
+    return 1;
+  }
+  if (c < ASCII_LOW || c > ASCII_HIGH) {
+    c = '?';
+  }
+  return frame->wrap_glyph_width[c - ASCII_LOW];
+}
+
+// NOTE: every row holds at least one character, even when it is wider than
+// wrap_width. When the arena is full the line is left unwrapped, or the rest
+// of it stays on the last row it got
+static void line_wrap(EditorFrame *frame, Line *line) {
+  LineRender *render = line_render(frame, line);
+  if (render == NULL || render->wrap_generation == frame->wrap_generation) {
+    return;
+  }
+  render->wrap_count = 0;
+  char *text = line_text(frame, line);
+  int32_t x = 0;
+  for (int32_t i = 0; i < line->len; ++i) {
+    int32_t w = editor_frame_char_width(frame, text[i]);
+    if (x > 0 && x + w > frame->wrap_width) {
+      if (render->wrap_count == render->wraps_size) {
+        int32_t size = render->wraps_size > 0 ? render->wraps_size * 2 : 4;
+        int32_t *wraps =
+            pushArray(&frame->arena, size, int32_t, DEFAULT_ALIGNMENT);
+        if (wraps == NULL) {
+          break;
+        }
+        memcpy(wraps, render->wraps, render->wrap_count * sizeof(int32_t));
+        frame->abandoned_size += render->wraps_size * sizeof(int32_t);
+        render->wraps = wraps;
+        render->wraps_size = size;
+      }
+      render->wraps[render->wrap_count++] = i;
+      x = 0;
+    }
+    x += w;
+  }
+  render->wrap_generation = frame->wrap_generation;
+}
+
+// NOTE: a line without a render has a single row
+static int32_t line_wrap_count(Line *line) {
+  return line->render != NULL ? line->render->wrap_count : 0;
+}
+
+int32_t editor_frame_line_rows(EditorFrame *frame, Line *line) {
+  if (!editor_frame_wrapping(frame)) {
+    return 1;
+  }
+  line_wrap(frame, line);
+  return line_wrap_count(line) + 1;
+}
+
+// NOTE: row must be wrapped already
+int32_t line_row_start(Line *line, int32_t row) {
+  return row == 0 ? 0 : line->render->wraps[row - 1];
+}
+
+int32_t line_row_end(Line *line, int32_t row) {
+  return row < line_wrap_count(line) ? line->render->wraps[row] : line->len;
+}
+
+// NOTE: a column at a wrap point is shown at the start of the next row
+int32_t editor_frame_column_row(EditorFrame *frame, Line *line,
+                                int32_t column) {
+  if (!editor_frame_wrapping(frame)) {
+    return 0;
+  }
+  line_wrap(frame, line);
+  int32_t low = 0;
+  int32_t high = line_wrap_count(line);
+  while (low < high) {
+    int32_t mid = (low + high + 1) / 2;
+    if (line->render->wraps[mid - 1] <= column) {
+      low = mid;
+    } else {
+      high = mid - 1;
+    }
+  }
+  return low;
+}
+
+// NOTE: the cursor row has to be on screen. Only the rows between the cursor
+// and the top of the screen are looked at, at most viewport_v.size of them
+static void editor_frame_update_viewport_rows(EditorFrame *frame) {
+  Viewport *viewport_v = &frame->viewport_v;
+  Line *line = frame->cursor.line;
+  int32_t line_num = frame->cursor.line_num;
+  int32_t row = editor_frame_column_row(frame, line, frame->cursor.column);
+
+  bool visible = false;
+  if (line_num > viewport_v->start ||
+      (line_num == viewport_v->start && row >= frame->viewport_row)) {
+    int32_t rows_above = row;
+    while (line_num > viewport_v->start && rows_above < viewport_v->size) {
+      line = line->prev;
+      line_num--;
+      rows_above += editor_frame_line_rows(frame, line);
+    }
+    if (line_num == viewport_v->start) {
+      int32_t top_rows = editor_frame_line_rows(frame, line);
+      if (frame->viewport_row >= top_rows) {
+        frame->viewport_row = top_rows - 1;
+      }
+      visible = rows_above - frame->viewport_row < viewport_v->size;
+    }
+  }
+  if (visible) {
+    return;
+  }
+
+  line = frame->cursor.line;
+  line_num = frame->cursor.line_num;
+  for (int32_t back = viewport_v->size / 2; back > 0;) {
+    if (row > 0) {
+      int32_t step = row < back ? row : back;
+      row -= step;
+      back -= step;
+    } else if (line->prev != NULL) {
+      line = line->prev;
+      line_num--;
+      row = editor_frame_line_rows(frame, line) - 1;
+      back--;
+    } else {
+      break;
+    }
+  }
+  viewport_v->start = line_num;
+  frame->viewport_row = row;
+}
+
 void editor_frame_update_viewport(EditorFrame *frame) {
+  if (editor_frame_wrapping(frame)) {
+    editor_frame_update_viewport_rows(frame);
+    frame->viewport_h.start = 0;
+    return;
+  }
+
   if ((frame->cursor.line_num < frame->viewport_v.start) ||
       (frame->cursor.line_num >=
        (frame->viewport_v.start + frame->viewport_v.size))) {
@@ -121,12 +621,194 @@ void editor_frame_update_viewport(EditorFrame *frame) {
   }
 }
 
+// NOTE: only records the new width, lines are rewrapped when they are shown
+// or by editor_frame_wrap_step, so a resize costs the same on any buffer
+void editor_frame_set_wrap_width(EditorFrame *frame, int32_t width,
+                                 int32_t *glyph_width) {
+  if (width == frame->wrap_width && glyph_width == frame->wrap_glyph_width) {
+    return;
+  }
+  frame->wrap_width = width;
+  frame->wrap_glyph_width = glyph_width;
+  frame->wrap_generation++;
+  frame->wrap_next = 0;
+  if (editor_frame_wrapping(frame)) {
+    editor_frame_update_viewport(frame);
+  }
+}
+
+void editor_frame_set_wrap(EditorFrame *frame, bool wrap) {
+  frame->wrap = wrap;
+  frame->viewport_row = 0;
+  frame->wrap_next = 0;
+  editor_frame_update_viewport(frame);
+}
+
+// NOTE: wraps up to count lines ahead of time, the lines on screen are
+// wrapped as they are rendered
+void editor_frame_wrap_step(EditorFrame *frame, int32_t count) {
+  if (!editor_frame_wrapping(frame) ||
+      frame->wrap_next >= frame->line_count) {
+    return;
+  }
+  int32_t end = frame->wrap_next + count;
+  if (end > frame->line_count) {
+    end = frame->line_count;
+  }
+  Line *line = editor_frame_line_at(frame, frame->wrap_next);
+  for (int32_t i = frame->wrap_next; i < end; ++i) {
+    line_wrap(frame, line);
+    line = line->next;
+  }
+  frame->wrap_next = end;
+}
+
+// NOTE: a line can go cold when its text is in the arena for it alone and no
+// texture is kept for it
+static bool line_can_freeze(Line *line) {
+  return line->text != NULL && line->text != line->inline_text &&
+         !line->text_shared && line->render == NULL &&
+         line->len < COLD_BLOCK_SIZE;
+}
+
+static bool editor_frame_line_hot(EditorFrame *frame, int32_t line_num) {
+  int32_t cursor = frame->cursor.line_num;
+  int32_t viewport_end = frame->viewport_v.start + frame->viewport_v.size;
+  return (line_num >= cursor - COLD_HOT_LINES &&
+          line_num < cursor + COLD_HOT_LINES) ||
+         (line_num >= frame->viewport_v.start - COLD_HOT_LINES &&
+          line_num < viewport_end + COLD_HOT_LINES);
+}
+
+// NOTE: compresses the count lines from first, whose texts lie one after
+// the other in the arena, into a block. The pages under their old texts are
+// given back to the system. Texts that don't shrink by an eighth are left,
+// and so is everything when either arena is full. The cache slots are made
+// with the first block so reading a cold line never needs the arena
+static void editor_frame_freeze(MemoryArena *transient_arena,
+                                EditorFrame *frame, Line *first,
+                                int32_t count, int32_t size) {
+  for (int32_t i = 0; i < COLD_CACHE_COUNT; ++i) {
+    ColdCacheSlot *slot = frame->cold_cache + i;
+    if (slot->text == NULL) {
+      slot->text = pushSize(&frame->arena, COLD_BLOCK_SIZE, DEFAULT_ALIGNMENT);
+      if (slot->text == NULL) {
+        return;
+      }
+    }
+  }
+
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  char *text = pushSize(transient_arena, size, DEFAULT_ALIGNMENT);
+  int32_t capacity = size - size / 8;
+  uint8_t *compressed = pushSize(transient_arena, capacity, DEFAULT_ALIGNMENT);
+  if (text == NULL || compressed == NULL) {
+    endTemporaryMemory(tmp_memory);
+    return;
+  }
+  Line *line = first;
+  Line *last = first;
+  int32_t offset = 0;
+  for (int32_t i = 0; i < count; ++i, last = line, line = line->next) {
+    charcpy(text + offset, line->text, line->len);
+    text[offset + line->len] = '\n';
+    offset += line->len + 1;
+  }
+  int32_t compressed_size =
+      lz_compress((uint8_t *)text, size, compressed, capacity);
+  if (compressed_size < 0) {
+    endTemporaryMemory(tmp_memory);
+    return;
+  }
+
+  ColdBlock *block =
+      pushSize(&frame->arena, sizeof(ColdBlock) + compressed_size,
+               ARENA_DEFAULT_ALIGNMENT);
+  if (block == NULL) {
+    endTemporaryMemory(tmp_memory);
+    return;
+  }
+  block->size = size;
+  block->compressed_size = compressed_size;
+  block->cache_slot = -1;
+  charcpy((char *)(block + 1), (char *)compressed, compressed_size);
+  endTemporaryMemory(tmp_memory);
+
+  uintptr_t region_start = (uintptr_t)first->text;
+  uintptr_t region_end = (uintptr_t)last->text + last->max_len + 1;
+  offset = 0;
+  line = first;
+  for (int32_t i = 0; i < count; ++i, line = line->next) {
+    ColdLine cold = {.block = block, .offset = offset};
+    offset += line->len + 1;
+    frame->abandoned_size += line->max_len + 1;
+    line->text = NULL;
+    line->max_len = line->len;
+    memcpy(line->inline_text, &cold, sizeof(cold));
+  }
+  frame->cold_size += size;
+  frame->cold_compressed_size += compressed_size;
+
+  uintptr_t page_size = sysconf(_SC_PAGESIZE);
+  uintptr_t page_start = (region_start + page_size - 1) & ~(page_size - 1);
+  uintptr_t page_end = region_end & ~(page_size - 1);
+  if (page_end > page_start) {
+    madvise((void *)page_start, page_end - page_start, MADV_DONTNEED);
+  }
+}
+
+// NOTE: looks at up to count lines from cold_next for runs of lines away from
+// the viewport and the cursor to compress. The texts of a run must follow
+// each other in the arena, as they do after a load, so nothing else lives in
+// the pages given back
+void editor_frame_cold_step(MemoryArena *transient_arena, EditorFrame *frame,
+                            int32_t count) {
+  if (frame->cold_next >= frame->line_count) {
+    frame->cold_next = 0;
+  }
+  int32_t line_num = frame->cold_next;
+  int32_t end = line_num + count < frame->line_count ? line_num + count
+                                                     : frame->line_count;
+  Line *line = editor_frame_line_at(frame, line_num);
+  while (line_num < end) {
+    if (!line_can_freeze(line) || editor_frame_line_hot(frame, line_num)) {
+      line = line->next;
+      line_num++;
+      continue;
+    }
+    Line *first = line;
+    Line *last = line;
+    int32_t run_count = 0;
+    int32_t size = 0;
+    while (line_num < end && line_can_freeze(line) &&
+           !editor_frame_line_hot(frame, line_num) &&
+           size + line->len + 1 <= COLD_BLOCK_SIZE) {
+      uintptr_t last_end = (uintptr_t)last->text + last->max_len + 1;
+      uintptr_t aligned_end = (last_end + DEFAULT_ALIGNMENT - 1) &
+                              ~(uintptr_t)(DEFAULT_ALIGNMENT - 1);
+      if (line != first && (uintptr_t)line->text != last_end &&
+          (uintptr_t)line->text != aligned_end) {
+        break;
+      }
+      size += line->len + 1;
+      run_count++;
+      last = line;
+      line = line->next;
+      line_num++;
+    }
+    if (size >= COLD_BLOCK_MIN_SIZE) {
+      editor_frame_freeze(transient_arena, frame, first, run_count, size);
+    }
+  }
+  frame->cold_next = line_num;
+}
+
 // NOTE: moves cursor vertically,
 // if a column is specified it will be used as cursor.column
-void editor_frame_move_cursor_v(EditorFrame *frame, int16_t d,
-                                int16_t *column) {
+void editor_frame_move_cursor_v(EditorFrame *frame, int32_t d,
+                                int32_t *column) {
   assert(frame->cursor.line != NULL);
-  int16_t cursor_line_num = frame->cursor.line_num + d;
+  int64_t cursor_line_num = (int64_t)frame->cursor.line_num + d;
   if (cursor_line_num >= frame->line_count) {
     cursor_line_num = frame->line_count - 1;
   }
@@ -134,8 +816,8 @@ void editor_frame_move_cursor_v(EditorFrame *frame, int16_t d,
     cursor_line_num = 0;
   }
 
+  frame->cursor.line = editor_frame_line_at(frame, cursor_line_num);
   frame->cursor.line_num = cursor_line_num;
-  frame->cursor.line = frame->index[frame->cursor.line_num];
   assert(frame->cursor.line != NULL);
 
   editor_frame_update_viewport(frame);
@@ -149,8 +831,64 @@ void editor_frame_move_cursor_v(EditorFrame *frame, int16_t d,
   }
 }
 
+// NOTE: j and k, with soft wrapping they move by rows and keep the offset of
+// the cursor into the row
+void editor_frame_move_cursor_rows(EditorFrame *frame, int32_t d) {
+  if (!editor_frame_wrapping(frame)) {
+    editor_frame_move_cursor_v(frame, d, NULL);
+    return;
+  }
+
+  Line *line = frame->cursor.line;
+  int32_t line_num = frame->cursor.line_num;
+  int32_t row = editor_frame_column_row(frame, line, frame->cursor.column);
+  int32_t offset = frame->cursor.column - line_row_start(line, row);
+  for (; d > 0; --d) {
+    if (row < line_wrap_count(line)) {
+      row++;
+    } else if (line->next != NULL) {
+      line = line->next;
+      line_num++;
+      line_wrap(frame, line);
+      row = 0;
+    } else {
+      break;
+    }
+  }
+  for (; d < 0; ++d) {
+    if (row > 0) {
+      row--;
+    } else if (line->prev != NULL) {
+      line = line->prev;
+      line_num--;
+      line_wrap(frame, line);
+      row = line_wrap_count(line);
+    } else {
+      break;
+    }
+  }
+
+  int32_t column = line_row_start(line, row) + offset;
+  int32_t row_end = line_row_end(line, row);
+  if (row < line_wrap_count(line)) {
+    // NOTE: the wrap point itself belongs to the next row
+    row_end--;
+  }
+  if (column > row_end) {
+    column = row_end;
+  }
+  editor_frame_move_cursor_v(frame, line_num - frame->cursor.line_num,
+                             &column);
+}
+
 void editor_frame_invalidate_viewport_textures(EditorFrame *frame) {
-  for (int16_t i = frame->viewport_v.start; i < frame->viewport_v.size; ++i) {
+  if (frame->batch_depth > 0) {
+    frame->batch_viewport_invalidated = true;
+    return;
+  }
+
+  int32_t end = frame->viewport_v.start + frame->viewport_v.size;
+  for (int32_t i = frame->viewport_v.start; i < end; ++i) {
     if (i == frame->line_count) {
       break;
     }
@@ -158,10 +896,54 @@ void editor_frame_invalidate_viewport_textures(EditorFrame *frame) {
   }
 }
 
-void editor_frame_move_cursor_h(EditorFrame *frame, int16_t d) {
+// NOTE: batches can be nested, the deferred work is done when the outermost
+// one ends
+void editor_frame_begin_batch(EditorFrame *frame) {
+  assert_editor_frame_integrity(frame);
+  frame->batch_depth++;
+}
+
+void editor_frame_end_batch(EditorFrame *frame) {
+  assert(frame->batch_depth > 0);
+  frame->batch_depth--;
+  if (frame->batch_depth > 0) {
+    return;
+  }
+
+  editor_frame_reindex_from(frame, frame->index_valid_size);
+  if (frame->batch_viewport_invalidated) {
+    frame->batch_viewport_invalidated = false;
+    editor_frame_invalidate_viewport_textures(frame);
+  } else {
+    // NOTE: only touched lines that are visible, the rest are invalidated
+    // when they are rendered
+    int32_t start = frame->viewport_v.start;
+    if (frame->batch_dirty_start > start) {
+      start = frame->batch_dirty_start;
+    }
+    int32_t end = frame->viewport_v.start + frame->viewport_v.size;
+    if (frame->batch_dirty_end < end) {
+      end = frame->batch_dirty_end;
+    }
+    if (frame->line_count < end) {
+      end = frame->line_count;
+    }
+    for (int32_t i = start; i < end; ++i) {
+      LineRender *render = frame->index[i]->render;
+      if (render != NULL && render->texture_dirty) {
+        line_invalidate_texture(frame->index[i]);
+      }
+    }
+  }
+  frame->integrity_edits++;
+  assert_editor_frame_integrity(frame);
+  editor_frame_reset_dirty_range(frame);
+}
+
+void editor_frame_move_cursor_h(EditorFrame *frame, int32_t d) {
   assert(frame->cursor.line != NULL);
 
-  int16_t column = frame->cursor.column + d;
+  int64_t column = (int64_t)frame->cursor.column + d;
   if (column < 0) {
     column = 0;
   }
@@ -182,7 +964,8 @@ void editor_frame_delete_line(EditorFrame *frame, Line *line) {
   Line *prev_line = line->prev;
   Line *next_line = line->next;
 
-  line_invalidate_texture(line);
+  line_release_render(frame, line);
+  line->origin = -1;
 
   if (frame->line == line) {
     assert(next_line != NULL);
@@ -208,43 +991,82 @@ void editor_frame_delete_line(EditorFrame *frame, Line *line) {
 
 void editor_frame_close(EditorFrame *frame) {
   assert_editor_frame_integrity(frame);
-
-  frame->arena.used = 0;
+  if (frame->registers != NULL) {
+    text_registers_detach(frame->registers, frame->arena.base,
+                          frame->arena.size);
+  }
+  if (frame->journal != NULL && frame->journal->suspended == 0) {
+    journal_reset(frame->journal);
+  }
+  journal_record(frame, JournalOp_close, 0, 0, 0, 0, NULL, 0);
 
   Line *line = frame->line;
   while (line != NULL) {
     line_invalidate_texture(line);
     line = line->next;
   }
+
+  frame->arena.used = 0;
+  releaseArena(&frame->arena);
+  frame->index = NULL;
+  frame->index_size = 0;
+  frame->index_valid_size = 0;
+  frame->abandoned_size = 0;
   editor_frame_cursor_reset(frame);
+  frame->line_block = NULL;
+  frame->line_block_left = 0;
+  frame->free_render = NULL;
+  frame->origin_offsets = NULL;
+  frame->origin_count = 0;
+  frame->origin_size = 0;
+  frame->modified = false;
+  frame->cold_next = 0;
+  memset(frame->cold_cache, 0, sizeof(frame->cold_cache));
+  frame->cold_size = 0;
+  frame->cold_compressed_size = 0;
   frame->line_count = 1;
-  frame->line = line_create(&frame->arena);
+  frame->line = line_create(frame);
+  frame->deleted_line = NULL;
   frame->cursor.line = frame->line;
+  editor_frame_reindex(frame);
+  editor_frame_reset_dirty_range(frame);
 
   assert_editor_frame_integrity(frame);
 }
 
 void editor_frame_remove_char(EditorFrame *frame) {
-  assert_editor_frame_integrity(frame);
+  // NOTE: a join that can't fit leaves both lines alone
+  Line *cursor_line = frame->cursor.line;
+  if (frame->cursor.column == 0 && cursor_line->prev != NULL &&
+      cursor_line->len > 0 &&
+      !line_try_reserve(frame, cursor_line->prev,
+                        (int64_t)cursor_line->prev->len + cursor_line->len)) {
+    return;
+  }
+  journal_record(frame, JournalOp_remove_char, 0, 0, 0, 0, NULL, 0);
+  editor_frame_begin_batch(frame);
   if (frame->cursor.column == 0) {
     if (frame->cursor.line->prev != NULL) {
       Line *line_to_remove = frame->cursor.line;
 
-      int16_t column = frame->cursor.line->prev->len;
+      int32_t column = frame->cursor.line->prev->len;
       editor_frame_move_cursor_v(frame, -1, &column);
       editor_frame_delete_line(frame, line_to_remove);
 
       if (line_to_remove->len > 0) {
         // we need to join line_to_remove with prev cursor line
+        line_reserve(frame, frame->cursor.line,
+                     frame->cursor.line->len + line_to_remove->len);
         charcpy(frame->cursor.line->text + frame->cursor.line->len,
-                line_to_remove->text, line_to_remove->len);
+                line_text(frame, line_to_remove), line_to_remove->len);
         frame->cursor.line->len += line_to_remove->len;
       }
 
-      editor_frame_reindex(frame);
+      editor_frame_lines_moved(frame, frame->cursor.line_num + 1, -1);
     }
   } else {
     assert(frame->cursor.column <= frame->cursor.line->len);
+    line_reserve(frame, frame->cursor.line, frame->cursor.line->len);
     charcpy(frame->cursor.line->text + frame->cursor.column - 1,
             frame->cursor.line->text + frame->cursor.column,
             frame->cursor.line->len - frame->cursor.column);
@@ -252,45 +1074,55 @@ void editor_frame_remove_char(EditorFrame *frame) {
     editor_frame_move_cursor_h(frame, -1);
   }
 
-  line_invalidate_texture(frame->cursor.line);
-  assert_editor_frame_integrity(frame);
+  editor_frame_touch_line(frame, frame->cursor.line, frame->cursor.line_num);
+  editor_frame_end_batch(frame);
 }
 
-void editor_frame_insert_new_line(EditorFrame *frame) {
-  assert_editor_frame_integrity(frame);
-  Line *new_line;
-  if (frame->deleted_line != NULL) {
-    new_line = frame->deleted_line;
-    frame->deleted_line = frame->deleted_line->next;
-  } else {
-    new_line = line_create(&frame->arena);
+// NOTE: false when the arena has no room for the new line, the frame is left
+// as it was
+bool editor_frame_insert_new_line(EditorFrame *frame) {
+  int32_t tail_len = frame->cursor.line->len - frame->cursor.column;
+  Line *new_line = line_recycle(frame);
+  if (new_line == NULL) {
+    return false;
   }
+  new_line->len = 0;
+  if (!line_try_reserve(frame, new_line, tail_len > 0 ? tail_len : 0) ||
+      !editor_frame_index_reserve(frame, frame->line_count + 1)) {
+    line_unrecycle(frame, new_line);
+    return false;
+  }
+  journal_record(frame, JournalOp_insert_new_line, 0, 0, 0, 0, NULL, 0);
+  editor_frame_begin_batch(frame);
 
   if (frame->cursor.column < frame->cursor.line->len) {
     new_line->len = frame->cursor.line->len - frame->cursor.column;
-    charcpy(new_line->text, frame->cursor.line->text + frame->cursor.column,
+    charcpy(new_line->text,
+            line_text(frame, frame->cursor.line) + frame->cursor.column,
             new_line->len);
-    line_invalidate_texture(frame->cursor.line);
+    editor_frame_touch_line(frame, frame->cursor.line, frame->cursor.line_num);
     frame->cursor.line->len = frame->cursor.column;
-  } else {
-    new_line->len = 0;
   }
 
   line_insert_next(frame->cursor.line, new_line);
   frame->line_count++;
-  editor_frame_reindex(frame);
-  static int16_t new_column = 0;
+  editor_frame_lines_moved(frame, frame->cursor.line_num + 1, 1);
+  static int32_t new_column = 0;
   editor_frame_move_cursor_v(frame, 1, &new_column);
-  assert_editor_frame_integrity(frame);
+  editor_frame_end_batch(frame);
+  return true;
 }
 
-void editor_frame_remove_lines(EditorFrame *frame, int16_t n) {
-  assert_editor_frame_integrity(frame);
-  for (int16_t i = 0; i < n; ++i) {
+void editor_frame_remove_lines(EditorFrame *frame, int32_t n) {
+  journal_record(frame, JournalOp_remove_lines, n, 0, 0, 0, NULL, 0);
+  editor_frame_begin_batch(frame);
+  int32_t removed = 0;
+  for (int32_t i = 0; i < n; ++i) {
     Line *line_to_remove = frame->cursor.line;
     if (frame->line_count == 1) {
       frame->line->len = 0;
       frame->cursor.column = 0;
+      editor_frame_touch_line(frame, frame->line, 0);
       break;
     } else if (line_to_remove->next) {
       frame->cursor.line = line_to_remove->next;
@@ -300,84 +1132,996 @@ void editor_frame_remove_lines(EditorFrame *frame, int16_t n) {
       editor_frame_update_viewport(frame);
     }
     editor_frame_delete_line(frame, line_to_remove);
+    removed++;
   }
-  editor_frame_reindex(frame);
-  assert_editor_frame_integrity(frame);
+  editor_frame_lines_moved(frame, frame->cursor.line_num, -removed);
+  editor_frame_end_batch(frame);
 }
 
-void editor_frame_insert_text(MemoryArena *transient_arena, EditorFrame *frame,
-                              char *text, int16_t text_size) {
+void editor_frame_insert_text(EditorFrame *frame, char *text,
+                              int32_t text_size) {
   assert(text_size > 0);
-  assert_editor_frame_integrity(frame);
-
   Line *line = frame->cursor.line;
-  if (line->max_len < (line->len + text_size)) {
-    line->text[line->len] = 0;
-    char *s = push_string(transient_arena, line->text);
-
-    double chunks = ((double)(line->len + text_size + 1)) /
-                    (double)TEXT_LINE_ALLOCATION_SIZE;
-    int16_t new_size = ceil(chunks) * TEXT_LINE_ALLOCATION_SIZE;
-
-    line->max_len = new_size - 1;
-    line->text = pushSize(&frame->arena, new_size, DEFAULT_ALIGNMENT);
-    strcpy(line->text, s);
+  if (!line_try_reserve(frame, line, (int64_t)line->len + text_size)) {
+    return;
   }
+  journal_record(frame, JournalOp_insert_text, 0, 0, 0, 0, text, text_size);
+  editor_frame_begin_batch(frame);
 
-  assert(line->max_len >= (line->len + text_size));
-
-  int16_t column = frame->cursor.column;
+  int32_t column = frame->cursor.column;
   charcpy(line->text + column + text_size, line->text + column,
           line->len - column);
   charcpy(line->text + column, text, text_size);
-  line_invalidate_texture(line);
+  editor_frame_touch_line(frame, line, frame->cursor.line_num);
   line->len += text_size;
-  frame->line->text[frame->line->len] = 0;
+  line->text[line->len] = 0;
   editor_frame_move_cursor_h(frame, text_size);
 
-  assert_editor_frame_integrity(frame);
+  editor_frame_end_batch(frame);
+}
+
+// NOTE: filename now holds the buffer as it is, the journal starts over from
+// it
+void editor_frame_journal_rebase(EditorFrame *frame, char *filename) {
+  if (frame->journal == NULL || frame->journal->suspended > 0) {
+    return;
+  }
+  char path[PATH_MAX];
+  if (realpath(filename, path) == NULL) {
+    strncpy(path, filename, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+  }
+  journal_reset(frame->journal);
+  journal_record(frame, JournalOp_load, 0, 0, 0, 0, path, strlen(path));
+}
+
+// NOTE: the journal starts over from the buffer as it is. A buffer that
+// matches its file starts from loading it, any other one from an empty
+// buffer and its lines written out again, so a scratch buffer or one
+// restored with unsaved changes can be recovered too
+void editor_frame_journal_restart(EditorFrame *frame, char *filename) {
+  Journal *journal = frame->journal;
+  if (journal == NULL || journal->suspended > 0) {
+    return;
+  }
+  if (filename[0] != '\0' && !frame->modified) {
+    editor_frame_journal_rebase(frame, filename);
+    return;
+  }
+  journal_reset(journal);
+  journal_record_at(journal, JournalOp_close, 0, 0, NULL, 0);
+  int32_t line_num = 0;
+  for (Line *line = frame->line; line != NULL; line = line->next) {
+    if (line_num > 0) {
+      journal_record_at(journal, JournalOp_insert_new_line, line_num - 1,
+                        line->prev->len, NULL, 0);
+    }
+    if (line->len > 0) {
+      journal_record_at(journal, JournalOp_insert_text, line_num, 0,
+                        line_text(frame, line), line->len);
+    }
+    line_num++;
+  }
 }
 
-// TODO rewrite to avoid moving the cursor and such
+#define LOAD_FILE_READ_SIZE Kilobytes(64)
+
+static bool file_identity_equal(FileIdentity *identity, struct stat *st) {
+  return identity->dev == st->st_dev && identity->ino == st->st_ino &&
+         identity->size == st->st_size &&
+         identity->mtime.tv_sec == st->st_mtim.tv_sec &&
+         identity->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+// NOTE: the file described by st holds the lines joined by new lines, line n
+// becomes its line n. When the sizes don't add up nothing is reused from it
+static void editor_frame_set_origin(EditorFrame *frame, struct stat *st) {
+  if (frame->origin_size < frame->line_count) {
+    int64_t *offsets = pushArray(&frame->arena, frame->line_count, int64_t,
+                                 DEFAULT_ALIGNMENT);
+    if (offsets == NULL) {
+      frame->origin_count = 0;
+      frame->modified = false;
+      return;
+    }
+    frame->abandoned_size += frame->origin_size * sizeof(int64_t);
+    frame->origin_offsets = offsets;
+    frame->origin_size = frame->line_count;
+  }
+  int64_t offset = 0;
+  int32_t line_num = 0;
+  for (Line *line = frame->line; line != NULL; line = line->next) {
+    frame->origin_offsets[line_num] = offset;
+    line->origin = line_num++;
+    offset += line->len + 1;
+  }
+  frame->origin_count = frame->line_count;
+  frame->origin_file = (FileIdentity){.dev = st->st_dev,
+                                      .ino = st->st_ino,
+                                      .size = st->st_size,
+                                      .mtime = st->st_mtim};
+  frame->modified = false;
+
+  if (offset - 1 != st->st_size) {
+    for (Line *line = frame->line; line != NULL; line = line->next) {
+      line->origin = -1;
+    }
+    frame->origin_count = 0;
+  }
+}
+
+static bool text_printable(char *text, int32_t size) {
+  for (int32_t i = 0; i < size; ++i) {
+    if (text[i] < ASCII_LOW || text[i] > ASCII_HIGH) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// NOTE: lines are appended directly to the list, the whole load is a single
+// batch so the frame is reindexed and checked once. Returns -1 when the file
+// can't be read or doesn't fit and LOAD_FILE_UNPRINTABLE when it has bytes a
+// line can't hold, the buffer is left empty in both cases
 int editor_frame_load_file(MemoryArena *transient_arena, EditorFrame *frame,
                            char *filename) {
-  assert_editor_frame_integrity(frame);
   FILE *f = fopen(filename, "r");
   if (!f) {
     return -1;
   }
 
+  editor_frame_begin_batch(frame);
+  journal_suspend(frame);
   editor_frame_close(frame);
-  assert_editor_frame_integrity(frame);
+  journal_resume(frame);
   assert(frame->line_count == 1);
 
-  char c;
-  int16_t read_size = fread(&c, sizeof(char), 1, f);
-  while (read_size > 0) {
-    if (c == '\n') {
-      editor_frame_insert_new_line(frame);
-    } else {
-      assert(c >= 32);
-      editor_frame_insert_text(transient_arena, frame, &c, 1);
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  char *buffer =
+      pushSize(transient_arena, LOAD_FILE_READ_SIZE, DEFAULT_ALIGNMENT);
+
+  int result = buffer != NULL ? 0 : -1;
+  Line *line = frame->line;
+  size_t read_size =
+      buffer != NULL ? fread(buffer, sizeof(char), LOAD_FILE_READ_SIZE, f) : 0;
+  while (result == 0 && read_size > 0) {
+    char *start = buffer;
+    char *end = buffer + read_size;
+    while (start < end) {
+      char *new_line = memchr(start, '\n', end - start);
+      char *text_end = new_line != NULL ? new_line : end;
+      int32_t text_size = text_end - start;
+      if (!text_printable(start, text_size)) {
+        result = LOAD_FILE_UNPRINTABLE;
+        break;
+      }
+      if (text_size > 0) {
+        if (!line_try_reserve(frame, line, line->len + text_size)) {
+          result = -1;
+          break;
+        }
+        charcpy(line->text + line->len, start, text_size);
+        line->len += text_size;
+      }
+
+      if (new_line != NULL) {
+        Line *next_line = line_create(frame);
+        if (next_line == NULL) {
+          result = -1;
+          break;
+        }
+        line_insert_next(line, next_line);
+        frame->line_count++;
+        line = next_line;
+      }
+      start = text_end + 1;
     }
-    read_size = fread(&c, sizeof(char), 1, f);
+    read_size = fread(buffer, sizeof(char), LOAD_FILE_READ_SIZE, f);
   }
+  struct stat st;
+  bool known = fstat(fileno(f), &st) == 0;
   fclose(f);
+  endTemporaryMemory(tmp_memory);
+
+  if (result == 0 && !editor_frame_index_reserve(frame, frame->line_count)) {
+    result = -1;
+  }
+  if (result != 0) {
+    editor_frame_close(frame);
+    editor_frame_end_batch(frame);
+    return result;
+  }
 
   editor_frame_cursor_reset(frame);
   editor_frame_reindex(frame);
-  assert_editor_frame_integrity(frame);
+  editor_frame_end_batch(frame);
+  if (known) {
+    editor_frame_set_origin(frame, &st);
+  }
 
+  editor_frame_journal_rebase(frame, filename);
   return 0;
 }
 
+// NOTE: runs of unchanged lines shorter than this are written from memory,
+// a copy costs a syscall
+#define SAVE_COPY_MIN_SIZE Kilobytes(64)
+
+typedef struct {
+  int fd;
+  off_t offset;
+  char *buffer;
+  int32_t size;
+} SaveWriter;
+
+static int save_flush(SaveWriter *writer) {
+  char *bytes = writer->buffer;
+  while (writer->size > 0) {
+    ssize_t written = pwrite(writer->fd, bytes, writer->size, writer->offset);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return -1;
+    }
+    bytes += written;
+    writer->size -= written;
+    writer->offset += written;
+  }
+  return 0;
+}
+
+static int save_append(SaveWriter *writer, char *data, int32_t size) {
+  while (size > 0) {
+    if (writer->size == LOAD_FILE_READ_SIZE && save_flush(writer) != 0) {
+      return -1;
+    }
+    int32_t chunk = LOAD_FILE_READ_SIZE - writer->size;
+    chunk = chunk < size ? chunk : size;
+    charcpy(writer->buffer + writer->size, data, chunk);
+    writer->size += chunk;
+    data += chunk;
+    size -= chunk;
+  }
+  return 0;
+}
+
+// NOTE: copy_file_range lets the file system share the blocks or copy them
+// in the kernel. Where it isn't supported the rest goes through the buffer
+static int save_copy(SaveWriter *writer, int fd, off_t offset, off_t size) {
+  if (save_flush(writer) != 0) {
+    return -1;
+  }
+#ifdef SYS_copy_file_range
+  while (size > 0) {
+    int64_t in_offset = offset;
+    int64_t out_offset = writer->offset;
+    ssize_t copied = syscall(SYS_copy_file_range, fd, &in_offset, writer->fd,
+                             &out_offset, (size_t)size, 0);
+    if (copied < 0 && errno == EINTR) {
+      continue;
+    }
+    if (copied <= 0) {
+      break;
+    }
+    offset += copied;
+    size -= copied;
+    writer->offset += copied;
+  }
+#endif
+  while (size > 0) {
+    ssize_t n = pread(fd, writer->buffer,
+                      size < LOAD_FILE_READ_SIZE ? size : LOAD_FILE_READ_SIZE,
+                      offset);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return -1;
+    }
+    writer->size = n;
+    if (save_flush(writer) != 0) {
+      return -1;
+    }
+    offset += n;
+    size -= n;
+  }
+  return 0;
+}
+
+// NOTE: writes the lines next to the origin file and renames them over it.
+// Runs of lines still at consecutive origins are one range of it, long ones
+// are copied from it instead of written. Returns 2 when there is no room for
+// a file next to it, the caller writes over the origin in place then
+static int editor_frame_save_over(MemoryArena *transient_arena,
+                                  EditorFrame *frame, char *filename,
+                                  int origin_fd, struct stat *origin_stat) {
+  char path[PATH_MAX];
+  char tmp_path[PATH_MAX + 8];
+  if (realpath(filename, path) == NULL ||
+      snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path) >=
+          (int)sizeof(tmp_path)) {
+    return 2;
+  }
+  int fd = mkstemp(tmp_path);
+  if (fd < 0) {
+    return 2;
+  }
+
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  SaveWriter writer = {
+      .fd = fd,
+      .buffer = pushSize(transient_arena, LOAD_FILE_READ_SIZE, 1)};
+  int r = writer.buffer != NULL ? fchmod(fd, origin_stat->st_mode & 07777)
+                                : -1;
+  Line *line = frame->line;
+  while (line != NULL && r == 0) {
+    Line *last = line;
+    while (line->origin >= 0 && last->next != NULL &&
+           last->next->origin == last->origin + 1) {
+      last = last->next;
+    }
+    bool new_line = last->next != NULL;
+    off_t start = 0;
+    off_t end = 0;
+    if (line->origin >= 0) {
+      start = frame->origin_offsets[line->origin];
+      end = frame->origin_offsets[last->origin] + last->len;
+      if (new_line && last->origin + 1 < frame->origin_count) {
+        end++;
+        new_line = false;
+      }
+    }
+
+    if (end - start >= SAVE_COPY_MIN_SIZE) {
+      r = save_copy(&writer, origin_fd, start, end - start);
+      if (r == 0 && new_line) {
+        r = save_append(&writer, "\n", 1);
+      }
+    } else {
+      for (Line *l = line; r == 0; l = l->next) {
+        r = save_append(&writer, line_text(frame, l), l->len);
+        if (r == 0 && l->next != NULL) {
+          r = save_append(&writer, "\n", 1);
+        }
+        if (l == last) {
+          break;
+        }
+      }
+    }
+    line = last->next;
+  }
+  if (r == 0) {
+    r = save_flush(&writer);
+  }
+  endTemporaryMemory(tmp_memory);
+
+  struct stat st;
+  if (r == 0 && (fdatasync(fd) != 0 || fstat(fd, &st) != 0)) {
+    r = -1;
+  }
+  if (close(fd) != 0) {
+    r = -1;
+  }
+  if (r == 0 && rename(tmp_path, path) != 0) {
+    r = -1;
+  }
+  if (r != 0) {
+    unlink(tmp_path);
+    return -1;
+  }
+  editor_frame_set_origin(frame, &st);
+  return 0;
+}
+
+// NOTE: a loaded file ends with an empty line when it ends with a new line,
+// so joining the lines with new lines writes it back unchanged. dumps end every
+// line with a new line instead. Returns 1 when the lines were joined into the
+// file they came from and nothing changed, the file is left alone
+int editor_frame_dump_file(MemoryArena *transient_arena, EditorFrame *frame,
+                           char *filename, bool join) {
+  int origin_fd = join && frame->origin_count > 0 ? open(filename, O_RDONLY)
+                                                  : -1;
+  if (origin_fd >= 0) {
+    struct stat st;
+    int r = 2;
+    if (fstat(origin_fd, &st) == 0 &&
+        file_identity_equal(&frame->origin_file, &st)) {
+      r = frame->modified ? editor_frame_save_over(transient_arena, frame,
+                                                   filename, origin_fd, &st)
+                          : 1;
+    }
+    close(origin_fd);
+    if (r != 2) {
+      return r;
+    }
+  }
+
+  FILE *f = fopen(filename, "w");
+  if (!f) {
+    return -1;
+  }
+
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  char *buffer =
+      pushSize(transient_arena, LOAD_FILE_READ_SIZE, DEFAULT_ALIGNMENT);
+  setvbuf(f, buffer, _IOFBF, LOAD_FILE_READ_SIZE);
+
+  int r = 0;
+  for (Line *line = frame->line; line != NULL; line = line->next) {
+    bool new_line = !join || line->next != NULL;
+    if (fwrite(line_text(frame, line), 1, line->len, f) !=
+            (size_t)line->len ||
+        (new_line && fputc('\n', f) == EOF)) {
+      r = -1;
+      break;
+    }
+  }
+  if (fclose(f) != 0) {
+    r = -1;
+  }
+  endTemporaryMemory(tmp_memory);
+
+  struct stat st;
+  if (r == 0 && join && stat(filename, &st) == 0) {
+    editor_frame_set_origin(frame, &st);
+  }
+  return r;
+}
+
+// NOTE: removes lines [start, end), the cursor ends up on the first line after
+// them
+void editor_frame_delete_range(EditorFrame *frame, int32_t start,
+                               int32_t end) {
+  assert(start >= 0 && start <= end && end <= frame->line_count);
+  if (start == end) {
+    return;
+  }
+  journal_record(frame, JournalOp_delete_range, start, end, 0, 0, NULL, 0);
+  journal_suspend(frame);
+  editor_frame_begin_batch(frame);
+  editor_frame_move_cursor_v(frame, start - frame->cursor.line_num, NULL);
+  editor_frame_remove_lines(frame, end - start);
+  editor_frame_end_batch(frame);
+  journal_resume(frame);
+}
+
+// NOTE: inserts text at column in every line of [start, end), lines shorter
+// than column are left alone. The lines are walked once and the line count
+// doesn't change, so the index stays valid and only the visible lines are
+// invalidated when the batch ends
+void editor_frame_block_insert(EditorFrame *frame, int32_t start, int32_t end,
+                               int32_t column, char *text,
+                               int32_t text_size) {
+  assert(start >= 0 && start <= end && end <= frame->line_count);
+  assert(column >= 0);
+  if (start == end || text_size == 0) {
+    return;
+  }
+  // NOTE: every line is made room for first, the block goes in everywhere or
+  // nowhere
+  Line *line = editor_frame_line_at(frame, start);
+  for (int32_t line_num = start; line_num < end;
+       ++line_num, line = line->next) {
+    if (line->len >= column &&
+        !line_try_reserve(frame, line, (int64_t)line->len + text_size)) {
+      return;
+    }
+  }
+  journal_record(frame, JournalOp_block_insert, start, end, column, 0, text,
+                 text_size);
+  editor_frame_begin_batch(frame);
+
+  line = editor_frame_line_at(frame, start);
+  for (int32_t line_num = start; line_num < end;
+       ++line_num, line = line->next) {
+    if (line->len < column) {
+      continue;
+    }
+    line_reserve(frame, line, line->len + text_size);
+    charcpy(line->text + column + text_size, line->text + column,
+            line->len - column);
+    charcpy(line->text + column, text, text_size);
+    line->len += text_size;
+    editor_frame_touch_line(frame, line, line_num);
+  }
+
+  editor_frame_end_batch(frame);
+}
+
+// NOTE: removes columns [column_start, column_end) from every line of
+// [start, end), clipped to the length of each line. Same single pass as
+// editor_frame_block_insert
+void editor_frame_block_delete(EditorFrame *frame, int32_t start, int32_t end,
+                               int32_t column_start, int32_t column_end) {
+  assert(start >= 0 && start <= end && end <= frame->line_count);
+  assert(column_start >= 0 && column_start <= column_end);
+  if (start == end || column_start == column_end) {
+    return;
+  }
+  journal_record(frame, JournalOp_block_delete, start, end, column_start,
+                 column_end, NULL, 0);
+  editor_frame_begin_batch(frame);
+
+  Line *line = editor_frame_line_at(frame, start);
+  for (int32_t line_num = start; line_num < end;
+       ++line_num, line = line->next) {
+    if (line->len <= column_start) {
+      continue;
+    }
+    int32_t cut_end = line->len < column_end ? line->len : column_end;
+    line_reserve(frame, line, line->len);
+    charcpy(line->text + column_start, line->text + cut_end,
+            line->len - cut_end);
+    line->len -= cut_end - column_start;
+    editor_frame_touch_line(frame, line, line_num);
+  }
+  if (frame->cursor.column > frame->cursor.line->len) {
+    frame->cursor.column = frame->cursor.line->len;
+  }
+
+  editor_frame_end_batch(frame);
+}
+
+// NOTE: lines [start, end) go to reg, returns false when it can't hold them.
+// Only the texts of short and cold lines are copied, the others are shared
+bool editor_frame_yank(EditorFrame *frame, TextRegister *reg, int32_t start,
+                       int32_t end) {
+  assert(start >= 0 && start <= end && end <= frame->line_count);
+  text_register_clear(reg);
+  int32_t count = end - start;
+  uint64_t size = (uint64_t)count * sizeof(LineSpan);
+  Line *first = editor_frame_line_at(frame, start);
+  Line *line = first;
+  for (int32_t i = 0; i < count; ++i, line = line->next) {
+    if (line->text == line->inline_text || line->text == NULL) {
+      size += line->len;
+    }
+  }
+  if (!text_register_fits(reg, size)) {
+    return false;
+  }
+  reg->spans = pushArray(&reg->arena, count, LineSpan, DEFAULT_ALIGNMENT);
+  line = first;
+  for (int32_t i = 0; i < count; ++i, line = line->next) {
+    LineSpan *span = reg->spans + i;
+    span->len = line->len;
+    if (line->text == line->inline_text || line->text == NULL) {
+      span->text = pushSize(&reg->arena, line->len, 1);
+      charcpy(span->text, line_text(frame, line), line->len);
+    } else {
+      span->text = line->text;
+      line->text_shared = true;
+    }
+  }
+  reg->count = count;
+  return true;
+}
+
+// NOTE: the lines of reg go after the cursor line, or before it when above.
+// They are linked into a chain that is spliced in at once, so the frame is
+// reindexed once. Long texts still in the frame arena are shared with the
+// register, the others are copied. The cursor goes to the first new line.
+// False when the arena has no room for the lines, the frame is left as it was
+bool editor_frame_put(EditorFrame *frame, TextRegister *reg, bool above) {
+  if (reg->count == 0) {
+    return true;
+  }
+
+  uint8_t *arena_start = frame->arena.base;
+  uint8_t *arena_end = frame->arena.base + frame->arena.size;
+  Line *first = NULL;
+  Line *last = NULL;
+  int32_t made = 0;
+  for (; made < reg->count; ++made) {
+    LineSpan *span = reg->spans + made;
+    Line *line = line_recycle(frame);
+    if (line == NULL) {
+      break;
+    }
+    line->len = 0;
+    if (span->len >= LINE_INLINE_SIZE &&
+        (uint8_t *)span->text >= arena_start &&
+        (uint8_t *)span->text < arena_end) {
+      if (line->text != line->inline_text && !line->text_shared) {
+        frame->abandoned_size += line->max_len + 1;
+      }
+      line->text = span->text;
+      line->max_len = span->len;
+      line->text_shared = true;
+    } else if (line_try_reserve(frame, line, span->len)) {
+      charcpy(line->text, span->text, span->len);
+    } else {
+      line_unrecycle(frame, line);
+      break;
+    }
+    line->len = span->len;
+
+    line->prev = last;
+    line->next = NULL;
+    if (last != NULL) {
+      last->next = line;
+    } else {
+      first = line;
+    }
+    last = line;
+  }
+  if (made < reg->count ||
+      !editor_frame_index_reserve(frame, frame->line_count + reg->count)) {
+    while (first != NULL) {
+      Line *next = first->next;
+      line_unrecycle(frame, first);
+      first = next;
+    }
+    return false;
+  }
+  journal_record_spans(frame, JournalOp_put, reg->count, above, reg->spans,
+                       reg->count);
+  editor_frame_begin_batch(frame);
+
+  Line *cursor_line = frame->cursor.line;
+  int32_t line_num = frame->cursor.line_num;
+  if (above) {
+    first->prev = cursor_line->prev;
+    last->next = cursor_line;
+    if (cursor_line->prev != NULL) {
+      cursor_line->prev->next = first;
+    } else {
+      frame->line = first;
+    }
+    cursor_line->prev = last;
+    frame->cursor.line_num += reg->count;
+  } else {
+    line_num++;
+    first->prev = cursor_line;
+    last->next = cursor_line->next;
+    if (cursor_line->next != NULL) {
+      cursor_line->next->prev = last;
+    }
+    cursor_line->next = first;
+  }
+  frame->line_count += reg->count;
+  editor_frame_lines_moved(frame, line_num, reg->count);
+  editor_frame_mark_dirty(frame, line_num + reg->count - 1);
+
+  int32_t column = 0;
+  editor_frame_move_cursor_v(frame, line_num - frame->cursor.line_num,
+                             &column);
+  editor_frame_end_batch(frame);
+  return true;
+}
+
+static char *text_find(char *text, int32_t text_size, char *pattern,
+                       int32_t pattern_size) {
+  char *end = text + text_size - pattern_size;
+  while (text <= end) {
+    text = memchr(text, pattern[0], end - text + 1);
+    if (text == NULL) {
+      return NULL;
+    }
+    if (memcmp(text, pattern, pattern_size) == 0) {
+      return text;
+    }
+    text++;
+  }
+  return NULL;
+}
+
+// NOTE: matches of pattern in the first len characters of text, only the
+// first one unless global. *first is the first match
+static int32_t text_match_count(char *text, int32_t len, char *pattern,
+                                int32_t pattern_size, bool global,
+                                char **first) {
+  int32_t count = 0;
+  *first = text_find(text, len, pattern, pattern_size);
+  for (char *m = *first; m != NULL;) {
+    count++;
+    if (!global) {
+      break;
+    }
+    char *next = m + pattern_size;
+    m = text_find(next, text + len - next, pattern, pattern_size);
+  }
+  return count;
+}
+
+// NOTE: plain text replacement in lines [start, end), only the first match of
+// every line unless global. Returns the number of replacements. Every line
+// that changes is made room for first, so the lines are replaced everywhere
+// or nowhere. -1 when an arena is full, nothing was replaced
+int32_t editor_frame_substitute(MemoryArena *transient_arena,
+                                EditorFrame *frame, int32_t start, int32_t end,
+                                char *pattern, int32_t pattern_size,
+                                char *replacement, int32_t replacement_size,
+                                bool global) {
+  assert(start >= 0 && start <= end && end <= frame->line_count);
+  assert(pattern_size > 0);
+  if (start == end) {
+    return 0;
+  }
+
+  int64_t max_len = 0;
+  Line *line = editor_frame_line_at(frame, start);
+  for (int32_t line_num = start; line_num < end;
+       ++line_num, line = line->next) {
+    char *match;
+    int32_t count = text_match_count(line_text(frame, line), line->len,
+                                     pattern, pattern_size, global, &match);
+    if (count == 0) {
+      continue;
+    }
+    int64_t new_len =
+        (int64_t)line->len + (int64_t)count * (replacement_size - pattern_size);
+    assert(new_len < INT32_MAX);
+    // NOTE: a shared text that is cut short would lose its tail here
+    if (!line_try_reserve(frame, line,
+                          new_len > line->len ? new_len : line->len)) {
+      return -1;
+    }
+    if (new_len > max_len) {
+      max_len = new_len;
+    }
+  }
+
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  char *text = pushSize(transient_arena, max_len + 1, DEFAULT_ALIGNMENT);
+  if (text == NULL) {
+    endTemporaryMemory(tmp_memory);
+    return -1;
+  }
+  if (frame->journal != NULL && frame->journal->suspended == 0) {
+    char *payload = pushSize(transient_arena, pattern_size + replacement_size,
+                             DEFAULT_ALIGNMENT);
+    if (payload == NULL) {
+      endTemporaryMemory(tmp_memory);
+      return -1;
+    }
+    charcpy(payload, pattern, pattern_size);
+    charcpy(payload + pattern_size, replacement, replacement_size);
+    journal_record(frame, JournalOp_substitute, start, end, pattern_size,
+                   global, payload, pattern_size + replacement_size);
+  }
+  editor_frame_begin_batch(frame);
+
+  int32_t total = 0;
+  line = editor_frame_line_at(frame, start);
+  for (int32_t line_num = start; line_num < end;
+       ++line_num, line = line->next) {
+    char *match;
+    char *old_text = line_text(frame, line);
+    int32_t count = text_match_count(old_text, line->len, pattern,
+                                     pattern_size, global, &match);
+    if (count == 0) {
+      continue;
+    }
+
+    int64_t new_len =
+        (int64_t)line->len + (int64_t)count * (replacement_size - pattern_size);
+    char *src = old_text;
+    char *dest = text;
+    for (int32_t i = 0; i < count; ++i) {
+      charcpy(dest, src, match - src);
+      dest += match - src;
+      charcpy(dest, replacement, replacement_size);
+      dest += replacement_size;
+      src = match + pattern_size;
+      if (i + 1 < count) {
+        match = text_find(src, old_text + line->len - src, pattern,
+                          pattern_size);
+      }
+    }
+    charcpy(dest, src, old_text + line->len - src);
+
+    line_reserve(frame, line, new_len);
+    charcpy(line->text, text, new_len);
+    line->len = new_len;
+
+    editor_frame_touch_line(frame, line, line_num);
+    if (line == frame->cursor.line && frame->cursor.column > line->len) {
+      frame->cursor.column = line->len;
+    }
+    total += count;
+  }
+  endTemporaryMemory(tmp_memory);
+
+  editor_frame_end_batch(frame);
+  return total;
+}
+
+static void editor_frame_journal_seek(EditorFrame *frame,
+                                      JournalRecord *record) {
+  editor_frame_move_cursor_v(frame, record->line_num - frame->cursor.line_num,
+                             NULL);
+  frame->cursor.column = record->column;
+}
+
+// NOTE: puts the lines of the payload, false when they don't match the
+// record
+static bool editor_frame_journal_put(MemoryArena *transient_arena,
+                                     EditorFrame *frame, JournalRecord *record,
+                                     char *payload) {
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  TextRegister reg = {.count = record->args[0]};
+  reg.spans =
+      pushArray(transient_arena, reg.count, LineSpan, DEFAULT_ALIGNMENT);
+  char *text = payload;
+  char *end = payload + record->size;
+  int32_t count = 0;
+  while (text < end && count < reg.count) {
+    char *new_line = memchr(text, '\n', end - text);
+    if (new_line == NULL) {
+      break;
+    }
+    reg.spans[count++] = (LineSpan){.text = text, .len = new_line - text};
+    text = new_line + 1;
+  }
+  bool valid = count == reg.count && text == end;
+  if (valid) {
+    editor_frame_put(frame, &reg, record->args[1]);
+  }
+  endTemporaryMemory(tmp_memory);
+  return valid;
+}
+
+// NOTE: reapplies the journal from its first record, which loads the original
+// file, to the first truncated or invalid record. The journal is cut there so
+// new records follow the last good one. filename receives the path of the
+// original file. Returns the number of edits replayed, -1 when the journal
+// can't be used
+int32_t editor_frame_journal_replay(MemoryArena *transient_arena,
+                                    EditorFrame *frame, char *filename) {
+  Journal *journal = frame->journal;
+  assert(journal != NULL);
+  struct stat journal_stat;
+  if (fstat(journal->fd, &journal_stat) != 0 ||
+      journal_stat.st_size < (off_t)sizeof(JournalRecord)) {
+    return -1;
+  }
+
+  TemporaryMemory tmp_memory = beginTemporaryMemory(transient_arena);
+  char *data =
+      pushSize(transient_arena, journal_stat.st_size + 1, DEFAULT_ALIGNMENT);
+  if (pread(journal->fd, data, journal_stat.st_size, 0) !=
+      journal_stat.st_size) {
+    endTemporaryMemory(tmp_memory);
+    return -1;
+  }
+
+  int32_t count = -1;
+  off_t offset = 0;
+  journal->suspended++;
+  editor_frame_begin_batch(frame);
+  while (offset + (off_t)sizeof(JournalRecord) <= journal_stat.st_size) {
+    JournalRecord record;
+    memcpy(&record, data + offset, sizeof(record));
+    char *payload = data + offset + sizeof(record);
+    if (record.size < 0 ||
+        offset + (off_t)sizeof(record) + record.size > journal_stat.st_size) {
+      break;
+    }
+    if (count < 0 && record.op != JournalOp_load &&
+        record.op != JournalOp_close) {
+      break;
+    }
+
+    if (record.op == JournalOp_load) {
+      if (count >= 0 || record.size >= FILENAME_SIZE) {
+        break;
+      }
+      charcpy(filename, payload, record.size);
+      filename[record.size] = '\0';
+      if (editor_frame_load_file(transient_arena, frame, filename) != 0) {
+        break;
+      }
+    } else if (record.op == JournalOp_close) {
+      if (count >= 0) {
+        break;
+      }
+      filename[0] = '\0';
+      editor_frame_close(frame);
+    } else {
+      if (record.line_num < 0 || record.line_num >= frame->line_count) {
+        break;
+      }
+      editor_frame_journal_seek(frame, &record);
+      if (record.column < 0 || record.column > frame->cursor.line->len) {
+        break;
+      }
+
+      if (record.op == JournalOp_insert_text && record.size > 0) {
+        editor_frame_insert_text(frame, payload, record.size);
+      } else if (record.op == JournalOp_remove_char) {
+        editor_frame_remove_char(frame);
+      } else if (record.op == JournalOp_insert_new_line) {
+        editor_frame_insert_new_line(frame);
+      } else if (record.op == JournalOp_remove_lines && record.args[0] > 0) {
+        editor_frame_remove_lines(frame, record.args[0]);
+      } else if (record.op == JournalOp_delete_range &&
+                 record.args[0] >= 0 && record.args[0] <= record.args[1] &&
+                 record.args[1] <= frame->line_count) {
+        editor_frame_delete_range(frame, record.args[0], record.args[1]);
+      } else if (record.op == JournalOp_block_insert &&
+                 record.args[0] >= 0 && record.args[0] <= record.args[1] &&
+                 record.args[1] <= frame->line_count &&
+                 record.args[2] >= 0) {
+        editor_frame_block_insert(frame, record.args[0], record.args[1],
+                                  record.args[2], payload, record.size);
+      } else if (record.op == JournalOp_block_delete &&
+                 record.args[0] >= 0 && record.args[0] <= record.args[1] &&
+                 record.args[1] <= frame->line_count &&
+                 record.args[2] >= 0 && record.args[2] <= record.args[3]) {
+        editor_frame_block_delete(frame, record.args[0], record.args[1],
+                                  record.args[2], record.args[3]);
+      } else if (record.op == JournalOp_put && record.args[0] > 0) {
+        if (!editor_frame_journal_put(transient_arena, frame, &record,
+                                      payload)) {
+          break;
+        }
+      } else if (record.op == JournalOp_substitute && record.args[0] >= 0 &&
+                 record.args[0] <= record.args[1] &&
+                 record.args[1] <= frame->line_count && record.args[2] > 0 &&
+                 record.args[2] <= record.size) {
+        editor_frame_substitute(transient_arena, frame, record.args[0],
+                                record.args[1], payload, record.args[2],
+                                payload + record.args[2],
+                                record.size - record.args[2],
+                                record.args[3]);
+      } else {
+        break;
+      }
+    }
+    count++;
+    offset += sizeof(record) + record.size;
+  }
+  editor_frame_end_batch(frame);
+  journal->suspended--;
+  endTemporaryMemory(tmp_memory);
+
+  if (count < 0) {
+    return -1;
+  }
+  if (offset < journal_stat.st_size && ftruncate(journal->fd, offset) != 0) {
+    return -1;
+  }
+  return count;
+}
+
+static char *integrity_level_names[Integrity_count] = {
+    [Integrity_off] = "off",
+    [Integrity_touched] = "touched",
+    [Integrity_periodic] = "periodic",
+    [Integrity_full] = "full",
+};
+
+// NOTE: returns false when name is not a level
+bool editor_frame_set_integrity(EditorFrame *frame, char *name) {
+  for (int32_t i = 0; i < Integrity_count; ++i) {
+    if (strcmp(name, integrity_level_names[i]) == 0) {
+      frame->integrity = i;
+      frame->integrity_edits = 0;
+      return true;
+    }
+  }
+  return false;
+}
+
 EditorFrame editor_frame_create(MemoryArena *arena) {
-  EditorFrame frame = (EditorFrame){
-      .line_count = 1, .viewport_v.start = 0, .viewport_h.start = 0};
+  EditorFrame frame = (EditorFrame){.line_count = 1,
+                                    .viewport_v.start = 0,
+                                    .viewport_h.start = 0,
+                                    .wrap_generation = 1};
   size_t frame_arena_size = arena->size * 0.9;
-  sub_arena(&frame.arena, arena, frame_arena_size, ARENA_DEFAULT_ALIGNMENT);
-  Line *line = line_create(&frame.arena);
+  sub_arena(&frame.arena, arena, frame_arena_size, ARENA_HUGE_PAGE_SIZE);
+#if FRAME_ARENA_HUGE_PAGES
+  arenaUseHugePages(&frame.arena);
+#endif
+  char *integrity = getenv("HTEXT_INTEGRITY");
+  if (integrity == NULL || !editor_frame_set_integrity(&frame, integrity)) {
+    frame.integrity = Integrity_touched;
+  }
+  Line *line = line_create(&frame);
   frame.cursor = (Cursor){.line = line, .column = 0}, frame.line = line;
   editor_frame_reindex(&frame);
+  editor_frame_reset_dirty_range(&frame);
   return frame;
 }
@@ -0,0 +1,188 @@
+#include "htext_app.h"
+#include <ctype.h>
+
+// NOTE: an address is a line number as shown in the gutter, `.` for the cursor
+// line or `$` for the last one. Returns the characters consumed, 0 when there
+// is no address
+static int32_t ex_parse_address(EditorFrame *frame, char *text,
+                                int32_t *line_num) {
+  if (text[0] == '.') {
+    *line_num = frame->cursor.line_num;
+    return 1;
+  } else if (text[0] == '$') {
+    *line_num = frame->line_count - 1;
+    return 1;
+  } else if (isdigit((unsigned char)text[0])) {
+    char *end;
+    long long n = strtoll(text, &end, 10);
+    *line_num = n > INT32_MAX ? INT32_MAX : n;
+    return end - text;
+  }
+  return 0;
+}
+
+// NOTE: s{delim}pattern{delim}replacement[{delim}[g]], plain text, no regex
+static ExResult ex_substitute(ExCommandContext *context, char *text,
+                              int32_t start, int32_t end) {
+  char delim = text[1];
+  if (delim == '\0' || isalnum((unsigned char)delim) ||
+      isspace((unsigned char)delim)) {
+    sprintf(context->status_message, "Invalid substitution: %.200s", text);
+    return ExResult_error;
+  }
+  char *pattern = text + 2;
+  char *pattern_end = strchr(pattern, delim);
+  if (pattern_end == NULL || pattern_end == pattern) {
+    sprintf(context->status_message, "Invalid substitution: %.200s", text);
+    return ExResult_error;
+  }
+  char *replacement = pattern_end + 1;
+  char *replacement_end = strchr(replacement, delim);
+  bool global = false;
+  if (replacement_end == NULL) {
+    replacement_end = replacement + strlen(replacement);
+  } else if (strcmp(replacement_end + 1, "g") == 0) {
+    global = true;
+  } else if (replacement_end[1] != '\0') {
+    sprintf(context->status_message, "Invalid substitution: %.200s", text);
+    return ExResult_error;
+  }
+
+  int32_t count = editor_frame_substitute(
+      context->transient_arena, context->frame, start, end, pattern,
+      pattern_end - pattern, replacement, replacement_end - replacement,
+      global);
+  if (count < 0) {
+    sprintf(context->status_message, "Out of memory, nothing substituted");
+    return ExResult_error;
+  }
+  if (count == 0) {
+    sprintf(context->status_message, "Pattern not found");
+  } else {
+    sprintf(context->status_message, "%d substitutions", count);
+  }
+  return ExResult_ok;
+}
+
+static ExResult ex_write(ExCommandContext *context, char *filename,
+                         bool join) {
+  if (filename[0] == '\0') {
+    sprintf(context->status_message, "No file name");
+    return ExResult_error;
+  }
+  int r = editor_frame_dump_file(context->transient_arena, context->frame,
+                                 filename, join);
+  if (r < 0) {
+    sprintf(context->status_message, "Cannot write to %.200s", filename);
+    return ExResult_error;
+  }
+  if (r == 1) {
+    sprintf(context->status_message, "No changes to %.200s", filename);
+    return ExResult_ok;
+  }
+  if (join && strcmp(filename, context->filename) == 0) {
+    editor_frame_journal_rebase(context->frame, filename);
+  }
+  sprintf(context->status_message, "Wrote to %.200s", filename);
+  return ExResult_ok;
+}
+
+// NOTE: [range] is `%` or one or two addresses separated by `,`. With a range
+// the commands are `d` and `s`, a range alone moves the cursor
+static ExResult ex_range_command(ExCommandContext *context, char *text) {
+  EditorFrame *frame = context->frame;
+  int32_t start, end;
+  char *command = text;
+  if (text[0] == '%') {
+    start = 0;
+    end = frame->line_count - 1;
+    command++;
+  } else {
+    int32_t n = ex_parse_address(frame, command, &start);
+    assert(n > 0);
+    command += n;
+    end = start;
+    if (command[0] == ',') {
+      n = ex_parse_address(frame, command + 1, &end);
+      if (n == 0) {
+        sprintf(context->status_message, "Invalid range: %.200s", text);
+        return ExResult_error;
+      }
+      command += n + 1;
+    }
+  }
+  if (start > end || end >= frame->line_count) {
+    sprintf(context->status_message, "Invalid range: %.200s", text);
+    return ExResult_error;
+  }
+
+  if (command[0] == '\0') {
+    editor_frame_move_cursor_v(frame, end - frame->cursor.line_num, NULL);
+    return ExResult_ok;
+  } else if (strcmp(command, "d") == 0 || strcmp(command, "delete") == 0) {
+    editor_frame_delete_range(frame, start, end + 1);
+    return ExResult_ok;
+  } else if (command[0] == 's') {
+    return ex_substitute(context, command, start, end + 1);
+  }
+  sprintf(context->status_message, "Unrecognized command: %.200s", text);
+  return ExResult_error;
+}
+
+ExResult ex_command_execute(ExCommandContext *context, char *command,
+                            int32_t size) {
+  TemporaryMemory tmp_memory = beginTemporaryMemory(context->transient_arena);
+  char *text = pushSize(context->transient_arena, size + 1, DEFAULT_ALIGNMENT);
+  charcpy(text, command, size);
+  text[size] = '\0';
+
+  ExResult result = ExResult_ok;
+  if (strcmp(text, "quit") == 0 || strcmp(text, "q") == 0) {
+    result = ExResult_quit;
+  } else if (strcmp(text, "load") == 0 || strncmp(text, "load ", 5) == 0) {
+    char *filename = text[4] == '\0' ? "data" : text + 5;
+    int loaded = strlen(filename) >= FILENAME_SIZE
+                     ? -1
+                     : editor_frame_load_file(context->transient_arena,
+                                              context->frame, filename);
+    if (loaded == LOAD_FILE_UNPRINTABLE) {
+      sprintf(context->status_message, "Cannot load %.200s: not printable",
+              filename);
+      result = ExResult_error;
+    } else if (loaded != 0) {
+      sprintf(context->status_message, "Cannot open %.200s", filename);
+      result = ExResult_error;
+    } else {
+      strcpy(context->filename, filename);
+      context->filename_changed = true;
+    }
+  } else if (strncmp(text, "dump ", 5) == 0) {
+    result = ex_write(context, text + 5, false);
+  } else if (strcmp(text, "w") == 0 || strcmp(text, "write") == 0) {
+    result = ex_write(context, context->filename, true);
+  } else if (strncmp(text, "w ", 2) == 0) {
+    result = ex_write(context, text + 2, true);
+  } else if (strcmp(text, "close") == 0) {
+    context->filename[0] = '\0';
+    context->filename_changed = true;
+    editor_frame_close(context->frame);
+  } else if (strcmp(text, "set wrap") == 0) {
+    editor_frame_set_wrap(context->frame, true);
+  } else if (strcmp(text, "set nowrap") == 0) {
+    editor_frame_set_wrap(context->frame, false);
+  } else if (strncmp(text, "set integrity=", 14) == 0) {
+    if (!editor_frame_set_integrity(context->frame, text + 14)) {
+      sprintf(context->status_message, "Unknown integrity level %.100s",
+              text + 14);
+      result = ExResult_error;
+    }
+  } else if (text[0] == '%' || text[0] == '.' || text[0] == '$' ||
+             isdigit((unsigned char)text[0])) {
+    result = ex_range_command(context, text);
+  } else {
+    result = ExResult_unhandled;
+  }
+
+  endTemporaryMemory(tmp_memory);
+  return result;
+}
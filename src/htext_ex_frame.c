@@ -5,6 +5,7 @@ void ex_frame_invalidate_texture(ExFrame *frame) {
     SDL_DestroyTexture(frame->texture);
     frame->texture = NULL;
   }
+  frame->advances_valid = false;
 }
 
 void ex_frame_insert_text(ExFrame *frame, char *text, int16_t text_size) {
@@ -35,5 +36,8 @@ ExFrame ex_frame_create(MemoryArena *arena) {
   ExFrame ex_frame = (ExFrame){
       .size = 0, .max_size = 200, .cursor_column = 0, .texture = NULL};
   ex_frame.text = pushSize(arena, ex_frame.max_size, DEFAULT_ALIGNMENT);
+  ex_frame.advances = pushArray(arena, ex_frame.max_size + 1, int32_t,
+                                DEFAULT_ALIGNMENT);
+  ex_frame.advances_valid = false;
   return ex_frame;
 }
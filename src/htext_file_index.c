@@ -0,0 +1,646 @@
+#include "htext_app.h"
+
+static void file_list_reset(FileList *list) {
+  list->arena.used = 0;
+  releaseArena(&list->arena);
+  list->dirs = NULL;
+  list->dir_count = 0;
+  list->dir_size = 0;
+  list->dir_table = NULL;
+  list->dir_table_size = 0;
+  list->files = NULL;
+  list->masks = NULL;
+  list->file_count = 0;
+  list->file_size = 0;
+  list->incomplete = false;
+}
+
+// NOTE: path + suffix is named the way the crawl names it, relative to the
+// working directory like the root
+void file_index_ignore(FileIndex *index, char *path, char *suffix) {
+  if (index->ignored_count < FILE_INDEX_IGNORED_COUNT &&
+      strlen(path) + strlen(suffix) < GREP_PATH_SIZE) {
+    sprintf(index->ignored[index->ignored_count++], "%s%s", path, suffix);
+  }
+}
+
+static bool file_index_ignored(FileIndex *index, char *path) {
+  for (int32_t i = 0; i < index->ignored_count; ++i) {
+    if (strcmp(index->ignored[i], path) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+FileIndex *file_index_create(MemoryArena *arena, memory_index list_size,
+                             char *root, char *save_path) {
+  assert(strlen(root) < GREP_PATH_SIZE && strlen(save_path) < GREP_PATH_SIZE);
+  FileIndex *index = pushStruct(arena, FileIndex, DEFAULT_ALIGNMENT);
+  memset(index, 0, sizeof(*index));
+  for (int32_t i = 0; i < 2; ++i) {
+    sub_arena(&index->lists[i].arena, arena, list_size, ARENA_COMMIT_SIZE);
+    file_list_reset(index->lists + i);
+  }
+  for (int32_t i = 0; i < FILE_INDEX_JOB_COUNT; ++i) {
+    index->jobs[i].index = index;
+  }
+  strcpy(index->root, root);
+  strcpy(index->save_path, save_path);
+  file_index_ignore(index, save_path, "");
+  file_index_ignore(index, save_path, ".tmp");
+  return index;
+}
+
+static inline char fuzzy_lower(char c) {
+  return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+}
+
+// NOTE: letters and digits get a bit each, the other characters share the
+// rest. A path can only match a query whose mask is a subset of its own
+static uint64_t fuzzy_mask(char *text, int32_t len) {
+  uint64_t mask = 0;
+  for (int32_t i = 0; i < len; ++i) {
+    char c = fuzzy_lower(text[i]);
+    int32_t bit = c >= 'a' && c <= 'z'   ? c - 'a'
+                  : c >= '0' && c <= '9' ? 26 + c - '0'
+                                         : 36 + (uint8_t)c % 28;
+    mask |= 1ULL << bit;
+  }
+  return mask;
+}
+
+static bool fuzzy_boundary(char *path, int32_t i) {
+  if (i == 0) {
+    return true;
+  }
+  char prev = path[i - 1];
+  return prev == '/' || prev == '_' || prev == '-' || prev == '.' ||
+         prev == ' ' ||
+         (prev >= 'a' && prev <= 'z' && path[i] >= 'A' && path[i] <= 'Z');
+}
+
+// NOTE: -1 unless the lower case query is a subsequence of path, ignoring
+// case. The first match found is shrunk from its end back to the shortest
+// window, its characters score more at the start of a word, right after the
+// previous one and in the file name, gaps and long paths score less
+static int32_t fuzzy_score(char *path, char *query, int32_t query_len) {
+  int32_t q = 0;
+  int32_t end = 0;
+  for (; path[end] != '\0' && q < query_len; ++end) {
+    if (fuzzy_lower(path[end]) == query[q]) {
+      q++;
+    }
+  }
+  if (q < query_len) {
+    return -1;
+  }
+  int32_t len = end + strlen(path + end);
+  char *slash = strrchr(path, '/');
+  int32_t basename = slash != NULL ? slash - path + 1 : 0;
+
+  int32_t score = 0;
+  int32_t next = -1;
+  int32_t start = end;
+  for (int32_t i = end - 1; q > 0; --i) {
+    if (fuzzy_lower(path[i]) != query[q - 1]) {
+      continue;
+    }
+    score += 16;
+    if (i + 1 == next) {
+      score += 8;
+    }
+    if (fuzzy_boundary(path, i)) {
+      score += 10;
+    }
+    if (i >= basename) {
+      score += 4;
+    }
+    next = i;
+    start = i;
+    q--;
+  }
+  score -= end - start - query_len;
+  score -= len / 8;
+  return score > 0 ? score : 0;
+}
+
+// NOTE: room for size bytes and for the arrays to double once more
+static bool file_list_fits(FileList *list, memory_index size) {
+  memory_index growth =
+      (memory_index)list->dir_size * sizeof(FileIndexDir) +
+      list->file_size * (sizeof(char *) + sizeof(uint64_t)) +
+      list->dir_table_size * sizeof(int32_t);
+  return list->arena.used + size + 2 * growth + Kilobytes(4) <=
+         list->arena.size;
+}
+
+// NOTE: -1 when path is NULL or the arena is full
+static int32_t file_list_add_dir(FileList *list, char *path) {
+  if (path == NULL) {
+    return -1;
+  }
+  if (list->dir_count == list->dir_size) {
+    FileIndexDir *dirs = grep_grow(&list->arena, list->dirs, list->dir_count,
+                                   &list->dir_size, sizeof(FileIndexDir));
+    if (dirs == NULL) {
+      return -1;
+    }
+    list->dirs = dirs;
+  }
+  list->dirs[list->dir_count] = (FileIndexDir){.path = path};
+  return list->dir_count++;
+}
+
+// NOTE: the files of a directory that was read become candidates and its
+// directories are crawled next, unless add_dirs is false (they were saved
+// with the list). Hidden directories and the files the editor writes are
+// skipped. Returns false when the arena ran out or a record doesn't look right
+static bool file_list_add_entries(FileIndex *index, FileList *list,
+                                  int32_t dir, bool add_dirs) {
+  uint8_t *record = list->dirs[dir].entries;
+  uint8_t *end = record + list->dirs[dir].entries_size;
+  char *dir_path = list->dirs[dir].path;
+  while (record < end) {
+    uint16_t len;
+    if (end - record < 3) {
+      return false;
+    }
+    memcpy(&len, record + 1, 2);
+    if (end - record < 3 + len) {
+      return false;
+    }
+    uint8_t kind = record[0];
+    char *name = (char *)record + 3;
+    record += 3 + len;
+    if (kind == PathKind_directory && (!add_dirs || name[0] == '.')) {
+      continue;
+    }
+    if (!file_list_fits(list, strlen(dir_path) + len + 2)) {
+      return false;
+    }
+    char *path = directory_join(&list->arena, dir_path, name, len);
+    if (path == NULL) {
+      continue;
+    }
+    if (kind == PathKind_directory) {
+      if (file_list_add_dir(list, path) < 0) {
+        return false;
+      }
+      continue;
+    }
+    if (file_index_ignored(index, path)) {
+      continue;
+    }
+    if (list->file_count == list->file_size) {
+      int32_t file_size = list->file_size;
+      char **files = grep_grow(&list->arena, list->files, list->file_count,
+                               &file_size, sizeof(char *));
+      uint64_t *masks =
+          files == NULL ? NULL
+                        : grep_grow(&list->arena, list->masks,
+                                    list->file_count, &list->file_size,
+                                    sizeof(uint64_t));
+      if (masks == NULL) {
+        return false;
+      }
+      list->files = files;
+      list->masks = masks;
+    }
+    list->files[list->file_count] = path;
+    list->masks[list->file_count++] = fuzzy_mask(path, strlen(path));
+  }
+  return true;
+}
+
+static uint32_t file_list_hash(char *path) {
+  return hash_bytes(HASH_SEED, path, strlen(path));
+}
+
+// NOTE: the lookup table of a list that is done growing
+static void file_list_finish(FileList *list) {
+  int32_t size = 16;
+  while (size < list->dir_count * 2) {
+    size *= 2;
+  }
+  if (!file_list_fits(list, size * sizeof(int32_t))) {
+    return;
+  }
+  list->dir_table =
+      pushArray(&list->arena, size, int32_t, DEFAULT_ALIGNMENT);
+  memset(list->dir_table, 0xFF, size * sizeof(int32_t));
+  list->dir_table_size = size;
+  for (int32_t i = 0; i < list->dir_count; ++i) {
+    uint32_t slot = file_list_hash(list->dirs[i].path) & (size - 1);
+    while (list->dir_table[slot] >= 0) {
+      slot = (slot + 1) & (size - 1);
+    }
+    list->dir_table[slot] = i;
+  }
+}
+
+static int32_t file_list_find(FileList *list, char *path) {
+  if (list->dir_table == NULL) {
+    return -1;
+  }
+  uint32_t mask = list->dir_table_size - 1;
+  for (uint32_t slot = file_list_hash(path) & mask;
+       list->dir_table[slot] >= 0; slot = (slot + 1) & mask) {
+    if (strcmp(list->dirs[list->dir_table[slot]].path, path) == 0) {
+      return list->dir_table[slot];
+    }
+  }
+  return -1;
+}
+
+// NOTE: [sec][nsec][u16 path length][u32 entries size][path][entries] for
+// every directory after the header, in crawl order
+static void file_index_save(FileIndex *index, FileList *list) {
+  char tmp_path[GREP_PATH_SIZE + 8];
+  sprintf(tmp_path, "%s.tmp", index->save_path);
+  FILE *f = fopen(tmp_path, "w");
+  if (f == NULL) {
+    return;
+  }
+  FileIndexFileHeader header = {.magic = FILE_INDEX_MAGIC,
+                                .dir_count = list->dir_count};
+  fwrite(&header, sizeof(header), 1, f);
+  for (int32_t i = 0; i < list->dir_count; ++i) {
+    FileIndexDir *dir = list->dirs + i;
+    int64_t mtime[2] = {dir->mtime.tv_sec, dir->mtime.tv_nsec};
+    uint16_t path_len = strlen(dir->path);
+    uint32_t entries_size = dir->entries_size;
+    fwrite(mtime, sizeof(mtime), 1, f);
+    fwrite(&path_len, sizeof(path_len), 1, f);
+    fwrite(&entries_size, sizeof(entries_size), 1, f);
+    fwrite(dir->path, 1, path_len, f);
+    fwrite(dir->entries, 1, entries_size, f);
+  }
+  bool ok = !ferror(f);
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp_path, index->save_path) != 0) {
+    unlink(tmp_path);
+  }
+}
+
+// NOTE: the list of the last session is there before the first crawl is
+// done, a file that doesn't look right is ignored
+static bool file_index_load(FileIndex *index) {
+  FileList *list = index->lists + index->current;
+  int fd = open(index->save_path, O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(FileIndexFileHeader) ||
+      !file_list_fits(list, st.st_size)) {
+    close(fd);
+    return false;
+  }
+  uint8_t *data = pushSize(&list->arena, st.st_size, 8);
+  bool ok = read(fd, data, st.st_size) == st.st_size;
+  close(fd);
+  FileIndexFileHeader header;
+  memcpy(&header, data, sizeof(header));
+  ok = ok && header.magic == FILE_INDEX_MAGIC && header.dir_count >= 0;
+
+  uint8_t *record = data + sizeof(header);
+  uint8_t *end = data + st.st_size;
+  for (int32_t i = 0; ok && i < header.dir_count; ++i) {
+    int64_t mtime[2];
+    uint16_t path_len;
+    uint32_t entries_size;
+    if (end - record < 22) {
+      ok = false;
+      break;
+    }
+    memcpy(mtime, record, 16);
+    memcpy(&path_len, record + 16, 2);
+    memcpy(&entries_size, record + 18, 4);
+    record += 22;
+    if (end - record < (int64_t)path_len + entries_size ||
+        path_len >= GREP_PATH_SIZE ||
+        !file_list_fits(list, path_len + 1)) {
+      ok = false;
+      break;
+    }
+    char *path = pushSize(&list->arena, path_len + 1, 1);
+    charcpy(path, (char *)record, path_len);
+    path[path_len] = '\0';
+    int32_t dir = file_list_add_dir(list, path);
+    if (dir < 0) {
+      ok = false;
+      break;
+    }
+    list->dirs[dir].mtime =
+        (struct timespec){.tv_sec = mtime[0], .tv_nsec = mtime[1]};
+    list->dirs[dir].entries = record + path_len;
+    list->dirs[dir].entries_size = entries_size;
+    list->dirs[dir].read = true;
+    record += path_len + entries_size;
+    ok = file_list_add_entries(index, list, dir, false);
+  }
+  if (!ok || record != end) {
+    file_list_reset(list);
+    return false;
+  }
+  file_list_finish(list);
+  return true;
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(file_index_job_run) {
+  (void)queue;
+  FileIndexJob *job = data;
+  if (job->kind == FileIndexJob_save) {
+    file_index_save(job->index, job->index->lists + job->dir);
+  } else if (job->kind == FileIndexJob_load) {
+    file_index_load(job->index);
+  } else {
+    if (job->resume == 0) {
+      struct stat st;
+      job->unchanged = false;
+      if (stat(job->path, &st) == 0) {
+        job->unchanged = job->cached &&
+                         st.st_mtim.tv_sec == job->mtime.tv_sec &&
+                         st.st_mtim.tv_nsec == job->mtime.tv_nsec;
+        job->mtime = st.st_mtim;
+      }
+    }
+    job->output_size = 0;
+    job->more = !job->unchanged &&
+                directory_read(job->path, &job->resume, job->output,
+                               &job->output_size);
+  }
+  __atomic_store_n(&job->state, GrepJob_done, __ATOMIC_RELEASE);
+}
+
+static void file_index_issue(FileIndexJob *job, Memory *memory) {
+  job->state = GrepJob_queued;
+  if (memory->background_queue != NULL) {
+    memory->add_work_entry(memory->background_queue, file_index_job_run,
+                           job);
+  } else {
+    file_index_job_run(NULL, job);
+  }
+}
+
+static FileIndexJob *file_index_free_job(FileIndex *index) {
+  for (int32_t i = 0; i < FILE_INDEX_JOB_COUNT; ++i) {
+    if (index->jobs[i].state == GrepJob_free) {
+      return index->jobs + i;
+    }
+  }
+  return NULL;
+}
+
+// NOTE: a directory job is done, its entries go to the list being crawled.
+// The ones of an unchanged directory are copied from the last crawl
+static void file_index_collect(FileIndex *index, FileIndexJob *job) {
+  FileList *cache = index->lists + index->current;
+  FileList *list = index->lists + 1 - index->current;
+  FileIndexDir *dir = list->dirs + job->dir;
+  dir->mtime = job->mtime;
+  uint8_t *source = job->output;
+  int32_t size = job->output_size;
+  if (job->unchanged) {
+    FileIndexDir *cached = cache->dirs + file_list_find(cache, dir->path);
+    source = cached->entries;
+    size = cached->entries_size;
+    index->dirs_reused++;
+  } else if (!job->more) {
+    index->dirs_read++;
+  }
+  if (!file_list_fits(list, dir->entries_size + size)) {
+    list->incomplete = true;
+    return;
+  }
+  uint8_t *entries =
+      pushSize(&list->arena, dir->entries_size + size, DEFAULT_ALIGNMENT);
+  charcpy((char *)entries, (char *)dir->entries, dir->entries_size);
+  charcpy((char *)entries + dir->entries_size, (char *)source, size);
+  dir->entries = entries;
+  dir->entries_size += size;
+  if (!job->more) {
+    dir->read = true;
+    if (!file_list_add_entries(index, list, job->dir, true)) {
+      list->incomplete = true;
+    }
+  }
+}
+
+// NOTE: the list that isn't current is crawled again from the root
+static void file_index_crawl_begin(FileIndex *index) {
+  FileList *list = index->lists + 1 - index->current;
+  file_list_reset(list);
+  if (index->ranked_list == list) {
+    index->ranked_list = NULL;
+  }
+  if (file_list_add_dir(list, push_string(&list->arena, index->root)) < 0) {
+    list->incomplete = true;
+  }
+  index->crawl_next = 0;
+  index->dirs_read = 0;
+  index->dirs_reused = 0;
+  index->crawling = true;
+}
+
+// NOTE: called once a frame like grep_search_step. Returns true when the
+// list the picker shows may have changed
+bool file_index_step(FileIndex *index, Memory *memory) {
+  FileList *list = index->lists + 1 - index->current;
+  int32_t file_count = list->file_count;
+  bool busy = false;
+  bool loaded = false;
+  for (int32_t i = 0; i < FILE_INDEX_JOB_COUNT; ++i) {
+    FileIndexJob *job = index->jobs + i;
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != GrepJob_done) {
+      busy = busy || job->state != GrepJob_free;
+      continue;
+    }
+    if (job->kind == FileIndexJob_directory) {
+      file_index_collect(index, job);
+      if (job->more && !list->incomplete) {
+        file_index_issue(job, memory);
+        busy = true;
+        continue;
+      }
+    } else if (job->kind == FileIndexJob_load) {
+      index->loading = false;
+      loaded = true;
+      file_index_crawl_begin(index);
+    }
+    job->state = GrepJob_free;
+  }
+
+  FileIndexJob *job;
+  while (index->crawling && !list->incomplete &&
+         index->crawl_next < list->dir_count &&
+         (job = file_index_free_job(index)) != NULL) {
+    FileList *cache = index->lists + index->current;
+    job->kind = FileIndexJob_directory;
+    job->dir = index->crawl_next++;
+    strcpy(job->path, list->dirs[job->dir].path);
+    int32_t cached = file_list_find(cache, job->path);
+    job->cached = cached >= 0;
+    job->mtime = job->cached ? cache->dirs[cached].mtime
+                             : (struct timespec){0};
+    job->resume = 0;
+    file_index_issue(job, memory);
+    busy = true;
+  }
+
+  if (index->crawling && !busy &&
+      (index->crawl_next == list->dir_count || list->incomplete)) {
+    index->crawling = false;
+    file_list_finish(list);
+    if (!list->incomplete || index->lists[index->current].file_count == 0) {
+      index->current = 1 - index->current;
+    }
+    if (!list->incomplete) {
+      job = file_index_free_job(index);
+      job->kind = FileIndexJob_save;
+      job->dir = index->current;
+      file_index_issue(job, memory);
+    }
+    return true;
+  }
+  return loaded || list->file_count != file_count;
+}
+
+// NOTE: crawls the tree again unless a crawl is running or the last one is
+// still being saved. The first time the saved list is read on the
+// background queue and the crawl starts from file_index_step once it is
+void file_index_refresh(FileIndex *index, Memory *memory) {
+  if (index->crawling) {
+    return;
+  }
+  for (int32_t i = 0; i < FILE_INDEX_JOB_COUNT; ++i) {
+    if (index->jobs[i].state != GrepJob_free) {
+      return;
+    }
+  }
+  if (!index->loaded) {
+    index->loaded = true;
+    index->loading = true;
+    index->jobs[0].kind = FileIndexJob_load;
+    file_index_issue(index->jobs, memory);
+    return;
+  }
+  file_index_crawl_begin(index);
+  file_index_step(index, memory);
+}
+
+// NOTE: the jobs of a snapshot belonged to the threads of the process that
+// wrote it, the crawl starts over the next time the picker opens
+void file_index_restore(FileIndex *index) {
+  for (int32_t i = 0; i < FILE_INDEX_JOB_COUNT; ++i) {
+    index->jobs[i].state = GrepJob_free;
+  }
+  if (index->loading) {
+    index->loading = false;
+    index->loaded = false;
+    file_list_reset(index->lists + index->current);
+  }
+  if (index->crawling) {
+    index->crawling = false;
+    file_list_reset(index->lists + 1 - index->current);
+  }
+  index->ranked_list = NULL;
+}
+
+// NOTE: the list the picker shows, the one being crawled until there is a
+// complete one. An empty one while the saved list is read
+FileList *file_index_list(FileIndex *index) {
+  FileList *list = index->lists + index->current;
+  if (index->loading || (list->file_count == 0 && index->crawling)) {
+    list = index->lists + 1 - index->current;
+  }
+  return list;
+}
+
+// NOTE: the best PICKER_RESULT_COUNT files for query go to results. The
+// masks are checked first in a branchless pass over a flat array, only the
+// files that have every character of the query are scored. While the query
+// only grows the files that matched the last one are the only candidates
+void file_index_rank(FileIndex *index, char *query, int32_t query_len) {
+  FileList *list = file_index_list(index);
+  char lower[GREP_PATTERN_SIZE];
+  if (query_len >= GREP_PATTERN_SIZE) {
+    query_len = GREP_PATTERN_SIZE - 1;
+  }
+  for (int32_t i = 0; i < query_len; ++i) {
+    lower[i] = fuzzy_lower(query[i]);
+  }
+  bool same_list = list == index->ranked_list &&
+                   list->file_count == index->ranked_file_count;
+  bool narrow = same_list && index->query_len <= query_len &&
+                memcmp(index->query, lower, index->query_len) == 0;
+  if (narrow && index->query_len == query_len) {
+    return;
+  }
+
+  uint64_t query_mask = fuzzy_mask(lower, query_len);
+  int32_t count = 0;
+  if (narrow) {
+    for (int32_t i = 0; i < index->survivor_count; ++i) {
+      int32_t file = index->survivors[i];
+      index->survivors[count] = file;
+      count += (list->masks[file] & query_mask) == query_mask;
+    }
+  } else {
+    if (list != index->ranked_list ||
+        list->file_count > index->survivor_size) {
+      // NOTE: doubled so a list that grows while it is crawled doesn't need
+      // a new one every frame
+      int32_t size = list == index->ranked_list ? index->survivor_size * 2 : 0;
+      size = size > list->file_count ? size : list->file_count;
+      index->survivors = NULL;
+      index->survivor_size = 0;
+      if (file_list_fits(list, size * sizeof(int32_t))) {
+        index->survivors =
+            pushArray(&list->arena, size, int32_t, DEFAULT_ALIGNMENT);
+        index->survivor_size = size;
+      }
+    }
+    for (int32_t i = 0; index->survivors != NULL && i < list->file_count;
+         ++i) {
+      index->survivors[count] = i;
+      count += (list->masks[i] & query_mask) == query_mask;
+    }
+  }
+
+  int32_t scores[PICKER_RESULT_COUNT];
+  int32_t kept = 0;
+  index->result_count = 0;
+  for (int32_t i = 0; i < count; ++i) {
+    int32_t file = index->survivors[i];
+    int32_t score = fuzzy_score(list->files[file], lower, query_len);
+    if (score < 0) {
+      continue;
+    }
+    index->survivors[kept++] = file;
+    int32_t at = index->result_count;
+    while (at > 0 && scores[at - 1] < score) {
+      at--;
+    }
+    if (at == PICKER_RESULT_COUNT) {
+      continue;
+    }
+    int32_t last = index->result_count < PICKER_RESULT_COUNT
+                       ? index->result_count++
+                       : PICKER_RESULT_COUNT - 1;
+    for (int32_t j = last; j > at; --j) {
+      scores[j] = scores[j - 1];
+      index->results[j] = index->results[j - 1];
+    }
+    scores[at] = score;
+    index->results[at] = file;
+  }
+
+  charcpy(index->query, lower, query_len);
+  index->query_len = query_len;
+  index->survivor_count = kept;
+  index->ranked_list = index->survivors != NULL ? list : NULL;
+  index->ranked_file_count = list->file_count;
+  index->selected = 0;
+}
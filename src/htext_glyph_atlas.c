@@ -0,0 +1,231 @@
+#include "htext_app.h"
+#include "htext_sdl.h"
+#include <errno.h>
+#include <sys/mman.h>
+
+// NOTE: FNV-1a over the whole font file, 0 when it can't be read
+static uint64_t file_hash(char *path) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0 || file_stat.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  uint8_t *data = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return 0;
+  }
+
+  uint64_t hash = hash_bytes(HASH_SEED, data, file_stat.st_size);
+  munmap(data, file_stat.st_size);
+  return hash;
+}
+
+// NOTE: $XDG_CACHE_HOME/htext or ~/.cache/htext, created on demand
+static bool glyph_atlas_cache_path(char *dest, size_t dest_size,
+                                   GlyphAtlasFileHeader *header) {
+  char dir[FILENAME_SIZE];
+  char *cache_home = getenv("XDG_CACHE_HOME");
+  char *home = getenv("HOME");
+  if (cache_home != NULL && cache_home[0] != '\0') {
+    snprintf(dir, sizeof(dir), "%s/htext", cache_home);
+  } else if (home != NULL && home[0] != '\0') {
+    snprintf(dir, sizeof(dir), "%s/.cache", home);
+    mkdir(dir, 0755);
+    snprintf(dir, sizeof(dir), "%s/.cache/htext", home);
+  } else {
+    return false;
+  }
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    return false;
+  }
+  snprintf(dest, dest_size, "%s/atlas-%016llx-%d-%d", dir,
+           (unsigned long long)header->font_hash, header->font_size,
+           header->font_style);
+  return true;
+}
+
+// NOTE: the file is trusted only as far as its size goes, the pixels have to
+// fill it exactly and every glyph has to be inside them
+static bool glyph_atlas_header_valid(GlyphAtlasFileHeader *header,
+                                     off_t file_size) {
+  if (header->w <= 0 || header->h <= 0 ||
+      (int64_t)header->w * header->h * 4 !=
+          file_size - (int64_t)sizeof(*header)) {
+    return false;
+  }
+  for (int32_t i = 0; i < GLYPH_COUNT; ++i) {
+    SDL_Rect *glyph = header->glyphs + i;
+    if (glyph->x < 0 || glyph->y < 0 || glyph->w < 0 || glyph->h < 0 ||
+        glyph->x > header->w - glyph->w || glyph->y > header->h - glyph->h) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static SDL_Surface *glyph_atlas_load(GlyphAtlasFileHeader *header,
+                                     char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    return NULL;
+  }
+
+  GlyphAtlasFileHeader file_header;
+  struct stat file_stat;
+  bool ok = fstat(fileno(f), &file_stat) == 0 &&
+            fread(&file_header, sizeof(file_header), 1, f) == 1 &&
+            file_header.magic == GLYPH_ATLAS_MAGIC &&
+            file_header.font_hash == header->font_hash &&
+            file_header.font_size == header->font_size &&
+            file_header.font_style == header->font_style &&
+            glyph_atlas_header_valid(&file_header, file_stat.st_size);
+  SDL_Surface *surface = NULL;
+  if (ok) {
+    surface = SDL_cpointer(SDL_CreateRGBSurfaceWithFormat(
+        0, file_header.w, file_header.h, 32, SDL_PIXELFORMAT_ARGB8888));
+    for (int32_t y = 0; ok && y < file_header.h; ++y) {
+      ok = fread((uint8_t *)surface->pixels + y * surface->pitch,
+                 file_header.w * 4, 1, f) == 1;
+    }
+  }
+  fclose(f);
+
+  if (ok) {
+    *header = file_header;
+  } else if (surface != NULL) {
+    SDL_FreeSurface(surface);
+    surface = NULL;
+  }
+  return surface;
+}
+
+// NOTE: glyphs are rendered white in a single row, the color is applied with a
+// color mod when drawing
+static SDL_Surface *glyph_atlas_rasterize(TTF_Font *font,
+                                          GlyphAtlasFileHeader *header,
+                                          char *cache_path) {
+  SDL_Color white = {255, 255, 255, 255};
+  SDL_Surface *glyphs[GLYPH_COUNT];
+  int32_t w = 0;
+  int32_t h = TTF_FontHeight(font);
+  for (int32_t i = 0; i < GLYPH_COUNT; ++i) {
+    glyphs[i] =
+        TTF_cpointer(TTF_RenderGlyph_Blended(font, ASCII_LOW + i, white));
+    header->glyphs[i] = (SDL_Rect){.x = w, .y = 0, .w = glyphs[i]->w, .h = h};
+    w += glyphs[i]->w;
+    int advance = glyphs[i]->w;
+    TTF_GlyphMetrics(font, ASCII_LOW + i, NULL, NULL, NULL, NULL, &advance);
+    header->advances[i] = advance;
+  }
+  header->w = w;
+  header->h = h;
+
+  SDL_Surface *surface = SDL_cpointer(
+      SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888));
+  for (int32_t i = 0; i < GLYPH_COUNT; ++i) {
+    SDL_Rect dest = header->glyphs[i];
+    SDL_SetSurfaceBlendMode(glyphs[i], SDL_BLENDMODE_NONE);
+    SDL_BlitSurface(glyphs[i], NULL, surface, &dest);
+    SDL_FreeSurface(glyphs[i]);
+  }
+
+  if (cache_path != NULL) {
+    FILE *f = fopen(cache_path, "w");
+    if (f) {
+      bool ok = fwrite(header, sizeof(*header), 1, f) == 1;
+      for (int32_t y = 0; ok && y < h; ++y) {
+        ok = fwrite((uint8_t *)surface->pixels + y * surface->pitch, w * 4, 1,
+                    f) == 1;
+      }
+      if (fclose(f) != 0 || !ok) {
+        remove(cache_path);
+      }
+    }
+  }
+  return surface;
+}
+
+// NOTE: the atlas pixels and the metrics of every printable glyph in header,
+// from the disk cache when the font didn't change. Doesn't touch the
+// renderer so it can run on a worker with a font of its own
+SDL_Surface *glyph_atlas_surface(TTF_Font *font, char *font_path,
+                                 int32_t font_size,
+                                 GlyphAtlasFileHeader *header, bool *cached) {
+  *header = (GlyphAtlasFileHeader){.magic = GLYPH_ATLAS_MAGIC,
+                                   .font_hash = file_hash(font_path),
+                                   .font_size = font_size,
+                                   .font_style = TTF_GetFontStyle(font)};
+  char cache_path[FILENAME_SIZE + 64];
+  bool has_cache_path =
+      header->font_hash != 0 &&
+      glyph_atlas_cache_path(cache_path, sizeof(cache_path), header);
+
+  SDL_Surface *surface =
+      has_cache_path ? glyph_atlas_load(header, cache_path) : NULL;
+  *cached = surface != NULL;
+  if (surface == NULL) {
+    surface = glyph_atlas_rasterize(font, header,
+                                    has_cache_path ? cache_path : NULL);
+  }
+  return surface;
+}
+
+// NOTE: the texture of a surface from glyph_atlas_surface, which is freed.
+// Fills advances with the advance of every printable glyph
+void glyph_atlas_from_surface(GlyphAtlas *atlas, SDL_Renderer *renderer,
+                              SDL_Surface *surface,
+                              GlyphAtlasFileHeader *header,
+                              int32_t advances[GLYPH_COUNT]) {
+  atlas->texture =
+      SDL_cpointer(SDL_CreateTextureFromSurface(renderer, surface));
+  SDL_FreeSurface(surface);
+  SDL_SetTextureBlendMode(atlas->texture, SDL_BLENDMODE_BLEND);
+  atlas->h = header->h;
+  for (int32_t i = 0; i < GLYPH_COUNT; ++i) {
+    atlas->glyphs[i] = header->glyphs[i];
+    advances[i] = header->advances[i];
+  }
+}
+
+// NOTE: both steps at once on the main thread. Returns true on a cache hit
+bool glyph_atlas_create(GlyphAtlas *atlas, SDL_Renderer *renderer,
+                        TTF_Font *font, char *font_path, int32_t font_size,
+                        int32_t advances[GLYPH_COUNT]) {
+  GlyphAtlasFileHeader header;
+  bool cached;
+  SDL_Surface *surface =
+      glyph_atlas_surface(font, font_path, font_size, &header, &cached);
+  glyph_atlas_from_surface(atlas, renderer, surface, &header, advances);
+  return cached;
+}
+
+void glyph_atlas_destroy(GlyphAtlas *atlas) {
+  if (atlas->texture != NULL) {
+    SDL_DestroyTexture(atlas->texture);
+    atlas->texture = NULL;
+  }
+}
+
+// NOTE: draws text straight from the atlas, no texture per string. Returns
+// the width drawn
+int32_t glyph_atlas_render_text(SDL_Renderer *renderer, GlyphAtlas *atlas,
+                                char *text, int32_t x, int32_t y,
+                                SDL_Color color) {
+  SDL_SetTextureColorMod(atlas->texture, color.r, color.g, color.b);
+  int32_t start_x = x;
+  for (char *c = text; *c != '\0'; ++c) {
+    if (*c < ASCII_LOW || *c > ASCII_HIGH) {
+      continue;
+    }
+    SDL_Rect src = atlas->glyphs[*c - ASCII_LOW];
+    SDL_Rect dest = {.x = x, .y = y, .w = src.w, .h = src.h};
+    SDL_RenderCopy(renderer, atlas->texture, &src, &dest);
+    x += src.w;
+  }
+  return x - start_x;
+}
@@ -0,0 +1,503 @@
+#include "htext_app.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+GrepSearch *grep_search_create(MemoryArena *arena, memory_index size) {
+  GrepSearch *search = pushStruct(arena, GrepSearch, DEFAULT_ALIGNMENT);
+  memset(search, 0, sizeof(*search));
+  sub_arena(&search->arena, arena, size, ARENA_COMMIT_SIZE);
+  for (int32_t i = 0; i < GREP_JOB_COUNT; ++i) {
+    search->jobs[i].search = search;
+  }
+  search->current = -1;
+  return search;
+}
+
+// NOTE: the candidates are the positions where both the first and the last
+// byte of the pattern are, 16 of them are checked at a time
+static char *grep_find(char *text, int64_t size, char *pattern,
+                       int32_t pattern_len) {
+  int64_t last = size - pattern_len;
+  int64_t i = 0;
+#if defined(__SSE2__)
+  __m128i first_byte = _mm_set1_epi8(pattern[0]);
+  __m128i last_byte = _mm_set1_epi8(pattern[pattern_len - 1]);
+  for (; i + 15 <= last; i += 16) {
+    __m128i first = _mm_loadu_si128((__m128i *)(text + i));
+    __m128i end = _mm_loadu_si128((__m128i *)(text + i + pattern_len - 1));
+    uint32_t mask = _mm_movemask_epi8(_mm_and_si128(
+        _mm_cmpeq_epi8(first, first_byte), _mm_cmpeq_epi8(end, last_byte)));
+    while (mask != 0) {
+      char *candidate = text + i + __builtin_ctz(mask);
+      if (memcmp(candidate, pattern, pattern_len) == 0) {
+        return candidate;
+      }
+      mask &= mask - 1;
+    }
+  }
+#endif
+  while (i <= last) {
+    char *candidate = memchr(text + i, pattern[0], last - i + 1);
+    if (candidate == NULL) {
+      return NULL;
+    }
+    if (memcmp(candidate, pattern, pattern_len) == 0) {
+      return candidate;
+    }
+    i = candidate - text + 1;
+  }
+  return NULL;
+}
+
+static bool grep_job_cancelled(GrepJob *job) {
+  return __atomic_load_n(&job->search->generation, __ATOMIC_RELAXED) !=
+         job->generation;
+}
+
+static void grep_job_write(GrepJob *job, void *data, int32_t size) {
+  charcpy((char *)job->output + job->output_size, data, size);
+  job->output_size += size;
+}
+
+// NOTE: appends a [kind][u16 length][name] record for every directory and
+// regular file in path, from *resume. Returns true when the output filled up
+// first, *resume is then where to go on from. Symbolic links aren't followed,
+// one to a parent directory would never end
+static bool directory_read(char *path, int64_t *resume, uint8_t *output,
+                           int32_t *output_size) {
+  DIR *dir = opendir(path);
+  if (dir == NULL) {
+    return false;
+  }
+  if (*resume != 0) {
+    seekdir(dir, *resume);
+  }
+  bool more = false;
+  for (;;) {
+    long position = telldir(dir);
+    struct dirent *entry = readdir(dir);
+    if (entry == NULL) {
+      break;
+    }
+    char *name = entry->d_name;
+    if (strcmp(name, ".") == 0 || strcmp(name, "..") == 0) {
+      continue;
+    }
+    unsigned char type = entry->d_type;
+    struct stat st;
+    if (type == DT_UNKNOWN &&
+        fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+      type = S_ISDIR(st.st_mode) ? DT_DIR
+             : S_ISREG(st.st_mode) ? DT_REG
+                                   : DT_UNKNOWN;
+    }
+    if (type != DT_DIR && type != DT_REG) {
+      continue;
+    }
+    uint16_t len = strlen(name);
+    if (*output_size + 3 + len > GREP_JOB_OUTPUT_SIZE) {
+      *resume = position;
+      more = true;
+      break;
+    }
+    output[*output_size] = type == DT_DIR ? PathKind_directory
+                                          : PathKind_file;
+    memcpy(output + *output_size + 1, &len, 2);
+    charcpy((char *)output + *output_size + 3, name, len);
+    *output_size += 3 + len;
+  }
+  closedir(dir);
+  return more;
+}
+
+// NOTE: path joined with a name from a directory record, NULL when it is too
+// long or the arena is full. Children of "." are relative like the paths
+// given to it
+static char *directory_join(MemoryArena *arena, char *path, char *name,
+                            uint16_t name_len) {
+  bool current_dir = strcmp(path, ".") == 0;
+  size_t dir_len = current_dir ? 0 : strlen(path);
+  bool separator = dir_len > 0 && path[dir_len - 1] != '/';
+  size_t path_len = dir_len + separator + name_len;
+  if (path_len >= GREP_PATH_SIZE) {
+    return NULL;
+  }
+  char *result = pushSize(arena, path_len + 1, 1);
+  if (result == NULL) {
+    return NULL;
+  }
+  charcpy(result, path, dir_len);
+  if (separator) {
+    result[dir_len] = '/';
+  }
+  charcpy(result + dir_len + separator, name, name_len);
+  result[path_len] = '\0';
+  return result;
+}
+
+// NOTE: the lines from *counted to until, *line_start is the offset of the
+// line *counted is in
+static void grep_count_lines(char *data, char **counted, char *until,
+                             int32_t *line_num, int64_t *line_start) {
+  char *new_line;
+  while ((new_line = memchr(*counted, '\n', until - *counted)) != NULL) {
+    (*line_num)++;
+    *counted = new_line + 1;
+    *line_start = *counted - data;
+  }
+  *counted = until;
+}
+
+// NOTE: records are [line][column][u16 preview length][preview], one per line
+// that has a match. The file is mapped, the matcher runs over the page cache
+static void grep_file_run(GrepJob *job) {
+  int fd = open(job->path, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < job->pattern_len) {
+    close(fd);
+    return;
+  }
+  int64_t size = st.st_size;
+  char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) {
+    return;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  int64_t check_size =
+      size < GREP_BINARY_CHECK_SIZE ? size : GREP_BINARY_CHECK_SIZE;
+  if (job->resume == 0 && memchr(data, '\0', check_size) != NULL) {
+    munmap(data, size);
+    return;
+  }
+
+  int32_t pattern_len = job->pattern_len;
+  int64_t line_start = job->resume;
+  int32_t line_num = job->resume_line;
+  char *counted = data + line_start;
+  int64_t position = job->resume;
+  while (position < size && !grep_job_cancelled(job)) {
+    int64_t window = size - position;
+    if (window > GREP_SCAN_CHUNK_SIZE + pattern_len - 1) {
+      window = GREP_SCAN_CHUNK_SIZE + pattern_len - 1;
+    }
+    char *match = grep_find(data + position, window, job->pattern,
+                            pattern_len);
+    if (match == NULL) {
+      if (position + window == size) {
+        break;
+      }
+      position += GREP_SCAN_CHUNK_SIZE;
+      grep_count_lines(data, &counted, data + position, &line_num,
+                       &line_start);
+      continue;
+    }
+
+    grep_count_lines(data, &counted, match, &line_num, &line_start);
+    char *line_end = memchr(match, '\n', data + size - match);
+    int64_t end = line_end != NULL ? line_end - data : size;
+    uint16_t preview_len = end - line_start < GREP_PREVIEW_SIZE
+                               ? end - line_start
+                               : GREP_PREVIEW_SIZE;
+    if (job->output_size + 10 + preview_len > GREP_JOB_OUTPUT_SIZE) {
+      job->resume = line_start;
+      job->resume_line = line_num;
+      job->more = true;
+      break;
+    }
+    int64_t column64 = match - data - line_start;
+    int32_t column = column64 < INT32_MAX ? column64 : INT32_MAX;
+    grep_job_write(job, &line_num, 4);
+    grep_job_write(job, &column, 4);
+    grep_job_write(job, &preview_len, 2);
+    grep_job_write(job, data + line_start, preview_len);
+
+    position = end + 1;
+    if (position < size) {
+      counted = data + position;
+      line_start = position;
+      line_num++;
+    }
+  }
+  munmap(data, size);
+}
+
+static PLATFORM_WORK_QUEUE_CALLBACK(grep_job_run) {
+  (void)queue;
+  GrepJob *job = data;
+  job->output_size = 0;
+  job->more = false;
+  if (job->kind == PathKind_directory) {
+    job->more = directory_read(job->path, &job->resume, job->output,
+                               &job->output_size);
+  } else {
+    grep_file_run(job);
+  }
+  __atomic_store_n(&job->state, GrepJob_done, __ATOMIC_RELEASE);
+}
+
+// NOTE: the arrays double like the frame index, the old copies stay in the
+// arena until the next search. NULL when the arena is full, *size is kept
+static void *grep_grow(MemoryArena *arena, void *items, int32_t count,
+                       int32_t *size, size_t item_size) {
+  int32_t new_size = *size == 0 ? 64 : *size * 2;
+  void *result = pushSize(arena, new_size * item_size, DEFAULT_ALIGNMENT);
+  if (result == NULL) {
+    return NULL;
+  }
+  if (count > 0) {
+    charcpy(result, items, count * item_size);
+  }
+  *size = new_size;
+  return result;
+}
+
+// NOTE: room for size bytes and for the arrays to double once more
+static bool grep_fits(GrepSearch *search, memory_index size) {
+  memory_index growth = (memory_index)search->pending_size * sizeof(GrepPath) +
+                        search->file_size * sizeof(char *) +
+                        search->match_size * sizeof(GrepMatch);
+  return search->arena.used + size + 2 * growth + Kilobytes(4) <=
+         search->arena.size;
+}
+
+// NOTE: a path that didn't fit in the arena, NULL, is dropped and the search
+// is incomplete
+static void grep_pending_push(GrepSearch *search, char *path, int8_t kind) {
+  if (path == NULL) {
+    search->incomplete = true;
+    return;
+  }
+  if (search->pending_head + search->pending_count == search->pending_size) {
+    if (search->pending_head > 0 &&
+        search->pending_head >= search->pending_size / 2) {
+      memmove(search->pending, search->pending + search->pending_head,
+              search->pending_count * sizeof(GrepPath));
+    } else {
+      GrepPath *pending =
+          grep_grow(&search->arena, search->pending + search->pending_head,
+                    search->pending_count, &search->pending_size,
+                    sizeof(GrepPath));
+      if (pending == NULL) {
+        search->incomplete = true;
+        return;
+      }
+      search->pending = pending;
+    }
+    search->pending_head = 0;
+  }
+  search->pending[search->pending_head + search->pending_count++] =
+      (GrepPath){.path = path, .kind = kind};
+}
+
+// NOTE: `path:line:column: text` in text, which has room for GREP_PATH_SIZE +
+// GREP_PREVIEW_SIZE + 32 bytes. File names and previews can have any byte
+// but a line can't, the others show as '?'. Returns the size
+int32_t grep_match_format(GrepSearch *search, GrepMatch *match, char *text) {
+  int32_t size = sprintf(text, "%s:%d:%d: ", search->files[match->file],
+                         match->line_num, match->column);
+  charcpy(text + size, match->preview, match->preview_len);
+  size += match->preview_len;
+  for (int32_t i = 0; i < size; ++i) {
+    if (text[i] < ASCII_LOW || text[i] > ASCII_HIGH) {
+      text[i] = '?';
+    }
+  }
+  return size;
+}
+
+void grep_search_cancel(GrepSearch *search) {
+  __atomic_add_fetch(&search->generation, 1, __ATOMIC_RELAXED);
+  search->running = false;
+  search->pending_count = 0;
+}
+
+// NOTE: a search that was running is dropped, its jobs finish on their own
+// and what they found is ignored
+void grep_search_start(GrepSearch *search, char *pattern, int32_t pattern_len,
+                       char *dir) {
+  assert(pattern_len > 0 && pattern_len < GREP_PATTERN_SIZE);
+  grep_search_cancel(search);
+  search->arena.used = 0;
+  releaseArena(&search->arena);
+  charcpy(search->pattern, pattern, pattern_len);
+  search->pattern[pattern_len] = '\0';
+  search->pattern_len = pattern_len;
+  search->pending = NULL;
+  search->pending_head = 0;
+  search->pending_size = 0;
+  search->files = NULL;
+  search->file_count = 0;
+  search->file_size = 0;
+  search->matches = NULL;
+  search->match_count = 0;
+  search->match_size = 0;
+  search->files_searched = 0;
+  search->incomplete = false;
+  search->current = -1;
+  search->running = true;
+  grep_pending_push(search, push_string(&search->arena, dir),
+                    PathKind_directory);
+}
+
+static void grep_collect_directory(GrepSearch *search, GrepJob *job) {
+  uint8_t *record = job->output;
+  uint8_t *end = job->output + job->output_size;
+  while (record < end) {
+    uint8_t kind = record[0];
+    uint16_t len;
+    memcpy(&len, record + 1, 2);
+    char *name = (char *)record + 3;
+    record += 3 + len;
+    if (!grep_fits(search, strlen(job->path) + len + 2)) {
+      search->incomplete = true;
+      return;
+    }
+    char *path = directory_join(&search->arena, job->path, name, len);
+    if (path != NULL) {
+      grep_pending_push(search, path, kind);
+    }
+  }
+}
+
+static void grep_collect_file(GrepSearch *search, GrepJob *job) {
+  uint8_t *record = job->output;
+  uint8_t *end = job->output + job->output_size;
+  while (record < end) {
+    GrepMatch match;
+    uint16_t preview_len;
+    memcpy(&match.line_num, record, 4);
+    memcpy(&match.column, record + 4, 4);
+    memcpy(&preview_len, record + 8, 2);
+    char *preview = (char *)record + 10;
+    record += 10 + preview_len;
+
+    int32_t path_len = job->file < 0 ? strlen(job->path) : 0;
+    if (!grep_fits(search, path_len + 1 + preview_len)) {
+      search->incomplete = true;
+      return;
+    }
+    // NOTE: a match the arena can't hold is dropped with the rest of the
+    // file
+    if (job->file < 0) {
+      if (search->file_count == search->file_size) {
+        char **files =
+            grep_grow(&search->arena, search->files, search->file_count,
+                      &search->file_size, sizeof(char *));
+        if (files == NULL) {
+          search->incomplete = true;
+          return;
+        }
+        search->files = files;
+      }
+      char *path = push_string(&search->arena, job->path);
+      if (path == NULL) {
+        search->incomplete = true;
+        return;
+      }
+      job->file = search->file_count++;
+      search->files[job->file] = path;
+    }
+    if (search->match_count == search->match_size) {
+      GrepMatch *matches =
+          grep_grow(&search->arena, search->matches, search->match_count,
+                    &search->match_size, sizeof(GrepMatch));
+      if (matches == NULL) {
+        search->incomplete = true;
+        return;
+      }
+      search->matches = matches;
+    }
+    match.file = job->file;
+    match.preview_len = preview_len;
+    match.preview = pushSize(&search->arena, preview_len, 1);
+    if (match.preview == NULL) {
+      search->incomplete = true;
+      return;
+    }
+    charcpy(match.preview, preview, preview_len);
+    search->matches[search->match_count++] = match;
+  }
+}
+
+static void grep_job_issue(GrepJob *job, Memory *memory) {
+  job->state = GrepJob_queued;
+  if (memory->background_queue != NULL) {
+    memory->add_work_entry(memory->background_queue, grep_job_run, job);
+  } else {
+    grep_job_run(NULL, job);
+  }
+}
+
+// NOTE: called once a frame, takes what the workers found and hands them the
+// next paths. Without a queue (tests) the jobs run here. Returns true when
+// the counts changed or the search ended
+bool grep_search_step(GrepSearch *search, Memory *memory) {
+  if (!search->running) {
+    return false;
+  }
+  int32_t match_count = search->match_count;
+  int32_t files_searched = search->files_searched;
+  for (int32_t i = 0; i < GREP_JOB_COUNT; ++i) {
+    GrepJob *job = search->jobs + i;
+    if (__atomic_load_n(&job->state, __ATOMIC_ACQUIRE) != GrepJob_done) {
+      continue;
+    }
+    if (job->generation == search->generation) {
+      if (job->kind == PathKind_directory) {
+        grep_collect_directory(search, job);
+      } else {
+        grep_collect_file(search, job);
+      }
+      if (search->incomplete) {
+        grep_search_cancel(search);
+      } else if (job->more) {
+        grep_job_issue(job, memory);
+        continue;
+      } else if (job->kind == PathKind_file) {
+        search->files_searched++;
+      }
+    }
+    job->state = GrepJob_free;
+  }
+
+  bool busy = false;
+  for (int32_t i = 0; i < GREP_JOB_COUNT; ++i) {
+    GrepJob *job = search->jobs + i;
+    if (job->state == GrepJob_free && search->pending_count > 0) {
+      GrepPath pending = search->pending[search->pending_head++];
+      search->pending_count--;
+      job->generation = search->generation;
+      job->kind = pending.kind;
+      job->resume = 0;
+      job->resume_line = 0;
+      job->file = -1;
+      charcpy(job->pattern, search->pattern, search->pattern_len);
+      job->pattern_len = search->pattern_len;
+      strcpy(job->path, pending.path);
+      grep_job_issue(job, memory);
+    }
+    busy = busy || job->state != GrepJob_free;
+  }
+  if (!busy && search->pending_count == 0) {
+    search->running = false;
+  }
+  return !search->running || match_count != search->match_count ||
+         files_searched != search->files_searched;
+}
+
+// NOTE: the jobs of a snapshot belonged to the threads of the process that
+// wrote it, what was found so far is kept
+void grep_search_restore(GrepSearch *search) {
+  for (int32_t i = 0; i < GREP_JOB_COUNT; ++i) {
+    search->jobs[i].state = GrepJob_free;
+  }
+  if (search->running) {
+    grep_search_cancel(search);
+    search->incomplete = true;
+  }
+}
@@ -0,0 +1,125 @@
+#include "htext_app.h"
+#include <errno.h>
+
+Journal *journal_create(MemoryArena *arena, int fd) {
+  Journal *journal = pushStruct(arena, Journal, DEFAULT_ALIGNMENT);
+  journal->fd = fd;
+  journal->buffer = pushSize(arena, JOURNAL_BUFFER_SIZE, DEFAULT_ALIGNMENT);
+  journal->size = 0;
+  journal->suspended = 0;
+  return journal;
+}
+
+static void journal_write(Journal *journal, void *data, size_t size) {
+  uint8_t *bytes = data;
+  while (size > 0) {
+    ssize_t written = write(journal->fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // NOTE: losing the journal must not take the editor down
+      printf("journal write failed %s\n", strerror(errno));
+      return;
+    }
+    bytes += written;
+    size -= written;
+  }
+}
+
+// NOTE: hands the buffered records to the kernel, durability is up to the
+// platform sync thread. Returns true when something was written
+bool journal_flush(Journal *journal) {
+  if (journal->size == 0) {
+    return false;
+  }
+  journal_write(journal, journal->buffer, journal->size);
+  journal->size = 0;
+  return true;
+}
+
+static void journal_append(Journal *journal, void *data, int32_t size) {
+  if (journal->size + size > JOURNAL_BUFFER_SIZE) {
+    journal_flush(journal);
+  }
+  if (size > JOURNAL_BUFFER_SIZE) {
+    journal_write(journal, data, size);
+  } else {
+    charcpy(journal->buffer + journal->size, data, size);
+    journal->size += size;
+  }
+}
+
+// NOTE: everything recorded so far is covered by a new starting point
+static void journal_reset(Journal *journal) {
+  journal->size = 0;
+  if (ftruncate(journal->fd, 0) != 0) {
+    printf("journal truncate failed %s\n", strerror(errno));
+  }
+}
+
+static void journal_record_at(Journal *journal, int32_t op, int32_t line_num,
+                              int32_t column, char *payload, int32_t size) {
+  JournalRecord record = {
+      .op = op, .line_num = line_num, .column = column, .size = size};
+  journal_append(journal, &record, sizeof(record));
+  if (size > 0) {
+    journal_append(journal, payload, size);
+  }
+}
+
+static void journal_record(EditorFrame *frame, int32_t op, int32_t arg0,
+                           int32_t arg1, int32_t arg2, int32_t arg3,
+                           char *payload, int32_t size) {
+  Journal *journal = frame->journal;
+  if (journal == NULL || journal->suspended > 0) {
+    return;
+  }
+  JournalRecord record = {.op = op,
+                          .line_num = frame->cursor.line_num,
+                          .column = frame->cursor.column,
+                          .args = {arg0, arg1, arg2, arg3},
+                          .size = size};
+  journal_append(journal, &record, sizeof(record));
+  if (size > 0) {
+    journal_append(journal, payload, size);
+  }
+}
+
+static void journal_suspend(EditorFrame *frame) {
+  if (frame->journal != NULL) {
+    frame->journal->suspended++;
+  }
+}
+
+static void journal_resume(EditorFrame *frame) {
+  if (frame->journal != NULL) {
+    assert(frame->journal->suspended > 0);
+    frame->journal->suspended--;
+  }
+}
+
+// NOTE: the payload is the text of every span followed by a new line
+static void journal_record_spans(EditorFrame *frame, int32_t op,
+                                 int32_t arg0, int32_t arg1, LineSpan *spans,
+                                 int32_t count) {
+  Journal *journal = frame->journal;
+  if (journal == NULL || journal->suspended > 0) {
+    return;
+  }
+  int64_t size = 0;
+  for (int32_t i = 0; i < count; ++i) {
+    size += spans[i].len + 1;
+  }
+  assert(size < INT32_MAX);
+  JournalRecord record = {.op = op,
+                          .line_num = frame->cursor.line_num,
+                          .column = frame->cursor.column,
+                          .args = {arg0, arg1, 0, 0},
+                          .size = size};
+  journal_append(journal, &record, sizeof(record));
+  for (int32_t i = 0; i < count; ++i) {
+    journal_append(journal, spans[i].text, spans[i].len);
+    journal_append(journal, "\n", 1);
+  }
+}
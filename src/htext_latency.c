@@ -0,0 +1,65 @@
+#include "htext_app.h"
+
+static int32_t latency_bucket(uint32_t value) {
+  if (value < LATENCY_SUB_BUCKETS) {
+    return value;
+  }
+  int32_t exponent = 31 - __builtin_clz(value);
+  int32_t shift = exponent - (LATENCY_SUB_BUCKET_BITS - 1);
+  return LATENCY_SUB_BUCKETS +
+         (exponent - LATENCY_SUB_BUCKET_BITS) * (LATENCY_SUB_BUCKETS / 2) +
+         (value >> shift) - LATENCY_SUB_BUCKETS / 2;
+}
+
+// NOTE: the highest value counted in bucket
+static uint32_t latency_bucket_max(int32_t bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS) {
+    return bucket;
+  }
+  int32_t i = bucket - LATENCY_SUB_BUCKETS;
+  int32_t exponent = i / (LATENCY_SUB_BUCKETS / 2) + LATENCY_SUB_BUCKET_BITS;
+  int32_t shift = exponent - (LATENCY_SUB_BUCKET_BITS - 1);
+  uint64_t sub = i % (LATENCY_SUB_BUCKETS / 2) + LATENCY_SUB_BUCKETS / 2;
+  return ((sub + 1) << shift) - 1;
+}
+
+void latency_record(LatencyHistogram *histogram, uint32_t value) {
+  histogram->counts[latency_bucket(value)]++;
+  histogram->total++;
+  if (value > histogram->max) {
+    histogram->max = value;
+  }
+}
+
+// NOTE: the value percentile (0 to 1) of the samples are at or below, up to
+// the width of its bucket
+uint32_t latency_percentile(LatencyHistogram *histogram, real64 percentile) {
+  if (histogram->total == 0) {
+    return 0;
+  }
+  uint64_t target = (uint64_t)(percentile * histogram->total + 0.5);
+  if (target < 1) {
+    target = 1;
+  }
+  uint64_t seen = 0;
+  for (int32_t i = 0; i < LATENCY_BUCKET_COUNT; ++i) {
+    seen += histogram->counts[i];
+    if (seen >= target) {
+      uint32_t value = latency_bucket_max(i);
+      return value < histogram->max ? value : histogram->max;
+    }
+  }
+  return histogram->max;
+}
+
+// NOTE: snprintf semantics, the text is cut to fit size bytes
+int latency_format(char *dest, size_t size, char *name,
+                   LatencyHistogram *histogram) {
+  if (histogram->total == 0) {
+    return snprintf(dest, size, "%s -", name);
+  }
+  return snprintf(dest, size, "%s p50 %u p99 %u max %ums n %u", name,
+                  latency_percentile(histogram, 0.5),
+                  latency_percentile(histogram, 0.99), histogram->max,
+                  histogram->total);
+}
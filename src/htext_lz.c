@@ -0,0 +1,145 @@
+#include "htext_app.h"
+
+// NOTE: a small LZ77 codec for cold line texts. The data is a list of
+// sequences: a token, literals, and a match copied from up to 64KB back. The
+// high nibble of the token is the literal count and the low one the match
+// length minus LZ_MIN_MATCH, 15 means more follows as bytes of 255 ended by a
+// smaller one. The last sequence has literals only
+#define LZ_MIN_MATCH 4
+#define LZ_MAX_OFFSET 65535
+#define LZ_HASH_BITS 12
+
+static uint32_t lz_read32(uint8_t *bytes) {
+  uint32_t value;
+  memcpy(&value, bytes, sizeof(value));
+  return value;
+}
+
+static uint8_t *lz_put_length(uint8_t *out, int32_t length) {
+  while (length >= 255) {
+    *out++ = 255;
+    length -= 255;
+  }
+  *out++ = length;
+  return out;
+}
+
+static uint8_t *lz_put_sequence(uint8_t *out, uint8_t *literals,
+                                int32_t literal_count, int32_t offset,
+                                int32_t match) {
+  int32_t match_code = match - LZ_MIN_MATCH;
+  uint8_t *token = out++;
+  *token = (literal_count < 15 ? literal_count : 15) << 4;
+  if (literal_count >= 15) {
+    out = lz_put_length(out, literal_count - 15);
+  }
+  charcpy((char *)out, (char *)literals, literal_count);
+  out += literal_count;
+  if (match > 0) {
+    *token |= match_code < 15 ? match_code : 15;
+    *out++ = offset & 0xFF;
+    *out++ = offset >> 8;
+    if (match_code >= 15) {
+      out = lz_put_length(out, match_code - 15);
+    }
+  }
+  return out;
+}
+
+// NOTE: returns the compressed size, or -1 when it doesn't fit in capacity
+int32_t lz_compress(uint8_t *src, int32_t size, uint8_t *dst,
+                    int32_t capacity) {
+  int32_t table[1 << LZ_HASH_BITS];
+  memset(table, 0xFF, sizeof(table));
+  uint8_t *out = dst;
+  uint8_t *out_end = dst + capacity;
+  int32_t anchor = 0;
+  int32_t i = 0;
+  while (i + LZ_MIN_MATCH <= size) {
+    uint32_t value = lz_read32(src + i);
+    uint32_t hash = (value * 2654435761u) >> (32 - LZ_HASH_BITS);
+    int32_t candidate = table[hash];
+    table[hash] = i;
+    if (candidate < 0 || i - candidate > LZ_MAX_OFFSET ||
+        lz_read32(src + candidate) != value) {
+      i++;
+      continue;
+    }
+    int32_t match = LZ_MIN_MATCH;
+    while (i + match < size && src[candidate + match] == src[i + match]) {
+      match++;
+    }
+    int32_t literal_count = i - anchor;
+    if (out_end - out <
+        literal_count + literal_count / 255 + match / 255 + 6) {
+      return -1;
+    }
+    out = lz_put_sequence(out, src + anchor, literal_count, i - candidate,
+                          match);
+    i += match;
+    anchor = i;
+  }
+  int32_t literal_count = size - anchor;
+  if (out_end - out < literal_count + literal_count / 255 + 2) {
+    return -1;
+  }
+  out = lz_put_sequence(out, src + anchor, literal_count, 0, 0);
+  return out - dst;
+}
+
+static bool lz_get_length(uint8_t **in, uint8_t *in_end, int32_t *length) {
+  uint8_t byte;
+  do {
+    if (*in >= in_end) {
+      return false;
+    }
+    byte = *(*in)++;
+    *length += byte;
+  } while (byte == 255);
+  return true;
+}
+
+// NOTE: returns false unless src decompresses to exactly size bytes
+bool lz_decompress(uint8_t *src, int32_t compressed_size, uint8_t *dst,
+                   int32_t size) {
+  uint8_t *in = src;
+  uint8_t *in_end = src + compressed_size;
+  uint8_t *out = dst;
+  uint8_t *out_end = dst + size;
+  while (in < in_end) {
+    uint8_t token = *in++;
+    int32_t literal_count = token >> 4;
+    if (literal_count == 15 && !lz_get_length(&in, in_end, &literal_count)) {
+      return false;
+    }
+    if (literal_count > in_end - in || literal_count > out_end - out) {
+      return false;
+    }
+    charcpy((char *)out, (char *)in, literal_count);
+    in += literal_count;
+    out += literal_count;
+    if (in == in_end) {
+      break;
+    }
+
+    if (in_end - in < 2) {
+      return false;
+    }
+    int32_t offset = in[0] | (in[1] << 8);
+    in += 2;
+    int32_t match = (token & 0xF) + LZ_MIN_MATCH;
+    if ((token & 0xF) == 15 && !lz_get_length(&in, in_end, &match)) {
+      return false;
+    }
+    if (offset == 0 || offset > out - dst || match > out_end - out) {
+      return false;
+    }
+    // NOTE: byte by byte, the match may overlap what it produces
+    uint8_t *from = out - offset;
+    for (int32_t j = 0; j < match; ++j) {
+      out[j] = from[j];
+    }
+    out += match;
+  }
+  return out == out_end;
+}
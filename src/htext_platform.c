@@ -9,7 +9,9 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/wait.h>
 #include <unistd.h>
 
 #define DEBUG_FPS 0
@@ -36,6 +38,7 @@ void loadGameCode(const char *sourcePath, Code *code) {
   if (code->handler) {
     code->updateAndRender =
         (update_and_render *)dlsym(code->handler, "UpdateAndRender");
+    code->runBatch = (run_batch *)dlsym(code->handler, "RunBatch");
   } else {
     char *errstr = dlerror();
     if (errstr != NULL) {
@@ -54,19 +57,230 @@ void unloadGameCode(Code *code) {
   code->isValid = false;
 }
 
-int main(void) {
+// NOTE: maps the snapshot image over permanent storage, copy on write so the
+// file is never modified. Pages are read lazily as they are touched
+int restoreSnapshot(const char *path, Memory *memory) {
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return -1;
+  }
+
+  SnapshotHeader header;
+  struct stat fileStat;
+  if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+      fstat(fd, &fileStat) != 0 || header.magic != SNAPSHOT_MAGIC ||
+      header.base != (uint64_t)memory->permanent_storage ||
+      header.size != memory->permanent_storage_size ||
+      (uint64_t)fileStat.st_size != SNAPSHOT_HEADER_SIZE + header.size) {
+    close(fd);
+    return -1;
+  }
+
+  void *result =
+      mmap(memory->permanent_storage, header.size, PROT_READ | PROT_WRITE,
+           MAP_PRIVATE | MAP_FIXED | MAP_NORESERVE, fd, SNAPSHOT_HEADER_SIZE);
+  close(fd);
+  if (result == MAP_FAILED) {
+    return -1;
+  }
+  memory->restored = true;
+  return 0;
+}
+
+// NOTE: --batch script.ex [--jobs N] file..., no SDL or TTF is initialized.
+// --jobs may come anywhere before a `--`, the other arguments are moved down
+// in argv so the script is argv[2] and the files follow it. With N > 1 the
+// files are split across N forked processes
+int runBatch(const char *libSourcePath, Memory *memory, int argc,
+             char **argv) {
+  int jobs = 1;
+  int argCount = 2;
+  bool options = true;
+  for (int i = 2; i < argc; ++i) {
+    if (options && strcmp(argv[i], "--") == 0) {
+      options = false;
+    } else if (options && strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+      jobs = atoi(argv[++i]);
+    } else if (options && strncmp(argv[i], "--jobs=", 7) == 0) {
+      jobs = atoi(argv[i] + 7);
+    } else {
+      argv[argCount++] = argv[i];
+    }
+  }
+  if (argCount < 3) {
+    printf("usage: htext --batch script.ex [--jobs N] file...\n");
+    return -1;
+  }
+  char *scriptPath = argv[2];
+  char **files = argv + 3;
+  int fileCount = argCount - 3;
+  if (jobs < 1) {
+    jobs = 1;
+  }
+  if (jobs > fileCount) {
+    jobs = fileCount;
+  }
+
+  Code code = {};
+  loadGameCode(libSourcePath, &code);
+  if (!code.isValid || code.runBatch == NULL) {
+    return -1;
+  }
+
+  int failures = 0;
+  if (jobs <= 1) {
+    failures = code.runBatch(memory, scriptPath, files, fileCount);
+  } else {
+    // NOTE: every child gets a copy on write view of the memory block and
+    // the files i with i % jobs == job, so it only needs argv
+    for (int job = 0; job < jobs; ++job) {
+      pid_t pid = fork();
+      if (pid < 0) {
+        printf("failed to fork %s\n", strerror(errno));
+        return -1;
+      }
+      if (pid == 0) {
+        int jobFileCount = 0;
+        for (int i = job; i < fileCount; i += jobs) {
+          files[jobFileCount++] = files[i];
+        }
+        int jobFailures =
+            code.runBatch(memory, scriptPath, files, jobFileCount);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(jobFailures > 255 ? 255 : jobFailures);
+      }
+    }
+    int status;
+    while (wait(&status) > 0) {
+      if (WIFEXITED(status)) {
+        failures += WEXITSTATUS(status);
+      } else {
+        failures++;
+      }
+    }
+  }
+
+  unloadGameCode(&code);
+  return failures == 0 ? 0 : 1;
+}
+
+typedef struct {
+  platform_work_queue_callback *callback;
+  void *data;
+} PlatformWorkQueueEntry;
+
+// NOTE: single producer ring buffer, workers claim entries with a compare and
+// swap on nextEntryToRead and sleep on the semaphore when it is empty
+struct PlatformWorkQueue {
+  uint32_t completionGoal;
+  uint32_t completionCount;
+  uint32_t nextEntryToWrite;
+  uint32_t nextEntryToRead;
+  SDL_sem *semaphore;
+  bool lowPriority;
+  PlatformWorkQueueEntry entries[WORK_QUEUE_ENTRY_COUNT];
+};
+
+static void addWorkEntry(PlatformWorkQueue *queue,
+                         platform_work_queue_callback *callback, void *data) {
+  uint32_t entryToWrite = queue->nextEntryToWrite;
+  uint32_t newNextEntryToWrite = (entryToWrite + 1) % WORK_QUEUE_ENTRY_COUNT;
+  assert(newNextEntryToWrite !=
+         __atomic_load_n(&queue->nextEntryToRead, __ATOMIC_ACQUIRE));
+  queue->entries[entryToWrite].callback = callback;
+  queue->entries[entryToWrite].data = data;
+  queue->completionGoal++;
+  __atomic_store_n(&queue->nextEntryToWrite, newNextEntryToWrite,
+                   __ATOMIC_RELEASE);
+  SDL_SemPost(queue->semaphore);
+}
+
+// NOTE: returns false when there was nothing to do
+static bool doNextWorkEntry(PlatformWorkQueue *queue) {
+  uint32_t entryToRead =
+      __atomic_load_n(&queue->nextEntryToRead, __ATOMIC_ACQUIRE);
+  if (entryToRead ==
+      __atomic_load_n(&queue->nextEntryToWrite, __ATOMIC_ACQUIRE)) {
+    return false;
+  }
+  uint32_t newNextEntryToRead = (entryToRead + 1) % WORK_QUEUE_ENTRY_COUNT;
+  if (__atomic_compare_exchange_n(&queue->nextEntryToRead, &entryToRead,
+                                  newNextEntryToRead, false, __ATOMIC_ACQ_REL,
+                                  __ATOMIC_ACQUIRE)) {
+    PlatformWorkQueueEntry entry = queue->entries[entryToRead];
+    entry.callback(queue, entry.data);
+    __atomic_add_fetch(&queue->completionCount, 1, __ATOMIC_RELEASE);
+  }
+  return true;
+}
+
+static void completeAllWork(PlatformWorkQueue *queue) {
+  while (__atomic_load_n(&queue->completionCount, __ATOMIC_ACQUIRE) !=
+         queue->completionGoal) {
+    doNextWorkEntry(queue);
+  }
+  queue->completionGoal = 0;
+  __atomic_store_n(&queue->completionCount, 0, __ATOMIC_RELEASE);
+}
+
+static int workQueueThread(void *data) {
+  PlatformWorkQueue *queue = data;
+  if (queue->lowPriority) {
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+  }
+  for (;;) {
+    if (!doNextWorkEntry(queue)) {
+      SDL_SemWait(queue->semaphore);
+    }
+  }
+  return 0;
+}
+
+static void createWorkQueue(PlatformWorkQueue *queue, int threadCount,
+                            bool lowPriority) {
+  queue->lowPriority = lowPriority;
+  queue->completionGoal = 0;
+  queue->completionCount = 0;
+  queue->nextEntryToWrite = 0;
+  queue->nextEntryToRead = 0;
+  queue->semaphore = SDL_cpointer(SDL_CreateSemaphore(0));
+  for (int i = 0; i < threadCount; ++i) {
+    SDL_DetachThread(
+        SDL_cpointer(SDL_CreateThread(workQueueThread, "worker", queue)));
+  }
+}
+
+// NOTE: keeps fdatasync off the frame, at most JOURNAL_SYNC_INTERVAL_MS of
+// edits are lost when the machine goes down
+static int journalSyncThread(void *data) {
+  Memory *memory = data;
+  for (;;) {
+    SDL_Delay(JOURNAL_SYNC_INTERVAL_MS);
+    if (__atomic_exchange_n(&memory->journal_dirty, 0, __ATOMIC_ACQ_REL)) {
+      int fd = __atomic_load_n(&memory->journal_fd, __ATOMIC_ACQUIRE);
+      if (fd >= 0) {
+        fdatasync(fd);
+      }
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char **argv) {
   const char *libSourcePath = "build/htext.so";
 
-  uint64_t permanentStorageSize = Megabytes(256);
-  uint64_t transientStorageSize = Gigabytes(3);
+  uint64_t permanentStorageSize = Gigabytes(64);
+  uint64_t transientStorageSize = Gigabytes(16);
   PlatformState platformState = {};
   platformState.total_size = permanentStorageSize + transientStorageSize;
 
-  void *baseAddress = (void *)(0);
-  // NOTE: MAP_ANONYMOUS content initialized to zero
+  void *baseAddress = (void *)(STORAGE_BASE_ADDRESS);
+  // NOTE: MAP_ANONYMOUS content initialized to zero, the range is only
+  // reserved here, arenas commit pages with mprotect as they grow
   platformState.memory_block =
-      mmap(baseAddress, platformState.total_size, PROT_READ | PROT_WRITE,
-           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+      mmap(baseAddress, platformState.total_size, PROT_NONE,
+           MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
 
   if (platformState.memory_block == MAP_FAILED) {
     printf("failed to reserve memory %s\n", strerror(errno));
@@ -79,6 +293,27 @@ int main(void) {
   memory.permanent_storage = platformState.memory_block;
   memory.transient_storage =
       ((uint8_t *)memory.permanent_storage + memory.permanent_storage_size);
+  memory.journal_fd = -1;
+
+  if (mprotect(memory.permanent_storage, STORAGE_INITIAL_COMMIT_SIZE,
+               PROT_READ | PROT_WRITE) != 0 ||
+      mprotect(memory.transient_storage, STORAGE_INITIAL_COMMIT_SIZE,
+               PROT_READ | PROT_WRITE) != 0) {
+    printf("failed to commit memory %s\n", strerror(errno));
+    return -1;
+  }
+
+  if (argc > 2 && strcmp(argv[1], "--restore") == 0) {
+    if (restoreSnapshot(argv[2], &memory) != 0) {
+      printf("cannot restore %s, starting from scratch\n", argv[2]);
+    }
+  }
+
+  if (argc > 1 && strcmp(argv[1], "--batch") == 0) {
+    int r = runBatch(libSourcePath, &memory, argc, argv);
+    munmap(platformState.memory_block, platformState.total_size);
+    return r;
+  }
 
   int width = 1920;
   int height = 1080;
@@ -87,6 +322,18 @@ int main(void) {
 
   TTF_ccode(TTF_Init());
 
+  SDL_DetachThread(SDL_cpointer(
+      SDL_CreateThread(journalSyncThread, "journal sync", &memory)));
+
+  static PlatformWorkQueue workQueue;
+  createWorkQueue(&workQueue, WORK_QUEUE_THREAD_COUNT, false);
+  memory.work_queue = &workQueue;
+  memory.add_work_entry = addWorkEntry;
+  memory.complete_all_work = completeAllWork;
+  static PlatformWorkQueue backgroundQueue;
+  createWorkQueue(&backgroundQueue, BACKGROUND_QUEUE_THREAD_COUNT, true);
+  memory.background_queue = &backgroundQueue;
+
   SDL_Window *window = SDL_cpointer(
       SDL_CreateWindow("Play", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
                        width, height, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE));
@@ -140,6 +387,10 @@ int main(void) {
   SDL_StartTextInput();
   while (running) {
     uint32_t frameStartMs = SDL_GetTicks();
+    input.frame_deadline =
+        SDL_GetPerformanceCounter() +
+        (uint64_t)(targetSecondsPerFrame * FRAME_DEADLINE_SHARE *
+                   SDL_GetPerformanceFrequency());
 
 #if DEBUG
     time_t modificationTime;
@@ -150,6 +401,8 @@ int main(void) {
         lastModificationTime = modificationTime;
       } else if (lastModificationTime != modificationTime || !code.isValid) {
         input.executableReloaded = true;
+        completeAllWork(memory.work_queue);
+        completeAllWork(memory.background_queue);
         unloadGameCode(&code);
         loadGameCode(libSourcePath, &code);
         lastModificationTime = modificationTime;
@@ -175,6 +428,7 @@ int main(void) {
       input.text[0] = '\0';
 
       SDL_RenderPresent(renderer);
+      input.last_present = SDL_GetTicks();
 
 #if DEBUG_WINDOW
       SDL_RenderPresent(debugRenderer);
@@ -202,6 +456,8 @@ int main(void) {
     }
   }
 
+  completeAllWork(memory.work_queue);
+  completeAllWork(memory.background_queue);
   unloadGameCode(&code);
   SDL_DestroyRenderer(renderer);
   SDL_DestroyWindow(window);
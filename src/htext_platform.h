@@ -47,6 +47,28 @@ typedef struct {
   int height;
 } SdlOffscreenBuffer;
 
+// NOTE: a queue of jobs run by platform worker threads. Entries are added
+// from the main thread only
+typedef struct PlatformWorkQueue PlatformWorkQueue;
+
+#define PLATFORM_WORK_QUEUE_CALLBACK(name)                                     \
+  void name(PlatformWorkQueue *queue, void *data)
+typedef PLATFORM_WORK_QUEUE_CALLBACK(platform_work_queue_callback);
+
+typedef void platform_add_work_entry(PlatformWorkQueue *queue,
+                                     platform_work_queue_callback *callback,
+                                     void *data);
+// NOTE: the calling thread helps until every entry added so far is done
+typedef void platform_complete_all_work(PlatformWorkQueue *queue);
+
+#define WORK_QUEUE_THREAD_COUNT 4
+#define BACKGROUND_QUEUE_THREAD_COUNT 4
+#define WORK_QUEUE_ENTRY_COUNT 256
+
+// NOTE: storage is reserved address space, only the first
+// STORAGE_INITIAL_COMMIT_SIZE bytes of each block are committed up front
+#define STORAGE_INITIAL_COMMIT_SIZE Megabytes(1)
+
 typedef struct {
   uint64_t permanent_storage_size;
   void *permanent_storage; // NOTE(casey): REQUIRED to be cleared to zero at
@@ -55,14 +77,64 @@ typedef struct {
   uint64_t transient_storage_size;
   void *transient_storage; // NOTE(casey): REQUIRED to be cleared to zero at
                            // startup
+
+  // NOTE: permanent storage was mapped back from a snapshot, pointers to GPU
+  // and font resources in it are stale
+  bool restored;
+
+  // NOTE: the app appends to the journal every frame and sets journal_dirty,
+  // a platform thread fdatasyncs it every JOURNAL_SYNC_INTERVAL_MS. Accessed
+  // with __atomic builtins, journal_fd is -1 when there is no journal
+  int journal_fd;
+  int journal_dirty;
+
+  // NOTE: NULL when there are no worker threads, in batch mode and in tests.
+  // Callbacks live in the app code, all work is completed before it reloads
+  PlatformWorkQueue *work_queue;
+  platform_add_work_entry *add_work_entry;
+  platform_complete_all_work *complete_all_work;
+  // NOTE: for long running work like searching files, its threads run at low
+  // priority so they don't hold up the work_queue ones. NULL like work_queue
+  PlatformWorkQueue *background_queue;
 } Memory;
 
+#define JOURNAL_SYNC_INTERVAL_MS 500
+
+// NOTE: share of the target frame duration the app may spend before
+// Input.frame_deadline
+#define FRAME_DEADLINE_SHARE 0.75
+
+// NOTE: permanent storage is reserved at this address so a snapshot of it can
+// be mapped back as is, pointers included
+#define STORAGE_BASE_ADDRESS Terabytes(2)
+
+// NOTE: a snapshot file is this header followed, at SNAPSHOT_HEADER_SIZE, by
+// an image of the whole permanent storage. Only the used parts are written,
+// the rest are holes
+#define SNAPSHOT_MAGIC 0x3130504e53545448ULL // "HTTSNP01"
+#define SNAPSHOT_HEADER_SIZE Kilobytes(4)
+
+typedef struct {
+  uint64_t magic;
+  uint64_t base;
+  uint64_t size;
+} SnapshotHeader;
+
 typedef struct {
   bool executableReloaded;
   int keypressed;
 
   char text[32];
 
+  // NOTE: SDL_GetPerformanceCounter value the app should be done by, the rest
+  // of the frame is left to present it. Work that can wait, like render-ahead,
+  // only runs until then. 0 when there is no frame to fit in
+  uint64_t frame_deadline;
+
+  // NOTE: SDL_GetTicks right after the previous frame was presented, 0 before
+  // the first one
+  uint32_t last_present;
+
 #if DEBUG_RECORDING || DEBUG_PLAYBACK
   FILE *playbackFile;
 #endif
@@ -72,6 +144,12 @@ typedef struct {
   int name(Memory *memory, Input *input, SdlOffscreenBuffer *buffer)
 typedef UPDATE_AND_RENDER(update_and_render);
 
+// NOTE: headless batch mode, applies the ex script at script_path to every
+// file, returns the number of files that failed
+#define RUN_BATCH(name)                                                        \
+  int name(Memory *memory, char *script_path, char **files, int32_t file_count)
+typedef RUN_BATCH(run_batch);
+
 // clang-format off
 #define UNHEX(color) \
   ((color) >> (8 * 3)) & 0xFF, \
@@ -85,6 +163,7 @@ typedef struct {
   // IMPORTANT(casey): Either of the callbacks can be 0!  You must
   // check before calling.
   update_and_render *updateAndRender;
+  run_batch *runBatch;
 
   bool isValid;
 } Code;
@@ -0,0 +1,57 @@
+#include "htext_app.h"
+
+TextRegisters *text_registers_create(MemoryArena *arena,
+                                     memory_index register_size) {
+  TextRegisters *registers =
+      pushStruct(arena, TextRegisters, DEFAULT_ALIGNMENT);
+  for (int32_t i = 0; i < TEXT_REGISTER_COUNT; ++i) {
+    TextRegister *reg = registers->registers + i;
+    sub_arena(&reg->arena, arena, register_size, ARENA_COMMIT_SIZE);
+    reg->spans = NULL;
+    reg->count = 0;
+  }
+  return registers;
+}
+
+static void text_register_clear(TextRegister *reg) {
+  reg->arena.used = 0;
+  releaseArena(&reg->arena);
+  reg->spans = NULL;
+  reg->count = 0;
+}
+
+static bool text_register_fits(TextRegister *reg, uint64_t size) {
+  return reg->arena.used + size + DEFAULT_ALIGNMENT <= reg->arena.size;
+}
+
+// NOTE: [base, base + size) is about to be reused, the texts registers share
+// from there are copied into their own arenas. A register too small for them
+// is cleared
+static void text_registers_detach(TextRegisters *registers, uint8_t *base,
+                                  memory_index size) {
+  for (int32_t i = 0; i < TEXT_REGISTER_COUNT; ++i) {
+    TextRegister *reg = registers->registers + i;
+    uint64_t shared_size = 0;
+    for (int32_t j = 0; j < reg->count; ++j) {
+      uint8_t *text = (uint8_t *)reg->spans[j].text;
+      if (text >= base && text < base + size) {
+        shared_size += reg->spans[j].len;
+      }
+    }
+    if (shared_size == 0) {
+      continue;
+    }
+    if (!text_register_fits(reg, shared_size)) {
+      text_register_clear(reg);
+      continue;
+    }
+    for (int32_t j = 0; j < reg->count; ++j) {
+      LineSpan *span = reg->spans + j;
+      uint8_t *text = (uint8_t *)span->text;
+      if (text >= base && text < base + size) {
+        span->text = pushSize(&reg->arena, span->len, 1);
+        charcpy(span->text, (char *)text, span->len);
+      }
+    }
+  }
+}
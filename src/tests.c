@@ -11,8 +11,8 @@ int main(void) {
   uint64_t persistentSize = Megabytes(512);
   uint64_t transientSize = Megabytes(512);
   void *gameMemoryBlock =
-      mmap(baseAddress, persistentSize + transientSize, PROT_READ | PROT_WRITE,
-           MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+      mmap(baseAddress, persistentSize + transientSize, PROT_NONE,
+           MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
   assert(gameMemoryBlock != MAP_FAILED);
 
   MemoryArena arena;
@@ -23,23 +23,24 @@ int main(void) {
                   ((uint8_t *)gameMemoryBlock) + persistentSize);
 
   EditorFrame frame = editor_frame_create(&arena);
+  frame.integrity = Integrity_full;
 
   //-----
   for (int i = 0; i < 102; ++i) {
-    editor_frame_insert_text(&transient_arena, &frame, "c", 1);
+    editor_frame_insert_text(&frame, "c", 1);
   }
 
   assert(strcmp(frame.line->text,
                 "cccccccccccccccccccccccccccccccccccccccccccccccccccccccccccccc"
                 "cccccccccccccccccccccccccccccccccccccccc") == 0);
   editor_frame_move_cursor_h(&frame, -100);
-  editor_frame_insert_text(&transient_arena, &frame, "1", 1);
+  editor_frame_insert_text(&frame, "1", 1);
   assert(strcmp(frame.line->text,
                 "cc1ccccccccccccccccccccccccccccccccccccccccccccccccccccccccccc"
                 "ccccccccccccccccccccccccccccccccccccccccc") == 0);
   editor_frame_close(&frame);
 
-  editor_frame_insert_text(&transient_arena, &frame, "hello world", 11);
+  editor_frame_insert_text(&frame, "hello world", 11);
   assert(frame.line == frame.cursor.line);
   assert(frame.cursor.column == 11);
   assert(frame.line->prev == NULL);
@@ -48,7 +49,7 @@ int main(void) {
 
   //----
   frame.cursor.column = 5;
-  editor_frame_insert_text(&transient_arena, &frame, ",", 1);
+  editor_frame_insert_text(&frame, ",", 1);
   assert(frame.line->len == 12);
   assert(frame.line->prev == NULL);
   assert(strncmp(frame.line->text, "hello, world", 12) == 0);
@@ -136,5 +137,758 @@ int main(void) {
   assert(frame.line->next->next->prev == frame.line->next);
   assert(frame.line->next->next == frame.cursor.line);
 
+  //----
+  editor_frame_close(&frame);
+  editor_frame_begin_batch(&frame);
+  for (int i = 0; i < 50; ++i) {
+    editor_frame_insert_text(&frame, "x", 1);
+    editor_frame_insert_new_line(&frame);
+  }
+  // reindexing is deferred, lines are found walking from the cursor
+  assert(frame.index_valid_size == 1);
+  editor_frame_move_cursor_v(&frame, -25, NULL);
+  assert(frame.cursor.line_num == 25);
+  assert(frame.cursor.line->len == 1);
+  editor_frame_end_batch(&frame);
+
+  assert(frame.line_count == 51);
+  assert(frame.index_valid_size == frame.line_count);
+  assert(frame.index[25] == frame.cursor.line);
+  assert(frame.batch_dirty_start > frame.batch_dirty_end);
+
+  //----
+  assert(editor_frame_load_file(&transient_arena, &frame, "fixtures/data") ==
+         0);
+  assert(frame.line_count == 101);
+  assert(frame.cursor.line == frame.line);
+  assert(strncmp(frame.line->text, "1. This is a line", 17) == 0);
+  assert(strncmp(frame.index[99]->text, "100. This is a line", 19) == 0);
+  assert(frame.index[100]->len == 0);
+  // the read buffer is temporary but shows up in the high-water mark
+  assert(transient_arena.used == 0);
+  assert(transient_arena.high_water >= LOAD_FILE_READ_SIZE);
+  assert(frame.arena.allocation_count > 0);
+
+  //---- ex commands shared with batch mode
+  char filename[FILENAME_SIZE] = "";
+  char status_message[STATUS_MESSAGE_SIZE];
+  ExCommandContext ex_context = {.frame = &frame,
+                                 .transient_arena = &transient_arena,
+                                 .filename = filename,
+                                 .status_message = status_message};
+  assert(ex_command_execute(&ex_context, "0,9d", 4) == ExResult_ok);
+  assert(frame.line_count == 91);
+  assert(strncmp(frame.line->text, "11. This", 8) == 0);
+  assert(ex_command_execute(&ex_context, "%s/is/IS/g", 10) == ExResult_ok);
+  assert(strncmp(frame.line->text, "11. ThIS IS a line", 18) == 0);
+  assert(ex_command_execute(&ex_context, "5,2d", 4) == ExResult_error);
+  assert(ex_command_execute(&ex_context, "w", 1) == ExResult_error);
+  assert(ex_command_execute(&ex_context, "stats", 5) == ExResult_unhandled);
+  // NOTE: a file with a tab fails to load instead of tripping the line checks
+  {
+    FILE *f = fopen("build/tests.tab", "w");
+    assert(f != NULL);
+    fputs("printable\nwith\ta tab\n", f);
+    fclose(f);
+    assert(ex_command_execute(&ex_context, "load build/tests.tab", 20) ==
+           ExResult_error);
+    assert(strcmp(status_message,
+                  "Cannot load build/tests.tab: not printable") == 0);
+    assert(frame.line_count == 1);
+    assert(frame.line->len == 0);
+    unlink("build/tests.tab");
+  }
+
+  //---- registers share long texts with the lines they were yanked from
+  frame.registers = text_registers_create(&arena, Kilobytes(64));
+  TextRegister *reg = frame.registers->registers + 1;
+  editor_frame_close(&frame);
+  editor_frame_insert_text(&frame, "short", 5);
+  editor_frame_insert_new_line(&frame);
+  editor_frame_insert_text(&frame, "a line long enough to live on the heap",
+                           38);
+  assert(editor_frame_yank(&frame, reg, 0, 2));
+  assert(reg->count == 2);
+  assert(reg->spans[0].text != frame.index[0]->text);
+  assert(reg->spans[1].text == frame.index[1]->text);
+  editor_frame_put(&frame, reg, false);
+  assert(frame.line_count == 4);
+  assert(frame.cursor.line_num == 2);
+  assert(frame.index[3]->text == frame.index[1]->text);
+  // NOTE: the first write copies the text out
+  editor_frame_move_cursor_v(&frame, 1, NULL);
+  editor_frame_insert_text(&frame, "!", 1);
+  assert(frame.index[3]->text != frame.index[1]->text);
+  assert(strncmp(frame.index[1]->text, "a line long", 11) == 0);
+  assert(strncmp(frame.index[3]->text, "!a line long", 12) == 0);
+  assert(!frame.index[3]->text_shared);
+  // NOTE: texts from the frame arena are copied before it is reused
+  editor_frame_close(&frame);
+  assert(reg->count == 2);
+  assert((uint8_t *)reg->spans[1].text >= reg->arena.base &&
+         (uint8_t *)reg->spans[1].text < reg->arena.base + reg->arena.size);
+  editor_frame_put(&frame, reg, true);
+  assert(frame.line_count == 3);
+  assert(strncmp(frame.index[1]->text, "a line long", 11) == 0);
+  editor_frame_begin_batch(&frame);
+  for (int i = 0; i < 10000; ++i) {
+    editor_frame_insert_new_line(&frame);
+  }
+  editor_frame_end_batch(&frame);
+  assert(!editor_frame_yank(&frame, reg, 0, frame.line_count));
+  assert(reg->count == 0);
+
+  //---- the journal replays edits over the file it was started from
+  int journal_fd = open("build/tests.journal",
+                        O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  assert(journal_fd >= 0);
+  frame.journal = journal_create(&arena, journal_fd);
+  assert(editor_frame_load_file(&transient_arena, &frame, "fixtures/data") ==
+         0);
+  editor_frame_move_cursor_v(&frame, 3, NULL);
+  editor_frame_insert_text(&frame, "abc", 3);
+  editor_frame_insert_new_line(&frame);
+  editor_frame_remove_char(&frame);
+  editor_frame_remove_lines(&frame, 2);
+  assert(ex_command_execute(&ex_context, "10,20d", 6) == ExResult_ok);
+  assert(ex_command_execute(&ex_context, "%s/line/LINE/", 13) ==
+         ExResult_ok);
+  editor_frame_block_insert(&frame, 0, 5, 2, "++", 2);
+  editor_frame_block_delete(&frame, 1, 3, 0, 3);
+  assert(strncmp(frame.index[0]->text, "1.++ This", 9) == 0);
+  assert(strncmp(frame.index[1]->text, "+ This", 6) == 0);
+  assert(editor_frame_yank(&frame, reg, 4, 7));
+  editor_frame_put(&frame, reg, true);
+  assert(frame.line_count == 88 + 3);
+  assert(journal_flush(frame.journal));
+  // NOTE: a record cut short by a crash is dropped
+  off_t journal_size = lseek(journal_fd, 0, SEEK_END);
+  JournalRecord torn = {.op = JournalOp_insert_text, .size = 100};
+  assert(write(journal_fd, &torn, sizeof(torn)) == sizeof(torn));
+
+  EditorFrame recovered = editor_frame_create(&arena);
+  recovered.journal = journal_create(&arena, journal_fd);
+  assert(editor_frame_journal_replay(&transient_arena, &recovered, filename) ==
+         9);
+  assert(strstr(filename, "fixtures/data") != NULL);
+  assert(recovered.line_count == frame.line_count);
+  for (int32_t i = 0; i < frame.line_count; ++i) {
+    assert(frame.index[i]->len == recovered.index[i]->len);
+    assert(strncmp(frame.index[i]->text, recovered.index[i]->text,
+                   frame.index[i]->len) == 0);
+  }
+  struct stat journal_stat;
+  assert(fstat(journal_fd, &journal_stat) == 0);
+  assert(journal_stat.st_size == journal_size);
+  editor_frame_close(&recovered);
+  frame.journal = NULL;
+  close(journal_fd);
+  unlink("build/tests.journal");
+  filename[0] = '\0';
+
+  //---- scratch buffers and buffers with unsaved changes are recovered too
+  journal_fd = open("build/tests.journal",
+                    O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  assert(journal_fd >= 0);
+  Journal *scratch_journal = journal_create(&arena, journal_fd);
+  recovered.journal = scratch_journal;
+  editor_frame_journal_restart(&recovered, "");
+  editor_frame_insert_text(&recovered, "scratch", 7);
+  editor_frame_insert_new_line(&recovered);
+  editor_frame_insert_text(&recovered, " text", 5);
+  assert(journal_flush(scratch_journal));
+  frame.journal = scratch_journal;
+  strcpy(filename, "stale");
+  assert(editor_frame_journal_replay(&transient_arena, &frame, filename) ==
+         3);
+  assert(filename[0] == '\0' && frame.line_count == 2);
+  assert(strncmp(frame.index[0]->text, "scratch", 7) == 0);
+  assert(strncmp(frame.index[1]->text, " text", 5) == 0);
+  // NOTE: like a session restored from a snapshot with unsaved changes
+  assert(frame.modified);
+  editor_frame_journal_restart(&frame, "fixtures/data");
+  assert(journal_flush(scratch_journal));
+  assert(editor_frame_journal_replay(&transient_arena, &recovered,
+                                     filename) >= 0);
+  assert(recovered.line_count == 2 && recovered.index[1]->len == 5);
+  assert(strncmp(recovered.index[1]->text, " text", 5) == 0);
+  editor_frame_close(&recovered);
+  recovered.journal = NULL;
+  frame.journal = NULL;
+  close(journal_fd);
+  unlink("build/tests.journal");
+  filename[0] = '\0';
+
+  //---- saving back copies unchanged lines and skips clean buffers
+  FILE *save_file = fopen("build/tests.save", "w");
+  assert(save_file != NULL);
+  for (int i = 0; i < 5000; ++i) {
+    fprintf(save_file, "%d. a line long enough to be copied\n", i);
+  }
+  fclose(save_file);
+  assert(editor_frame_load_file(&transient_arena, &frame, "build/tests.save") ==
+         0);
+  assert(frame.origin_count == 5001 && !frame.modified);
+  assert(frame.index[4999]->origin == 4999);
+  struct stat save_stat;
+  assert(stat("build/tests.save", &save_stat) == 0);
+  assert(editor_frame_dump_file(&transient_arena, &frame, "build/tests.save",
+                                true) == 1);
+  editor_frame_move_cursor_v(&frame, 2500, NULL);
+  editor_frame_insert_text(&frame, "x", 1);
+  editor_frame_move_cursor_v(&frame, 1, NULL);
+  editor_frame_remove_lines(&frame, 3);
+  assert(frame.modified && frame.index[2500]->origin == -1);
+  assert(frame.cursor.line->origin == 2504);
+  assert(editor_frame_dump_file(&transient_arena, &frame, "build/tests.save",
+                                true) == 0);
+  assert(!frame.modified && frame.cursor.line->origin == 2501);
+  save_file = fopen("build/tests.save", "r");
+  char *saved = pushSize(&transient_arena, Megabytes(1), 1);
+  size_t saved_size = fread(saved, 1, Megabytes(1), save_file);
+  fclose(save_file);
+  char *saved_line = saved;
+  for (int32_t i = 0; i < frame.line_count; ++i) {
+    Line *line = frame.index[i];
+    assert(strncmp(saved_line, line->text, line->len) == 0);
+    saved_line += line->len + 1;
+  }
+  assert(saved_line == saved + saved_size + 1);
+  assert(strncmp(frame.index[2500]->text, "x2500. a line", 13) == 0);
+  assert(strncmp(frame.index[2501]->text, "2504. a line", 12) == 0);
+  transient_arena.used = 0;
+  // NOTE: a file changed by someone else is written in full
+  save_file = fopen("build/tests.save", "a");
+  fputs("appended\n", save_file);
+  fclose(save_file);
+  assert(editor_frame_dump_file(&transient_arena, &frame, "build/tests.save",
+                                true) == 0);
+  assert(stat("build/tests.save", &save_stat) == 0);
+  assert(frame.origin_count == frame.line_count);
+  assert(save_stat.st_size == frame.origin_offsets[frame.line_count - 1]);
+  unlink("build/tests.save");
+  // NOTE: a name too long for the temporary file next to it is written in
+  // place
+  {
+    char long_path[300] = "build/";
+    memset(long_path + 6, 'l', 250);
+    long_path[256] = '\0';
+    save_file = fopen(long_path, "w");
+    assert(save_file != NULL);
+    fputs("first\nsecond\n", save_file);
+    fclose(save_file);
+    assert(editor_frame_load_file(&transient_arena, &frame, long_path) == 0);
+    editor_frame_insert_text(&frame, "1. ", 3);
+    assert(editor_frame_dump_file(&transient_arena, &frame, long_path,
+                                  true) == 0);
+    assert(!frame.modified);
+    char long_text[32] = "";
+    save_file = fopen(long_path, "r");
+    size_t long_size = fread(long_text, 1, sizeof(long_text) - 1, save_file);
+    fclose(save_file);
+    assert(long_size == 16 && strcmp(long_text, "1. first\nsecond\n") == 0);
+    unlink(long_path);
+  }
+
+  //---- the codec round trips, lines far from the viewport are compressed
+  uint8_t *lz_text = pushSize(&transient_arena, Kilobytes(64), 1);
+  uint8_t *lz_packed = pushSize(&transient_arena, Kilobytes(80), 1);
+  uint8_t *lz_unpacked = pushSize(&transient_arena, Kilobytes(64), 1);
+  for (int32_t i = 0; i < Kilobytes(64); ++i) {
+    lz_text[i] = i < Kilobytes(32) ? (uint8_t)(i * 7919 >> 3) ^ (i >> 11)
+                                   : 'a' + i % 3;
+  }
+  int32_t sizes[] = {0, 3, 4, 100, Kilobytes(40), Kilobytes(64)};
+  for (uint32_t i = 0; i < ArrayCount(sizes); ++i) {
+    int32_t packed = lz_compress(lz_text, sizes[i], lz_packed, Kilobytes(80));
+    assert(packed >= 0);
+    assert(lz_decompress(lz_packed, packed, lz_unpacked, sizes[i]));
+    assert(memcmp(lz_text, lz_unpacked, sizes[i]) == 0);
+    if (sizes[i] > 0) {
+      assert(!lz_decompress(lz_packed, packed, lz_unpacked, sizes[i] - 1));
+    }
+  }
+  assert(lz_compress(lz_text, Kilobytes(64), lz_packed, 100) == -1);
+  transient_arena.used = 0;
+
+  FILE *cold_file = fopen("build/tests.cold", "w");
+  assert(cold_file != NULL);
+  for (int i = 0; i < 20000; ++i) {
+    fprintf(cold_file, "%d. a line that nobody looks at again\n", i);
+  }
+  fclose(cold_file);
+  assert(editor_frame_load_file(&transient_arena, &frame, "build/tests.cold") ==
+         0);
+  frame.viewport_v.size = 10;
+  editor_frame_cold_step(&transient_arena, &frame, frame.line_count);
+  assert(frame.index[100]->text != NULL);
+  assert(frame.index[10000]->text == NULL);
+  assert(frame.cold_size > 0);
+  assert(frame.cold_compressed_size * 3 < frame.cold_size);
+  assert(strncmp(line_text(&frame, frame.index[10000]), "10000. a line", 13) ==
+         0);
+  // NOTE: searching reads cold lines in place, changes warm them up
+  assert(ex_command_execute(&ex_context, "15000,15999s/nobody/NOBODY/", 27) ==
+         ExResult_ok);
+  assert(frame.index[15000]->text != NULL && frame.index[16000]->text == NULL);
+  assert(strncmp(frame.index[15000]->text, "15000. a line that NOBODY", 25) ==
+         0);
+  assert(editor_frame_yank(&frame, reg, 19990, 20000));
+  editor_frame_move_cursor_v(&frame, 12000, NULL);
+  assert(frame.cursor.line->text == NULL);
+  editor_frame_put(&frame, reg, true);
+  editor_frame_insert_text(&frame, "y", 1);
+  assert(strncmp(frame.cursor.line->text, "y19990. a line", 14) == 0);
+  int32_t first_column = 0;
+  editor_frame_move_cursor_v(&frame, 10, &first_column);
+  editor_frame_remove_char(&frame);
+  assert(strncmp(frame.cursor.line->text,
+                 "19999. a line that nobody looks at again12000. a", 48) == 0);
+  assert(editor_frame_dump_file(&transient_arena, &frame, "build/tests.cold",
+                                true) == 0);
+  cold_file = fopen("build/tests.cold", "r");
+  char *cold_saved = pushSize(&transient_arena, Megabytes(1), 1);
+  size_t cold_saved_size = fread(cold_saved, 1, Megabytes(1), cold_file);
+  fclose(cold_file);
+  char *cold_line = cold_saved;
+  for (int32_t i = 0; i < frame.line_count; ++i) {
+    Line *line = frame.index[i];
+    assert(strncmp(cold_line, line_text(&frame, line), line->len) == 0);
+    cold_line += line->len + 1;
+  }
+  assert(cold_line == cold_saved + cold_saved_size + 1);
+  transient_arena.used = 0;
+  unlink("build/tests.cold");
+
+  //---- soft wrapping moves j and k by rows
+  editor_frame_close(&frame);
+  frame.viewport_v.size = 4;
+  editor_frame_set_wrap_width(&frame, 10, NULL);
+  editor_frame_set_wrap(&frame, true);
+  editor_frame_insert_text(&frame, "0123456789012345678901234", 25);
+  editor_frame_insert_new_line(&frame);
+  editor_frame_insert_text(&frame, "abc", 3);
+  assert(editor_frame_line_rows(&frame, frame.line) == 3);
+  assert(editor_frame_column_row(&frame, frame.line, 10) == 1);
+  editor_frame_move_cursor_rows(&frame, -2);
+  assert(frame.cursor.line_num == 0);
+  assert(frame.cursor.column == 13);
+  editor_frame_move_cursor_rows(&frame, -1);
+  assert(frame.cursor.column == 3);
+  editor_frame_move_cursor_rows(&frame, 3);
+  assert(frame.cursor.line_num == 1);
+  editor_frame_move_cursor_v(&frame, -1, NULL);
+  editor_frame_move_cursor_h(&frame, 20);
+  for (int i = 0; i < 6; ++i) {
+    editor_frame_insert_new_line(&frame);
+  }
+  assert(frame.viewport_v.start == 4 && frame.viewport_row == 0);
+  editor_frame_move_cursor_v(&frame, -6, NULL);
+  assert(frame.viewport_v.start == 0 && frame.viewport_row == 0);
+  editor_frame_insert_text(&frame, "0123456789012345678901234567890123456789",
+                           40);
+  assert(frame.viewport_v.start == 0 && frame.viewport_row == 2);
+  editor_frame_set_wrap_width(&frame, 5, NULL);
+  assert(frame.wrap_next == 0);
+  editor_frame_wrap_step(&frame, frame.line_count);
+  assert(frame.line->render->wrap_generation == frame.wrap_generation);
+  assert(frame.line->render->wrap_count == 12);
+  editor_frame_set_wrap(&frame, false);
+  editor_frame_set_wrap_width(&frame, 0, NULL);
+
+  //---- past the old 16 bit limits
+  editor_frame_close(&frame);
+  editor_frame_begin_batch(&frame);
+  for (int i = 0; i < 40000; ++i) {
+    editor_frame_insert_new_line(&frame);
+  }
+  editor_frame_end_batch(&frame);
+  assert(frame.line_count == 40001);
+  assert(frame.index_size >= frame.line_count);
+  assert(frame.index[40000] == frame.cursor.line);
+  for (int i = 0; i < 1000; ++i) {
+    editor_frame_insert_text(&frame, "0123456789012345678901234567890123",
+                             34);
+  }
+  assert(frame.cursor.line->len == 34000);
+  assert(frame.cursor.column == 34000);
+  editor_frame_move_cursor_v(&frame, -40000, NULL);
+  assert(frame.cursor.line_num == 0);
+
+  //---- arenas commit on demand and give pages back on close
+  assert(arena.committed < arena.used + ARENA_COMMIT_SIZE);
+  assert(frame.arena.committed >= frame.arena.used);
+  memory_index committed = frame.arena.committed;
+  editor_frame_close(&frame);
+  assert(frame.arena.committed < committed);
+  assert(frame.arena.committed <= ARENA_HUGE_PAGE_SIZE);
+  assert(frame.line_count == 1);
+
+  //---- a file the frame arena can't hold fails to load and leaves it empty
+  {
+    FILE *f = fopen("build/tests.arena", "w");
+    assert(f != NULL);
+    for (int i = 0; i < LINE_BLOCK_COUNT * 2; ++i) {
+      fputs("x\n", f);
+    }
+    fclose(f);
+    memory_index size = frame.arena.size;
+    frame.arena.size = LINE_BLOCK_COUNT * sizeof(Line) +
+                       INDEX_INITIAL_SIZE * sizeof(Line *) + Kilobytes(4);
+    assert(editor_frame_load_file(&transient_arena, &frame,
+                                  "build/tests.arena") == -1);
+    assert(frame.line_count == 1);
+    assert(frame.line->len == 0);
+    assert(frame.arena.used <= frame.arena.size);
+    assert(pushSize(&frame.arena, frame.arena.size, 1) == NULL);
+    frame.arena.size = size;
+    assert(editor_frame_load_file(&transient_arena, &frame,
+                                  "build/tests.arena") == 0);
+    assert(frame.line_count == LINE_BLOCK_COUNT * 2 + 1);
+    editor_frame_close(&frame);
+    unlink("build/tests.arena");
+  }
+
+  //---- a line that can't grow any more fails the edit and stays as it was
+  {
+    Line *line = frame.line;
+    assert(frame.line_count == 1 && line->len == 0);
+    line->len = INT32_MAX - 1;
+    editor_frame_insert_text(&frame, "x", 1);
+    assert(line->len == INT32_MAX - 1);
+    // NOTE: doubling this capacity overflows an int32_t
+    line->len = 1 << 30;
+    line->max_len = 1 << 30;
+    editor_frame_insert_text(&frame, "x", 1);
+    assert(line->len == 1 << 30 && line->max_len == 1 << 30);
+    assert(line->text == line->inline_text);
+    line->len = 0;
+    line->max_len = LINE_INLINE_SIZE - 1;
+    assert(frame.cursor.column == 0);
+  }
+
+  //---- new lines, puts and substitutions fail on a full frame arena and
+  // leave the buffer as it was
+  {
+    char *text = "a line long enough to live on the heap";
+    editor_frame_insert_text(&frame, text, 38);
+    assert(editor_frame_yank(&frame, reg, 0, 1));
+    // NOTE: the register gets its own copy, putting it needs the arena
+    editor_frame_close(&frame);
+    editor_frame_insert_text(&frame, text, 38);
+    editor_frame_move_cursor_h(&frame, -38);
+    char replacement[80];
+    memset(replacement, 'x', sizeof(replacement));
+
+    memory_index size = frame.arena.size;
+    frame.arena.size = frame.arena.used;
+    assert(!editor_frame_insert_new_line(&frame));
+    assert(!editor_frame_put(&frame, reg, false));
+    assert(editor_frame_substitute(&transient_arena, &frame, 0, 1, "heap", 4,
+                                   replacement, sizeof(replacement),
+                                   false) == -1);
+    assert(frame.line_count == 1);
+    assert(frame.line->len == 38);
+    assert(strncmp(frame.line->text, text, 38) == 0);
+    assert(frame.cursor.line == frame.line && frame.cursor.column == 0);
+    assert(frame.arena.used == frame.arena.size);
+
+    frame.arena.size = size;
+    assert(editor_frame_insert_new_line(&frame));
+    assert(editor_frame_put(&frame, reg, false));
+    assert(editor_frame_substitute(&transient_arena, &frame, 0, 2, "heap", 4,
+                                   replacement, sizeof(replacement),
+                                   false) == 1);
+    assert(frame.line_count == 3);
+    assert(frame.index[0]->len == 0);
+    assert(frame.index[1]->len == 34 + sizeof(replacement));
+    assert(strncmp(frame.index[2]->text, text, 38) == 0);
+    editor_frame_close(&frame);
+  }
+
+  //---- the cheaper integrity levels are picked at runtime
+  assert(ex_command_execute(&ex_context, "set integrity=bogus", 19) ==
+         ExResult_error);
+  assert(frame.integrity == Integrity_full);
+  assert(ex_command_execute(&ex_context, "set integrity=periodic", 22) ==
+         ExResult_ok);
+  assert(frame.integrity == Integrity_periodic);
+  for (int i = 0; i < INTEGRITY_SWEEP_INTERVAL + 1; ++i) {
+    editor_frame_insert_new_line(&frame);
+  }
+  assert(frame.integrity_edits == 1);
+  editor_frame_remove_lines(&frame, 10);
+  assert(editor_frame_set_integrity(&frame, "full"));
+
+  //---- short lines keep their text inline, lines are allocated in blocks
+  assert(sizeof(Line) == 64);
+  assert(editor_frame_load_file(&transient_arena, &frame, "fixtures/data") ==
+         0);
+  assert(frame.line->text == frame.line->inline_text);
+  assert(frame.line->next == frame.line + 1);
+  assert(frame.line->render == NULL);
+  editor_frame_close(&frame);
+
+  //---- grep walks a tree, jobs whose output filled up go on where they were
+  char grep_text[64];
+  memset(grep_text, 'x', sizeof(grep_text));
+  for (int32_t i = 0; i + 6 <= 64; ++i) {
+    charcpy(grep_text + i, "needle", 6);
+    assert(grep_find(grep_text, 64, "needle", 6) == grep_text + i);
+    assert(grep_find(grep_text, i + 5, "needle", 6) == NULL);
+    memset(grep_text + i, 'x', 6);
+  }
+  assert(mkdir("build/tests.grep", 0755) == 0 || errno == EEXIST);
+  assert(mkdir("build/tests.grep/sub", 0755) == 0 || errno == EEXIST);
+  FILE *grep_file = fopen("build/tests.grep/a.txt", "w");
+  fprintf(grep_file, "nothing\n  needle\nneedle twice needle");
+  fclose(grep_file);
+  grep_file = fopen("build/tests.grep/sub/b.log", "w");
+  for (int32_t i = 0; i < 5000; ++i) {
+    fprintf(grep_file, "%d %0100d needle\n", i, i);
+  }
+  fclose(grep_file);
+  grep_file = fopen("build/tests.grep/caf\xc3\xa9.txt", "w");
+  fprintf(grep_file, "needle\t\xc3\xa9");
+  fclose(grep_file);
+  grep_file = fopen("build/tests.grep/sub/c.bin", "w");
+  fwrite("needle\0", 1, 7, grep_file);
+  fclose(grep_file);
+  unlink("build/tests.grep/sub/up");
+  assert(symlink("..", "build/tests.grep/sub/up") == 0);
+
+  GrepSearch *grep = grep_search_create(&arena, Megabytes(2));
+  Memory grep_memory = {};
+  grep_search_start(grep, "needle", 6, "build/tests.grep/");
+  while (grep->running) {
+    grep_search_step(grep, &grep_memory);
+  }
+  assert(grep->match_count == 3 + 5000 && grep->file_count == 3);
+  assert(grep->files_searched == 4 && !grep->incomplete);
+  // NOTE: the :copen lines keep to the bytes a line can hold
+  char grep_line_text[GREP_PATH_SIZE + GREP_PREVIEW_SIZE + 32];
+  for (int32_t i = 0; i < grep->match_count; ++i) {
+    int32_t size = grep_match_format(grep, grep->matches + i, grep_line_text);
+    for (int32_t j = 0; j < size; ++j) {
+      assert(grep_line_text[j] >= ASCII_LOW && grep_line_text[j] <= ASCII_HIGH);
+    }
+    if (strstr(grep->files[grep->matches[i].file], "caf") != NULL) {
+      assert(strncmp(grep_line_text, "build/tests.grep/caf??.txt:0:0: needle?",
+                     39) == 0);
+    }
+  }
+  int32_t grep_line = 0;
+  for (int32_t i = 0; i < grep->match_count; ++i) {
+    GrepMatch *match = grep->matches + i;
+    char *path = grep->files[match->file];
+    if (strstr(path, "caf") != NULL) {
+      continue;
+    } else if (strcmp(path, "build/tests.grep/a.txt") == 0) {
+      assert(match->line_num == 1 ? match->column == 2
+                                  : match->line_num == 2 && match->column == 0);
+    } else {
+      assert(strcmp(path, "build/tests.grep/sub/b.log") == 0);
+      assert(match->line_num == grep_line++);
+      assert(match->preview_len == GREP_PREVIEW_SIZE ||
+             match->preview_len == match->column + 6);
+    }
+  }
+  assert(grep_line == 5000);
+  unlink("build/tests.grep/sub/up");
+  unlink("build/tests.grep/sub/c.bin");
+  unlink("build/tests.grep/sub/b.log");
+  unlink("build/tests.grep/a.txt");
+  unlink("build/tests.grep/caf\xc3\xa9.txt");
+  rmdir("build/tests.grep/sub");
+  rmdir("build/tests.grep");
+
+  //---- the file index ranks fuzzy matches, saves and rereads changed dirs
+  assert(mkdir("build/tests.index", 0755) == 0 || errno == EEXIST);
+  assert(mkdir("build/tests.index/src", 0755) == 0 || errno == EEXIST);
+  assert(mkdir("build/tests.index/.git", 0755) == 0 || errno == EEXIST);
+  char *index_files[] = {"build/tests.index/README.md",
+                         "build/tests.index/src/main.c",
+                         "build/tests.index/src/editor_frame.c",
+                         "build/tests.index/.git/config"};
+  for (int32_t i = 0; i < 4; ++i) {
+    fclose(fopen(index_files[i], "w"));
+  }
+  // NOTE: the files the editor writes in the tree are left out
+  fclose(fopen("build/tests.index/journal", "w"));
+  unlink("build/tests.files");
+  FileIndex *file_index = file_index_create(&arena, Kilobytes(128),
+                                            "build/tests.index",
+                                            "build/tests.files");
+  file_index_ignore(file_index, "build/tests.index/journal", "");
+  assert(file_index_ignored(file_index, "build/tests.files.tmp"));
+  file_index_refresh(file_index, &grep_memory);
+  assert(file_index->loading && !file_index->crawling);
+  do {
+    file_index_step(file_index, &grep_memory);
+  } while (file_index->crawling);
+  file_index_step(file_index, &grep_memory);
+  assert(file_index_list(file_index)->file_count == 3);
+  assert(file_index->dirs_read == 2 && file_index->dirs_reused == 0);
+  FileList *file_list = file_index_list(file_index);
+  file_index_rank(file_index, "EdFr", 4);
+  assert(file_index->result_count == 1);
+  assert(strcmp(file_list->files[file_index->results[0]], index_files[2]) ==
+         0);
+  file_index_rank(file_index, "c", 1);
+  assert(file_index->result_count == 2);
+  assert(strcmp(file_list->files[file_index->results[0]], index_files[1]) ==
+         0);
+  file_index_rank(file_index, "cx", 2);
+  assert(file_index->result_count == 0 && file_index->survivor_count == 0);
+
+  // NOTE: like a new session, the saved list is read before crawling. It is
+  // shown once the job that read it is collected
+  file_index->loaded = false;
+  file_list_reset(file_index->lists + file_index->current);
+  file_index_refresh(file_index, &grep_memory);
+  assert(file_index_list(file_index)->file_count == 0);
+  assert(file_index_step(file_index, &grep_memory));
+  assert(!file_index->loading && file_index->crawling);
+  assert(file_index_list(file_index)->file_count == 3);
+  while (file_index->crawling) {
+    file_index_step(file_index, &grep_memory);
+  }
+  assert(file_index->dirs_read == 0 && file_index->dirs_reused == 2);
+  assert(file_index_list(file_index)->file_count == 3);
+  fclose(fopen("build/tests.index/src/new.c", "w"));
+  file_index_step(file_index, &grep_memory);
+  file_index_refresh(file_index, &grep_memory);
+  while (file_index->crawling) {
+    file_index_step(file_index, &grep_memory);
+  }
+  assert(file_index_list(file_index)->file_count == 4);
+  assert(file_index->dirs_read == 1 && file_index->dirs_reused == 1);
+  unlink("build/tests.index/src/new.c");
+  for (int32_t i = 0; i < 4; ++i) {
+    unlink(index_files[i]);
+  }
+  unlink("build/tests.index/journal");
+  rmdir("build/tests.index/.git");
+  rmdir("build/tests.index/src");
+  rmdir("build/tests.index");
+  unlink("build/tests.files");
+
+  //---- V and Ctrl-V switch visual modes, block I and c repeat on every line
+  {
+    TemporaryMemory state_memory = beginTemporaryMemory(&transient_arena);
+    State *state = pushStruct(&transient_arena, State, DEFAULT_ALIGNMENT);
+    memset(state, 0, sizeof(*state));
+    editor_frame_close(&frame);
+    editor_frame_insert_text(&frame, "abcdefgh", 8);
+    editor_frame_insert_new_line(&frame);
+    editor_frame_insert_text(&frame, "ab", 2);
+    editor_frame_insert_new_line(&frame);
+    editor_frame_insert_text(&frame, "abcdefgh", 8);
+    state->editor_frame = frame;
+    EditorFrame *block_frame = &state->editor_frame;
+
+    visual_move_cursor(block_frame, 0, 3);
+    visual_begin(state, AppMode_visual_line);
+    visual_apply(state, KEY_CTRL_V);
+    assert(state->mode == AppMode_visual_block);
+    visual_apply(state, 'V');
+    assert(state->mode == AppMode_visual_line);
+    visual_apply(state, 'V');
+    assert(state->mode == AppMode_normal);
+    visual_begin(state, AppMode_visual_block);
+    visual_apply(state, KEY_CTRL_V);
+    assert(state->mode == AppMode_normal);
+
+    // NOTE: the short line in the middle is skipped
+    visual_begin(state, AppMode_visual_block);
+    visual_move_cursor(block_frame, 2, 4);
+    visual_apply(state, 'I');
+    assert(state->mode == AppMode_insert && block_frame->cursor.line_num == 0);
+    editor_frame_insert_text(block_frame, "XY", 2);
+    block_insert_end(state);
+    assert(strncmp(block_frame->index[0]->text, "abcXYdefgh", 10) == 0);
+    assert(block_frame->index[1]->len == 2);
+    assert(strncmp(block_frame->index[2]->text, "abcXYdefgh", 10) == 0);
+
+    // NOTE: c deletes the block first, text typed then backspaced is not
+    // repeated
+    visual_move_cursor(block_frame, 0, 3);
+    state->mode = AppMode_normal;
+    visual_begin(state, AppMode_visual_block);
+    visual_move_cursor(block_frame, 2, 4);
+    visual_apply(state, 'c');
+    assert(strncmp(block_frame->index[0]->text, "abcdefgh", 8) == 0);
+    editor_frame_insert_text(block_frame, "Z", 1);
+    block_insert_end(state);
+    assert(strncmp(block_frame->index[2]->text, "abcZdefgh", 9) == 0);
+    block_insert_begin(state, 0, 3, 3);
+    editor_frame_insert_text(block_frame, "W", 1);
+    editor_frame_remove_char(block_frame);
+    block_insert_end(state);
+    assert(strncmp(block_frame->index[2]->text, "abcZdefgh", 9) == 0);
+
+    // NOTE: a first line shorter than the block column gets the text at its
+    // end, the other lines at the block column
+    block_insert_begin(state, 1, 3, 5);
+    assert(block_frame->cursor.column == 2);
+    editor_frame_insert_text(block_frame, "--", 2);
+    block_insert_end(state);
+    assert(strncmp(block_frame->index[1]->text, "ab--", 4) == 0);
+    assert(strncmp(block_frame->index[2]->text, "abcZd--efgh", 11) == 0);
+
+    frame = state->editor_frame;
+    endTemporaryMemory(state_memory);
+    editor_frame_close(&frame);
+  }
+
+  //---- a cached atlas is used only when its pixels fill the file
+  {
+    GlyphAtlasFileHeader atlas = {.w = 10 * GLYPH_COUNT, .h = 20};
+    for (int32_t i = 0; i < GLYPH_COUNT; ++i) {
+      atlas.glyphs[i] = (SDL_Rect){.x = i * 10, .y = 0, .w = 10, .h = 20};
+    }
+    off_t atlas_size = sizeof(atlas) + atlas.w * atlas.h * 4;
+    assert(glyph_atlas_header_valid(&atlas, atlas_size));
+    assert(!glyph_atlas_header_valid(&atlas, atlas_size - 1));
+    atlas.h = INT32_MAX;
+    assert(!glyph_atlas_header_valid(&atlas, atlas_size));
+    atlas.h = 20;
+    atlas.glyphs[GLYPH_COUNT - 1].w = 11;
+    assert(!glyph_atlas_header_valid(&atlas, atlas_size));
+  }
+
+  //---- status text is cut at the end of its buffer
+  {
+    char text[8];
+    char *end = text + sizeof(text);
+    char *dest = format_append(text, end, "hello");
+    assert(dest == text + 5);
+    dest = format_append(dest, end, " %s", "world");
+    assert(dest == end - 1);
+    assert(strcmp(text, "hello w") == 0);
+    assert(format_append(dest, end, "more") == end - 1);
+    assert(strcmp(text, "hello w") == 0);
+  }
+
+  //---- latency percentiles are exact for small values, within a bucket above
+  LatencyHistogram histogram = {};
+  assert(latency_percentile(&histogram, 0.5) == 0);
+  for (uint32_t i = 1; i <= 100; ++i) {
+    latency_record(&histogram, i);
+  }
+  latency_record(&histogram, 100000);
+  assert(latency_percentile(&histogram, 0.1) == 10);
+  uint32_t p99 = latency_percentile(&histogram, 0.99);
+  assert(p99 >= 100 && p99 <= 100 + 100 / 16);
+  assert(latency_percentile(&histogram, 1.0) == 100000);
+  assert(histogram.max == 100000 && histogram.total == 101);
+  assert(latency_bucket(UINT32_MAX) == LATENCY_BUCKET_COUNT - 1);
+  assert(latency_bucket_max(LATENCY_BUCKET_COUNT - 1) == UINT32_MAX);
+  char latency_text[16];
+  assert(latency_format(latency_text, sizeof(latency_text), "keydown",
+                        &histogram) >= (int)sizeof(latency_text));
+  assert(strncmp(latency_text, "keydown p50 ", 12) == 0);
+  assert(strlen(latency_text) == sizeof(latency_text) - 1);
+
   return 0;
 }